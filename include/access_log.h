@@ -0,0 +1,48 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "config.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include <stddef.h>
+#include <arpa/inet.h>
+
+// One request being answered, completed once its last response byte is sent and then
+// reported to the metrics and, if sampling keeps it, the access log
+typedef struct access_record {
+    struct access_record *next;
+    long long start;            // Monotonic nanoseconds when the request's first byte arrived
+    long long first_byte;       // When the first response byte was sent, 0 before
+    size_t queued;              // Response bytes queued so far
+    size_t sent;
+    int queuing;                // The handler may still queue output for it
+    int status;
+    metrics_route_t route;
+    char client_ip[INET_ADDRSTRLEN];
+    char method[16];
+    char target[ACCESS_LOG_PATH_MAX];   // Path and query as the client sent them
+    char protocol[16];
+} access_record;
+
+// Open the configured access log and start its writer, does nothing when it is disabled
+int access_log_init(void);
+
+// Write out what is buffered and stop the writer
+void access_log_cleanup(void);
+
+// Whether finished records are written anywhere
+int access_log_enabled(void);
+
+// Monotonic nanoseconds, the clock records are timed with
+long long access_log_now(void);
+
+// Fill a record for a request, the slices are copied
+void access_log_begin(access_record *record, const char *client_ip, const http_request_t *req, long long start);
+
+// Write a finished record if sampling keeps it, end is when its last byte was sent
+void access_log_write(const access_record *record, long long end);
+
+// Records discarded because the writer fell behind
+unsigned long access_log_dropped(void);
+
+#endif
\ No newline at end of file
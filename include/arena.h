@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+// Bump allocator over pooled buffers, everything it hands out is released at once by arena_reset
+typedef struct {
+    struct arena_block *blocks;     // Newest first, allocations bump the first pooled one
+    size_t used;                    // Bytes taken from the current block
+    size_t reserved;                // Bytes held across all blocks
+} arena_t;
+
+// Start empty, an arena holds no memory until its first allocation
+void arena_init(arena_t *arena);
+
+// Allocate size bytes aligned for any type, larger requests than a pooled buffer get their own block
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Give every block back, invalidating all allocations
+void arena_reset(arena_t *arena);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+// Where the pool's buffers currently are
+typedef struct {
+    size_t in_use;
+    size_t cached;      // Held by per-thread caches
+    size_t free;        // On the shared free list
+} buffer_pool_stats_t;
+
+// Take a BUFFER_SIZE buffer, from the calling thread's cache when it has one, NULL when out of memory
+void *buffer_pool_get(void);
+
+// Give a buffer back, any thread may return a buffer another thread took
+void buffer_pool_put(void *buffer);
+
+// Count buffers by where they are, cached counts are read without stopping their threads
+void buffer_pool_stats(buffer_pool_stats_t *stats);
+
+// Free the shared list, buffers still in use or cached are not touched
+void buffer_pool_cleanup(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+
+// Compress input into a newly allocated gzip stream, returns 0 on success
+int gzip_compress(const void *input, size_t input_length, char **output, size_t *output_length);
+
+#endif
\ No newline at end of file
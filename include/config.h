@@ -1,9 +1,130 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
 #define PORT 8080
 #define BUFFER_SIZE 8192
 #define SMALL_BUFFER 1024
 #define ROOT_DIR "./www"
 
+// Pooled I/O buffers of BUFFER_SIZE: kept per thread, moved to and from the shared list in batches,
+// and freed once the shared list holds more than BUFFER_POOL_KEEP
+#define BUFFER_POOL_CACHE 64
+#define BUFFER_POOL_BATCH 16
+#define BUFFER_POOL_KEEP 1024
+
+// Request parsing limits
+#define MAX_HEADERS 64
+#define MAX_HEADER_SIZE BUFFER_SIZE
+#define MAX_CHUNK_LINE 1024
+
+// Request bodies larger than this are answered with 413
+#define MAX_BODY_SIZE (16 * 1024 * 1024)
+
+// Event loop
+#define MAX_EVENTS 256
+
+// Pending connections per listener, the kernel caps this at net.core.somaxconn
+#define LISTEN_BACKLOG 1024
+
+// Threaded mode: pool threads, connections waiting for one, and the Retry-After sent once that queue is full
+#define THREAD_POOL_SIZE 256
+#define THREAD_QUEUE_SIZE 1024
+#define THREAD_RETRY_AFTER 1
+
+// Persistent connections
+#define KEEPALIVE_TIMEOUT 5
+#define KEEPALIVE_MAX_REQUESTS 100
+
+// Connection deadlines in seconds, kept on a timing wheel advanced every TIMER_TICK_MS: the whole
+// request head, each wait for more of a request body, and the whole response
+#define TIMER_TICK_MS 100
+#define HEADER_TIMEOUT 10
+#define BODY_TIMEOUT 30
+#define RESPONSE_TIMEOUT 300
+
+// In-memory cache of small static files
+#define FILE_CACHE_SIZE (64 * 1024 * 1024)
+#define FILE_CACHE_MAX_FILE (64 * 1024)
+#define FILE_CACHE_REVALIDATE 1
+
+// Cache of open descriptors, stat results and misses
+#define FD_CACHE_TTL 2
+#define FD_CACHE_ENTRIES 4096
+
+// Files compressed on the fly, larger ones are only sent precompressed or as is
+#define COMPRESS_MIN_SIZE 256
+#define COMPRESS_MAX_FILE (1024 * 1024)
+
+// Directory listings are sent in chunks, and cached while they are not too large
+#define LISTING_CHUNK_SIZE (16 * 1024)
+#define LISTING_CACHE_MAX (1024 * 1024)
+
+// Ranges per request served as multipart/byteranges, more are answered with the whole file
+#define MAX_RANGES 16
+
+// Access log, rotated by size into ACCESS_LOG_KEEP numbered files
+#define ACCESS_LOG_MAX_SIZE (64 * 1024 * 1024)
+#define ACCESS_LOG_KEEP 5
+#define ACCESS_LOG_PATH_MAX 256
+
+// Cleartext HTTP/2: concurrent streams per connection, the receive window offered for each stream
+// and the connection, and the response bytes framed per pass before the socket is written to
+#define H2_MAX_STREAMS 100
+#define H2_WINDOW (1024 * 1024)
+#define H2_WRITE_BATCH (64 * 1024)
+
+// io_uring backend: queue depth, provided receive buffers of BUFFER_SIZE (a power of two),
+// registered file slots and the chunk files are read in before sending
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 256
+#define URING_FILE_SLOTS 1024
+#define URING_FILE_CHUNK (256 * 1024)
+
+// Connection handling model
+typedef enum {
+    SERVER_MODE_EPOLL = 0,
+    SERVER_MODE_THREADED = 1,
+    SERVER_MODE_URING = 2           // Falls back to epoll when io_uring is unavailable
+} server_mode_t;
+
+// Access log line layout
+typedef enum {
+    ACCESS_LOG_JSON = 0,
+    ACCESS_LOG_CLF = 1          // Common Log Format with the two timings appended
+} access_log_format_t;
+
+// Runtime settings, defaults above can be overridden from the environment
+typedef struct {
+    server_mode_t mode;
+    int workers;        // Event loops, each with its own SO_REUSEPORT listener
+    int pin_cpus;       // Pin each event loop thread to one CPU
+    int listen_backlog;
+    int threads;                    // Connections served at once in threaded mode
+    int thread_queue;               // Accepted connections waiting for a thread before new ones get a 503
+    int keepalive_timeout;          // Seconds an idle connection is kept open
+    int header_timeout;             // Seconds from a request's first byte to the end of its head, 0 for none
+    int body_timeout;               // Seconds a request body may stall, 0 for none
+    int response_timeout;           // Seconds a response may take to send, 0 for none
+    int keepalive_max_requests;     // Requests served before a connection is closed
+    size_t max_body_size;           // Largest request body accepted, 0 for no limit
+    size_t file_cache_size;         // Byte budget of the static file cache, 0 disables it
+    int fd_cache_ttl;               // Seconds a descriptor cache entry is trusted, 0 disables it
+    const char *mime_types;         // mime.types file extending the built-in types, NULL for none
+    const char *access_log;         // Access log path, NULL disables it
+    const char *site_pack;          // Archive built by ./sitepack served instead of ROOT_DIR, NULL for none
+    access_log_format_t access_log_format;
+    double access_log_sample;       // Share of requests logged
+    int access_log_always;          // Status classes logged regardless of sampling, bit n for nxx
+    size_t access_log_max_size;     // Rotate once the file grows past this, 0 never rotates
+    int http2;                      // Accept h2c by prior knowledge or Upgrade
+    int h2_max_streams;             // Streams a client may have open at once
+} server_config_t;
+
+extern server_config_t server_config;
+
+// Load settings from environment variables
+void config_load(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,192 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "config.h"
+#include "arena.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "timer_wheel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Result of driving a connection's socket
+typedef enum {
+    CONN_IO_DONE = 0,     // Finished, move to the next state
+    CONN_IO_AGAIN = 1,    // Socket would block, wait for readiness
+    CONN_IO_CLOSED = 2,   // Peer closed the connection
+    CONN_IO_ERROR = -1
+} conn_io_t;
+
+// Deadline a connection is held to, by what it is waiting for
+typedef enum {
+    TIMEOUT_IDLE,       // The next request's first byte
+    TIMEOUT_HEADER,     // The rest of a request head, from its first byte
+    TIMEOUT_BODY,       // More of a request body, from the last body bytes
+    TIMEOUT_RESPONSE,   // The peer taking the response, from when it started going out
+    TIMEOUT_NONE
+} conn_timeout_t;
+
+// Per-connection state machine
+typedef enum {
+    CONN_READING,   // Collecting request bytes
+    CONN_WRITING,   // Draining the queued response
+    CONN_DONE       // Ready to be closed
+} conn_state_t;
+
+typedef enum {
+    OUT_MEMORY,     // Response bytes, owned or referenced
+    OUT_FILE        // Range of an open file, owned or borrowed
+} out_type_t;
+
+// How a file segment reaches the socket
+typedef enum {
+    FILE_SENDFILE,
+    FILE_SPLICE,    // Through a pipe when sendfile isn't supported for the file
+    FILE_COPY       // pread and send when neither is
+} file_method_t;
+
+struct access_record;
+struct connection;
+struct h2_session;
+struct h2_stream;
+
+// Queued piece of response output
+typedef struct out_segment {
+    struct out_segment *next;
+    out_type_t type;
+    size_t remaining;   // Bytes left to send
+    const char *data;   // OUT_MEMORY: next byte to send
+    int fd;             // OUT_FILE: source file
+    off_t offset;       // OUT_FILE: next file offset
+    file_method_t method;
+    uint64_t file_id;   // OUT_FILE: identifies the open file to backends that register it, 0 if unknown
+    void (*release)(void *);    // Called once the segment is sent or dropped
+    void *release_arg;
+    struct access_record *record;   // Request its bytes are counted against, NULL for none
+    char payload[];
+} out_segment;
+
+// Receives a request body as it is decoded: data gets each piece in order, then end runs once the
+// body is complete and answers the request. abort runs instead when the body is cut short or
+// rejected, the connection answers for the handler then
+typedef struct {
+    void (*data)(struct connection *conn, void *ctx, const char *data, size_t length);
+    void (*end)(struct connection *conn, void *ctx);
+    void (*abort)(struct connection *conn, void *ctx);
+    void *ctx;
+} body_reader;
+
+typedef struct connection {
+    int fd;
+    struct sockaddr_in addr;
+    char client_ip[INET_ADDRSTRLEN];
+    conn_state_t state;
+    int keep_alive;             // Keep the connection open after the current response
+    int requests_served;
+    timer_entry timer;          // Deadline on the backend's timing wheel
+    conn_timeout_t timeout;     // Which deadline the timer is set for
+    long long timeout_mark;     // Body bytes received when the body deadline was last set
+    char *in_buf;               // Pooled BUFFER_SIZE buffer, only held while request bytes are waiting
+    size_t in_len;
+    arena_t arena;              // Request state, output segments and access records, reset between requests
+    http_request_t *request;    // Parser state for the request at the front of in_buf, in the arena
+    http_body_t body;           // Framing of the body arriving behind the request head
+    int receiving_body;         // The head is dispatched and its body is still arriving
+    int expect_continue;        // The client holds the body back until it gets 100 Continue
+    body_reader reader;         // Where the body goes, discarded when no handler asked for it
+    out_segment *out_head;
+    out_segment *out_tail;
+    int pipe_fds[2];            // Lazily created for splice fallback
+    size_t pipe_pending;        // Bytes spliced into the pipe but not yet sent
+    long long request_start;    // When the next request's first byte arrived, 0 before
+    metrics_route_t route;      // Handler answering the current request, set while dispatching
+    struct access_record *access_head;  // Requests whose response isn't fully sent, oldest first
+    struct access_record *access_tail;
+    struct h2_session *h2;      // Set once the connection speaks HTTP/2
+    struct h2_stream *stream;   // HTTP/2 stream being handled, its output and allocations go to it
+} connection_t;
+
+// Create connection state for an accepted socket
+connection_t *connection_create(int fd, const struct sockaddr_in *addr);
+
+// Close the socket and release all queued output
+void connection_destroy(connection_t *conn);
+
+// Read available request bytes and dispatch every complete request
+conn_io_t connection_read(connection_t *conn);
+
+// Send as much queued output as the socket accepts
+conn_io_t connection_flush(connection_t *conn);
+
+// For backends that do their own I/O: whether conn should receive now, returns the room left for
+// input, or 0 after moving it on to writing out queued or rejection output. Between requests this
+// also resets the arena and returns the input buffer to the pool
+size_t connection_prepare_read(connection_t *conn);
+
+// Where a backend should place received bytes, taking an input buffer from the pool if needed.
+// NULL when out of memory
+char *connection_input(connection_t *conn);
+
+// Dispatch length bytes a backend placed at connection_input
+void connection_received(connection_t *conn, size_t length);
+
+// Drop length sent bytes from the front of the queue, moving on once it is empty
+void connection_sent(connection_t *conn, size_t length);
+
+// Stream the current request's body to reader instead of discarding it, called by a handler that
+// then answers from reader->end. The request head stays valid until then
+void connection_read_body(connection_t *conn, const body_reader *reader);
+
+// Current tick of the clock deadlines are kept in, TIMER_TICK_MS long
+uint64_t connection_clock(void);
+
+// Set conn's timer on wheel for the deadline its state calls for. Idle, header and response
+// deadlines run from when the connection started waiting for that, the body deadline moves with
+// every read of the body. Called after each time the connection was driven
+void connection_watch(connection_t *conn, timer_wheel_t *wheel);
+
+// Count a missed deadline, the backend then closes the connection
+void connection_expired(connection_t *conn);
+
+// Whether the connection closes once its queued output is sent
+int connection_closing(const connection_t *conn);
+
+// Connection header value for the response being built
+const char *connection_token(const connection_t *conn);
+
+// Allocate memory that lives until the connection is between requests again
+void *connection_alloc(connection_t *conn, size_t size);
+
+// Queue a copy of data for sending
+int connection_queue_data(connection_t *conn, const void *data, size_t length);
+
+// Queue data without copying it, release(release_arg) runs once it is no longer needed
+int connection_queue_ref(connection_t *conn, const void *data, size_t length,
+                         void (*release)(void *), void *release_arg);
+
+// Queue length bytes of file_fd starting at offset, takes ownership of file_fd
+int connection_queue_file(connection_t *conn, int file_fd, off_t offset, size_t length);
+
+// Queue a range of a borrowed file_fd, release(release_arg) runs once it is no longer needed.
+// file_id names the open file for backends that register descriptors, 0 if it has no identity
+int connection_queue_file_ref(connection_t *conn, int file_fd, uint64_t file_id, off_t offset, size_t length,
+                              void (*release)(void *), void *release_arg);
+
+// For HTTP/2 framing: append a prepared segment to the socket's queue, counting its bytes against
+// record unless that is NULL
+void connection_queue_segment(connection_t *conn, out_segment *seg, struct access_record *record);
+
+// Let go of what a segment that will never be sent refers to
+void connection_release_segment(out_segment *seg);
+
+// Track a request's record, completed and reported by connection_end_record once its output is sent
+void connection_begin_record(connection_t *conn, struct access_record *record);
+
+// No more output will be queued for record
+void connection_end_record(connection_t *conn, struct access_record *record);
+
+#endif
\ No newline at end of file
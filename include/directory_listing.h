@@ -0,0 +1,14 @@
+#ifndef DIRECTORY_LISTING_H
+#define DIRECTORY_LISTING_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Receives rendered HTML in pieces of at most LISTING_CHUNK_SIZE bytes
+typedef void (*listing_sink)(void *arg, const char *data, size_t length);
+
+// Render an HTML listing of dir_path, st receives the directory's stat from before it was read.
+// Returns -1 when the directory cannot be opened, nothing has been emitted then
+int generate_directory_listing(const char *dir_path, struct stat *st, listing_sink sink, void *arg);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,7 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+// Run an edge-triggered epoll reactor owning listen_fd and every accepted client
+int event_loop_run(int listen_fd);
+
+#endif
\ No newline at end of file
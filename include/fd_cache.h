@@ -0,0 +1,40 @@
+#ifndef FD_CACHE_H
+#define FD_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Open file and stat result for a resolved path, or a cached miss
+typedef struct fd_cache_entry {
+    struct fd_cache_entry *hash_next;
+    struct fd_cache_entry *clock_prev;
+    struct fd_cache_entry *clock_next;
+    uint32_t hash;
+    int refcount;               // One for the cache, one per user such as an in-flight sendfile
+    int referenced;             // CLOCK bit, set on every hit
+    int linked;                 // Still reachable through the cache
+    time_t expires;             // Monotonic seconds after which the entry is reopened
+    int missing;                // Path does not exist, st and fd are unset
+    int fd;                     // Open for regular files, -1 otherwise
+    uint64_t id;                // Never reused, tells descriptors apart once fd numbers are recycled
+    struct stat st;
+    char path[];
+} fd_cache_entry;
+
+// Set up the cache, a ttl of 0 disables caching but lookups still work
+int fd_cache_init(int ttl, int max_entries);
+
+// Close every cached descriptor
+void fd_cache_cleanup(void);
+
+// Resolve path through the cache, the caller owns a reference, NULL only when out of memory
+fd_cache_entry *fd_cache_open(const char *path);
+
+// Take an extra reference
+void fd_cache_retain(fd_cache_entry *entry);
+
+// Drop a reference, the descriptor is closed with the last one
+void fd_cache_release(fd_cache_entry *entry);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Cached response body with its pre-rendered header, keyed by source path and variant
+typedef struct file_cache_entry {
+    struct file_cache_entry *hash_next;
+    struct file_cache_entry *clock_prev;
+    struct file_cache_entry *clock_next;
+    char *path;                 // File whose changes invalidate the entry
+    char *variant;              // Representation, such as "" or "gzip"
+    uint32_t hash;
+    int refcount;               // One for the cache, one per in-flight response
+    int referenced;             // CLOCK bit, set on every hit
+    int linked;                 // Still reachable through the cache
+    time_t validated;           // Monotonic seconds of the last mtime check
+    struct timespec mtime;
+    off_t size;
+    ino_t ino;
+    const char *header;         // Status line and entity headers, no Connection line
+    size_t header_length;
+    const char *body;
+    size_t body_length;
+    char data[];                // Header followed by body
+} file_cache_entry;
+
+// Set up the cache with a total byte budget, 0 disables it
+int file_cache_init(size_t budget);
+
+// Release every entry
+void file_cache_cleanup(void);
+
+// Find a fresh entry, the caller owns a reference on success
+file_cache_entry *file_cache_lookup(const char *path, const char *variant);
+
+// Read a small open file into the cache, the caller owns a reference on success
+file_cache_entry *file_cache_insert(const char *path, const char *variant, int fd, const struct stat *st,
+                                    const char *header, size_t header_length);
+
+// Cache a derived body such as a compressed copy of path
+file_cache_entry *file_cache_store(const char *path, const char *variant, const struct stat *st,
+                                   const char *header, size_t header_length,
+                                   const void *body, size_t body_length);
+
+// Take an extra reference
+void file_cache_retain(file_cache_entry *entry);
+
+// Drop a reference taken by lookup or insert
+void file_cache_release(file_cache_entry *entry);
+
+#endif
\ No newline at end of file
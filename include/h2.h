@@ -0,0 +1,55 @@
+#ifndef H2_H
+#define H2_H
+
+#include "connection.h"
+#include "access_log.h"
+#include "http_parser.h"
+#include <stddef.h>
+
+// Cleartext HTTP/2 (RFC 9113). A connection switches over on the client preface or an h2c
+// upgrade, then carries any number of streams. Each stream's request is handed to the same
+// handlers as HTTP/1: while one runs, conn->stream is set and the response it queues is held by
+// the stream, then converted into HEADERS and DATA frames as flow control allows
+
+struct h2_session;
+struct h2_stream;
+
+// Whether buf opens with the client connection preface: 1 when it does, 0 while it is too short
+// to tell, -1 when it is something else
+int h2_preface(const char *buf, size_t length);
+
+// Switch a connection whose input starts with the preface to HTTP/2
+void h2_start(connection_t *conn);
+
+// Answer an HTTP/1.1 request asking to upgrade to h2c with 101 and serve it as stream 1.
+// Returns -1 when the request doesn't qualify and is to be served as HTTP/1.1 instead
+int h2_upgrade(connection_t *conn, const http_request_t *req);
+
+// Process the frames received so far, leaving any partial frame at the front of in_buf
+void h2_received(connection_t *conn);
+
+// Frame more of the streams' output into the connection's queue
+void h2_write(connection_t *conn);
+
+// Whether the connection closes once its queued output is sent
+int h2_closing(const connection_t *conn);
+
+// Deadline the connection is held to while nothing is queued
+conn_timeout_t h2_timeout(const connection_t *conn);
+
+// Free the session and every stream
+void h2_destroy(connection_t *conn);
+
+// Memory that lives as long as the stream
+void *h2_stream_alloc(struct h2_stream *stream, size_t size);
+
+// Hold a segment of the stream's response until it is framed
+void h2_stream_queue(struct h2_stream *stream, out_segment *seg);
+
+// Stream the request body to reader, as connection_read_body does for HTTP/1
+void h2_stream_read_body(struct h2_stream *stream, const body_reader *reader);
+
+// A stream's record has been reported, its response is fully sent and the stream can go
+void h2_record_sent(connection_t *conn, access_record *record);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include "arena.h"
+#include "http_parser.h"
+#include <stddef.h>
+
+// HPACK (RFC 7541) header compression for HTTP/2. Both directions start from the static table;
+// each also keeps a dynamic table of recent fields, at most HPACK_TABLE_SIZE bytes, the default
+// SETTINGS_HEADER_TABLE_SIZE and the most either side uses here
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+// Upper bound on the bytes hpack_encode writes for one field
+#define HPACK_FIELD_MAX(name_length, value_length) ((name_length) + (value_length) + 12)
+
+struct hpack_entry;
+
+// Dynamic table of one direction, newest entry first, evicted oldest first
+typedef struct {
+    struct hpack_entry *entries[HPACK_MAX_ENTRIES];    // Ring of entries, newest at slot newest
+    unsigned newest;
+    unsigned count;
+    size_t size;                // Entry sizes as RFC 7541 counts them, 32 bytes over name and value
+    size_t max_size;
+    int size_changed;           // Encoder: the new max_size is announced at the start of the next block
+} hpack_table;
+
+// Build the Huffman code tables, once at startup
+void hpack_init(void);
+
+// Start an empty dynamic table of HPACK_TABLE_SIZE bytes
+void hpack_table_init(hpack_table *table);
+
+// Free the table's entries
+void hpack_table_cleanup(hpack_table *table);
+
+// Decode a header block into fields copied into arena. Only the first max fields are stored, but
+// the whole block is always decoded so the table stays in step with the peer's. Returns the number
+// of fields in the block, or -1 when it is malformed, which the connection can't recover from
+int hpack_decode(hpack_table *table, const unsigned char *block, size_t length, arena_t *arena,
+                 http_header *fields, int max);
+
+// Limit the encoder's table to size bytes, at most HPACK_TABLE_SIZE, as the peer's
+// SETTINGS_HEADER_TABLE_SIZE allows
+void hpack_set_max_size(hpack_table *table, size_t size);
+
+// Start a header block, returns the bytes written to out, at most 8
+size_t hpack_begin_block(hpack_table *table, unsigned char *out);
+
+// Encode a :status field, returns the bytes written to out, at most 8
+size_t hpack_encode_status(hpack_table *table, unsigned char *out, int status);
+
+// Encode a field with a lowercase name, indexing it unless its value is unlikely to repeat.
+// Returns the bytes written to out, at most HPACK_FIELD_MAX
+size_t hpack_encode(hpack_table *table, unsigned char *out, const char *name, size_t name_length,
+                    const char *value, size_t value_length);
+
+#endif
\ No newline at end of file
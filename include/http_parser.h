@@ -0,0 +1,115 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include "config.h"
+#include <stddef.h>
+#include <time.h>
+
+// View into the connection buffer, not NUL-terminated
+typedef struct {
+    const char *data;
+    size_t length;
+} http_slice;
+
+typedef struct {
+    http_slice name;
+    http_slice value;
+} http_header;
+
+// Satisfiable byte range, both ends inclusive
+typedef struct {
+    long long first;
+    long long last;
+} http_range;
+
+typedef enum {
+    HTTP_PARSE_DONE = 0,            // Request head is complete
+    HTTP_PARSE_INCOMPLETE = 1,      // Need more bytes
+    HTTP_PARSE_ERROR = -1,          // Malformed request
+    HTTP_PARSE_TOO_LARGE = -2       // Header count or size limit exceeded
+} http_parse_result;
+
+typedef struct {
+    // Request line and headers, valid until the buffer is consumed
+    http_slice method;
+    http_slice path;
+    http_slice query;
+    http_slice version;
+    http_header headers[MAX_HEADERS];
+    int header_count;
+
+    // Derived while parsing
+    int version_major;          // 2 for requests arriving as HTTP/2 streams
+    int version_minor;
+    long long content_length;   // -1 when absent
+    int chunked;
+    int keep_alive;
+    size_t header_length;       // Bytes up to and including the blank line
+
+    // Resume state, the buffer may grow between calls but must not move
+    int state;
+    int connection_close;
+    int connection_keep_alive;
+    size_t line_start;
+} http_request_t;
+
+typedef enum {
+    HTTP_BODY_DONE = 0,             // Body and any trailer are complete
+    HTTP_BODY_INCOMPLETE = 1,       // Need more bytes
+    HTTP_BODY_ERROR = -1            // Malformed chunked framing
+} http_body_result;
+
+// Request body framing, decoded in place as the body arrives
+typedef struct {
+    int state;
+    long long remaining;        // Bytes left in the body or the current chunk
+    long long received;         // Body bytes decoded so far, without framing
+    size_t trailer_length;      // Trailer bytes skipped so far
+} http_body_t;
+
+// Reset parser state for the next request
+void http_parser_init(http_request_t *req);
+
+// Parse as much of the request head in buf as is available
+http_parse_result http_parse_request(http_request_t *req, const char *buf, size_t length);
+
+// Add a header to req, interpreting framing and persistence headers as they are added. Used by the
+// parser and for headers that don't arrive as text, such as decoded HTTP/2 fields
+http_parse_result http_add_header(http_request_t *req, http_slice name, http_slice value);
+
+// Start decoding the body framed by req's Content-Length or chunked coding
+void http_body_init(http_body_t *body, const http_request_t *req);
+
+// Decode body bytes from buf, setting *consumed to the bytes used and *data to the body bytes among
+// them, at most one run per call. Framing lines are only consumed once complete, so the caller keeps
+// unconsumed bytes and calls again with more appended
+http_body_result http_body_decode(http_body_t *body, const char *buf, size_t length, size_t *consumed,
+                                  http_slice *data);
+
+// Look up a header value by case-insensitive name
+const http_slice *http_get_header(const http_request_t *req, const char *name);
+
+// Check whether a comma-separated header value contains token
+int http_has_token(http_slice value, const char *token);
+
+// Whether an Accept-Encoding value allows coding with a non-zero quality
+int http_accepts_coding(const http_slice *accept, const char *coding);
+
+// Whether an If-None-Match list holds etag or "*", using weak comparison
+int http_etag_matches(const http_slice *list, const char *etag);
+
+// Parse an HTTP date such as If-Modified-Since, returns -1 when absent or malformed
+time_t http_parse_date(const http_slice *value);
+
+// Resolve a Range header against a representation of size bytes into at most max ranges.
+// Returns the number of satisfiable ranges, 0 when none is, or -1 when the header should be ignored
+int http_parse_ranges(const http_slice *value, long long size, http_range *ranges, int max);
+
+// Compare a slice against a string
+int http_slice_equals(http_slice slice, const char *str);
+int http_slice_equals_nocase(http_slice slice, const char *str);
+
+// Percent-decode a request path into out, returns the decoded length or -1
+int http_decode_path(http_slice path, char *out, size_t out_size);
+
+#endif
\ No newline at end of file
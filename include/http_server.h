@@ -3,12 +3,9 @@
 
 #include <netinet/in.h>
 
-typedef struct {
-    int client_socket;
-    struct sockaddr_in client_addr;
-} client_info;
-
 int initialize_server(void);
-void *handle_client(void *arg);
+
+// Serve one connection on the calling thread with blocking I/O until it closes
+void handle_client(int client_fd, const struct sockaddr_in *client_addr);
 
 #endif
\ No newline at end of file
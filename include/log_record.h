@@ -0,0 +1,43 @@
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Kinds of binary log records
+typedef enum {
+    LOG_RECORD_MESSAGE = 1,     // Format and file pointers with the raw arguments
+    LOG_RECORD_STRING = 2,      // Text of a format or file pointer, precedes its first use
+    LOG_RECORD_START = 3        // A server run begins, earlier pointers no longer apply
+} log_record_kind;
+
+// Fixed header of every binary record, native byte order
+typedef struct {
+    uint32_t length;            // Header plus payload
+    uint16_t kind;
+    uint16_t level;
+    uint32_t line;
+    uint32_t reserved;
+    uint64_t timestamp;         // Wall clock nanoseconds
+    uint64_t format;            // Pointer identifying the format string
+    uint64_t file;              // Pointer identifying the source file name
+} log_record;
+
+// Level name and color as they appear in text lines, such as "INFO " in green
+const char *log_level_prefix(int level);
+
+// Write "[YYYY-mm-dd HH:MM:SS.mmm] " into out, which must hold 32 bytes.
+// Only the milliseconds are rendered again while the second stays the same on this thread
+size_t log_timestamp(char *out, time_t seconds, long milliseconds);
+
+// Encode a message record with its arguments walked according to fmt, returns 0 when it does not fit
+size_t log_record_encode(char *out, size_t size, int level, const char *file, int line,
+                         uint64_t timestamp, const char *fmt, va_list args);
+
+// Render a message record as a text line ending in a newline, given the strings its pointers name
+size_t log_record_render(const log_record *record, const char *fmt, const char *file,
+                         char *out, size_t size);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Single-producer single-consumer byte ring, owned by one thread and drained by its set's writer
+typedef struct log_ring {
+    struct log_ring *next;
+    int closed;                                 // Owning thread has exited
+    _Alignas(64) size_t head;                   // Bytes written, advanced by the producer
+    _Alignas(64) size_t tail;                   // Bytes consumed, advanced by the writer
+    char data[];                                // ring_size bytes
+} log_ring;
+
+// Empties the rings on the writer thread, moving each tail past what it has written
+typedef void (*log_ring_drain)(log_ring *rings);
+
+// One ring per producing thread, created on its first line, and a writer thread draining them all
+typedef struct {
+    // Set before log_ring_start
+    size_t ring_size;                           // Power of two, larger than any line
+    size_t flush_bytes;                         // A ring holding this much wakes the writer early
+    int flush_interval_ms;                      // The writer drains at least this often
+    int block;                                  // Producers of full rings wait instead of dropping
+    log_ring_drain drain;
+
+    pthread_t writer_thread;
+    volatile int running;
+    pthread_mutex_t mutex;                      // Guards the ring list and the wakeups below
+    pthread_cond_t wake;                        // Signalled when a ring needs draining
+    pthread_cond_t drained;                     // Broadcast after each drain for blocked producers
+    int waiters;
+    log_ring *rings;
+    pthread_key_t ring_key;
+    unsigned long dropped;
+} log_ring_set;
+
+// Start the writer thread, returns -1 when it can't be created
+int log_ring_start(log_ring_set *set);
+
+// Drain what is left, stop the writer and free the rings. Threads still alive drop their lines
+void log_ring_stop(log_ring_set *set);
+
+// Copy bytes into the calling thread's ring. A full ring drops them, or waits when the set blocks.
+// Urgent lines wake the writer straight away
+void log_ring_enqueue(log_ring_set *set, const void *data, size_t length, int urgent);
+
+// Count a line lost before it reached a ring
+void log_ring_drop(log_ring_set *set);
+
+// Lines dropped so far
+unsigned long log_ring_dropped(log_ring_set *set);
+
+// Bytes enqueued but not yet drained, across all rings
+size_t log_ring_pending(log_ring_set *set);
+
+// Copy bytes out of a ring starting at position, following the wrap
+void log_ring_copy(const log_ring_set *set, const log_ring *ring, size_t position, void *out, size_t length);
+
+// Drain every ring through as few write_batch calls as possible, tails only move once it returns
+void log_ring_flush(const log_ring_set *set, log_ring *rings, void (*write_batch)(struct iovec *iov, int count));
+
+// Write iov out completely, returns the bytes written before any error
+size_t log_ring_writev(int fd, struct iovec *iov, int count);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define LOGGER_H
 
 #include <stdarg.h>
+#include <stddef.h>
 
 // Log levels
 typedef enum {
@@ -13,6 +14,19 @@ typedef enum {
     LOG_FATAL = 5
 } log_level_t;
 
+// What a thread does when its log ring is full
+typedef enum {
+    LOG_OVERFLOW_DROP = 0,      // Discard the line and count it
+    LOG_OVERFLOW_BLOCK = 1      // Wait for the writer to make room
+} log_overflow_t;
+
+// Where log lines are formatted
+typedef enum {
+    LOG_FORMAT_TEXT = 0,        // On the logging thread
+    LOG_FORMAT_DEFERRED = 1,    // On the writer thread, from the raw arguments
+    LOG_FORMAT_BINARY = 2       // Not at all, records go to <log>.bin for tools/logdecode
+} log_format_t;
+
 // Color codes
 #define COLOR_RESET   "\x1B[0m"
 #define COLOR_RED     "\x1B[31m"
@@ -32,6 +46,12 @@ void logger_cleanup(void);
 // Set log level
 void logger_set_level(log_level_t level);
 
+// Lines discarded because a ring was full
+unsigned long logger_dropped(void);
+
+// Bytes logged but not yet written, across all rings
+size_t logger_pending(void);
+
 // Log functions
 void log_trace(const char *file, int line, const char *fmt, ...);
 void log_debug(const char *file, int line, const char *fmt, ...);
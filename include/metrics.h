@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+// Plain event counters
+typedef enum {
+    METRIC_CONNECTIONS_OPENED = 0,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_CONNECTIONS_REJECTED,
+    METRIC_TIMEOUTS_IDLE,           // Connections closed for missing a deadline, by the deadline
+    METRIC_TIMEOUTS_HEADER,
+    METRIC_TIMEOUTS_BODY,
+    METRIC_TIMEOUTS_RESPONSE,
+    METRIC_FILE_CACHE_HITS,
+    METRIC_FILE_CACHE_MISSES,
+    METRIC_FD_CACHE_HITS,
+    METRIC_FD_CACHE_MISSES,
+    METRIC_H2_CONNECTIONS,          // Connections switched to HTTP/2
+    METRIC_H2_STREAMS,
+    METRIC_COUNTERS
+} metrics_counter_t;
+
+// Handler that answered a request
+typedef enum {
+    ROUTE_NONE = 0,             // Rejected before or by dispatch
+    ROUTE_STATIC,
+    ROUTE_LISTING,
+    ROUTE_PING,
+    ROUTE_METRICS,
+    ROUTE_COUNT
+} metrics_route_t;
+
+// Set up the shard registry
+int metrics_init(void);
+
+// Release every shard
+void metrics_cleanup(void);
+
+// Add one to a counter in the calling thread's shard
+void metrics_count(metrics_counter_t counter);
+
+// Record a finished request, duration is in nanoseconds from its first byte to its last response byte
+void metrics_request(const char *method, metrics_route_t route, int status, size_t bytes, long long duration);
+
+// Merge every shard into Prometheus text exposition format, the caller frees the result
+char *metrics_render(size_t *length);
+
+#endif
\ No newline at end of file
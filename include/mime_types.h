@@ -1,11 +1,41 @@
 #ifndef MIME_TYPES_H
 #define MIME_TYPES_H
 
+#include <stddef.h>
+
 typedef struct {
-    const char *extension;
+    const char *extension;      // Lowercase, without the dot
     const char *mime_type;
 } mime_map;
 
+typedef struct {
+    const char *mime_type;
+    const char *cache_control;
+} cache_policy;
+
+// A type with everything responses need from it, header lines rendered once at startup
+typedef struct {
+    const char *mime_type;          // Bare type, such as "text/html"
+    const char *content_type;       // Content-Type value, text types carry a charset
+    const char *cache_control;
+    int compressible;               // Worth compressing, responses then vary on Accept-Encoding
+    const char *type_header;        // "Content-Type: ...\r\n"
+    size_t type_header_length;
+    const char *policy_headers;     // "Cache-Control: ...\r\n", then Vary when compressible
+    size_t policy_headers_length;
+} mime_entry;
+
+// Build the lookup table from the built-in types and, when path is set, a mime.types file whose
+// extensions take precedence. Returns 1 when the file can't be read and only the built-in types are
+// used, -1 when the table couldn't be built at all
+int mime_types_init(const char *path);
+
+// Release the table
+void mime_types_cleanup(void);
+
+// Type of a file by its extension, application/octet-stream when it has none or an unknown one
+const mime_entry *mime_lookup(const char *path);
+
 const char* get_mime_type(const char *path);
 
 #endif
\ No newline at end of file
@@ -1,9 +1,13 @@
 #ifndef REQUEST_HANDLER_H
 #define REQUEST_HANDLER_H
+#include "connection.h"
+#include "http_parser.h"
 #include <stddef.h>
 
-void serve_static_file(int client_socket, const char *path);
-void handle_post_ping(int client_socket, const char *body);
-void generate_directory_listing(const char *dir_path, char *output, size_t output_size);
+// Answer req, or attach a body reader that answers once the body is in
+void handle_request(connection_t *conn, const http_request_t *req);
+void serve_static_file(connection_t *conn, const http_request_t *req);
+void handle_post_ping(connection_t *conn);
+void handle_get_metrics(connection_t *conn);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include "connection.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Response being assembled on a connection. The head is rendered into the connection's arena
+// and queued as one segment ahead of the body segments, which the connection then sends with
+// one sendmsg per run of memory segments
+typedef struct {
+    connection_t *conn;
+    char *head;
+    size_t length;
+    size_t capacity;
+    int head_sent;
+    int failed;         // Something could not be queued, the response is incomplete
+} response_t;
+
+// Start a response with its status line, such as "200 OK"
+void response_begin(response_t *res, connection_t *conn, const char *status);
+
+// Start a response from a pre-rendered status line and entity headers
+void response_begin_rendered(response_t *res, connection_t *conn, const char *head, size_t length);
+
+// Add one header line, format renders its value
+void response_header(response_t *res, const char *name, const char *format, ...);
+
+// Add pre-rendered header lines, each ending in CRLF
+void response_headers(response_t *res, const char *lines, size_t length);
+
+// Finish the head with Date and Connection and queue it, called implicitly by the body functions
+void response_end_head(response_t *res);
+
+// Queue a copy of body bytes
+void response_body(response_t *res, const void *data, size_t length);
+
+// Queue body bytes without copying them, release(release_arg) runs once they are no longer needed
+void response_body_ref(response_t *res, const void *data, size_t length, void (*release)(void *), void *release_arg);
+
+// Queue a range of a borrowed file, release(release_arg) runs once it is no longer needed
+void response_body_file(response_t *res, int file_fd, uint64_t file_id, off_t offset, size_t length,
+                        void (*release)(void *), void *release_arg);
+
+// Queue whatever is left of the head, returns -1 when any part could not be queued, in which case
+// the connection is closed once the partial response is out
+int response_finish(response_t *res);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#ifndef SITE_PACK_H
+#define SITE_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Static site packed into one file by ./sitepack, served from a read-only mapping with no filesystem
+// access per request. Offsets count from the start of the file and every structure is written in
+// the byte order of the machine that packs it
+#define SITE_PACK_MAGIC "WEBPACK1"
+#define SITE_PACK_VERSION 1
+
+// Representations of a file, encoded ones only for compressible types
+enum {
+    PACK_IDENTITY,
+    PACK_GZIP,
+    PACK_BR,
+    PACK_VARIANTS
+};
+
+// Entry flags
+#define PACK_LISTING 0x1            // A rendered directory listing, served as is
+#define PACK_COMPRESSIBLE 0x2       // Responses vary on Accept-Encoding
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t slot_count;            // Power of two, at least twice entry_count
+    uint32_t reserved;
+    uint64_t entries;               // pack_entry[entry_count]
+    uint64_t slots;                 // uint32_t[slot_count], entry index plus one, 0 when empty
+    uint64_t size;                  // Whole file
+} pack_header;
+
+// One representation: its status line and entity headers, as file responses render them, its ETag
+// and its body. head_length is 0 when the entry doesn't have it
+typedef struct {
+    uint64_t head;
+    uint64_t etag;
+    uint64_t body;
+    uint64_t body_length;
+    uint32_t head_length;
+    uint32_t etag_length;
+} pack_variant;
+
+typedef struct {
+    uint64_t path;                  // Decoded request path, such as "/css/site.css"
+    uint32_t path_length;
+    uint32_t hash;
+    uint32_t flags;
+    uint32_t type_header_length;
+    uint64_t type_header;           // "Content-Type: ...\r\n" for 304 and 206 responses
+    uint64_t policy_headers;        // Cache-Control, and Vary when compressible
+    uint64_t policy_headers_length;
+    int64_t mtime;
+    char last_modified[32];
+    pack_variant variants[PACK_VARIANTS];
+} pack_entry;
+
+// Hash of a request path, shared by the packer and lookups
+uint32_t site_pack_hash(const char *path, size_t length);
+
+// Map a pack built by ./sitepack, returns -1 when it can't be read or isn't one
+int site_pack_open(const char *path);
+
+// Unmap the pack
+void site_pack_close(void);
+
+// Whether requests are served from a pack
+int site_pack_loaded(void);
+
+// Entry for a decoded request path, NULL when the pack doesn't have it
+const pack_entry *site_pack_lookup(const char *path, size_t length);
+
+// Bytes at an offset of the mapping
+const char *site_pack_data(uint64_t offset);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <netinet/in.h>
+
+// Serves one accepted connection on a pool thread, owns the socket
+typedef void (*thread_pool_handler)(int client_fd, const struct sockaddr_in *client_addr);
+
+// Start threads workers sharing a queue of at most capacity waiting connections
+int thread_pool_init(int threads, int capacity, thread_pool_handler handler);
+
+// Queue an accepted connection, returns -1 without taking the socket when the queue is full
+int thread_pool_submit(int client_fd, const struct sockaddr_in *client_addr);
+
+// Connections waiting for a thread
+int thread_pool_depth(void);
+
+// Threads currently serving a connection
+int thread_pool_busy(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel: TIMER_LEVELS levels of TIMER_SLOTS slots, each level TIMER_SLOTS
+// times coarser than the one below. Scheduling and cancelling are O(1), timers due further out
+// than the top level reaches are clamped to it
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
+// Timer embedded in its owner, unlinked while it isn't scheduled
+typedef struct timer_entry {
+    struct timer_entry *next;
+    struct timer_entry **pprev;     // Link pointing at this entry, NULL when not scheduled
+    uint64_t expires;               // Tick the timer is due at
+    void *data;                     // Owner, handed back on expiry
+} timer_entry;
+
+typedef struct {
+    uint64_t now;                   // Last tick processed
+    size_t count;                   // Timers scheduled
+    timer_entry *slots[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel_t;
+
+// Start an empty wheel at tick now
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+// Prepare an unscheduled timer belonging to data
+void timer_init(timer_entry *timer, void *data);
+
+// Whether the timer is scheduled
+int timer_pending(const timer_entry *timer);
+
+// Schedule the timer to fire at tick expires, moving it if it was already scheduled.
+// Ticks at or before the wheel's current one fire on the next advance
+void timer_schedule(timer_wheel_t *wheel, timer_entry *timer, uint64_t expires);
+
+// Unschedule the timer, does nothing when it isn't scheduled
+void timer_cancel(timer_wheel_t *wheel, timer_entry *timer);
+
+// Process every tick up to now, calling expire(data, arg) for each timer that falls due. The
+// timer is unscheduled first, so expire may free its owner or schedule it again
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now, void (*expire)(void *data, void *arg), void *arg);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+// Whether this kernel supports everything the io_uring backend uses
+int uring_loop_available(void);
+
+// Run an io_uring reactor owning listen_fd and every accepted client
+int uring_loop_run(int listen_fd);
+
+#endif
\ No newline at end of file
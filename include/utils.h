@@ -1,9 +1,10 @@
 #ifndef UTILS_H
 #define UTILS_H
+#include "connection.h"
 #include <stddef.h>
 
-void send_response(int client_socket, const char *status, const char *content_type, 
+void send_response(connection_t *conn, const char *status, const char *content_type, 
                   const void *body, size_t body_length);
-void send_simple_response(int client_socket, const char *status, const char *content_type);
+void send_simple_response(connection_t *conn, const char *status, const char *content_type);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "access_log.h"
+#include "log_ring.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Per-thread ring of formatted lines, a power of two
+#define ACCESS_RING_SIZE (64 * 1024)
+#define ACCESS_LINE_MAX 1024
+
+// The writer flushes once a ring holds this much, or after the interval at the latest
+#define ACCESS_FLUSH_BYTES (32 * 1024)
+#define ACCESS_FLUSH_INTERVAL_MS 250
+
+static void drain_rings(log_ring *rings);
+
+// Full rings drop lines, requests never wait on the access log
+static struct {
+    int enabled;
+    int fd;
+    size_t file_size;
+    log_ring_set rings;
+} access_log = {
+    .enabled = 0,
+    .fd = -1,
+    .rings = {
+        .ring_size = ACCESS_RING_SIZE,
+        .flush_bytes = ACCESS_FLUSH_BYTES,
+        .flush_interval_ms = ACCESS_FLUSH_INTERVAL_MS,
+        .drain = drain_rings
+    }
+};
+
+// Per-thread wall clock text, rebuilt once per second
+static __thread struct {
+    time_t seconds;
+    char text[40];
+    size_t length;
+} stamp = {
+    .seconds = -1
+};
+
+// Per-thread sampling state, xorshift seeded from the thread's first record
+static __thread uint64_t sample_state;
+
+static int open_log(void) {
+    access_log.fd = open(server_config.access_log, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (access_log.fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    access_log.file_size = fstat(access_log.fd, &st) == 0 ? (size_t)st.st_size : 0;
+    return 0;
+}
+
+int access_log_init(void) {
+    if (!server_config.access_log) {
+        return 0;
+    }
+
+    if (open_log() == -1) {
+        ERROR("Failed to open access log %s: %s", server_config.access_log, strerror(errno));
+        return -1;
+    }
+
+    if (log_ring_start(&access_log.rings) != 0) {
+        ERROR("Failed to create access log thread");
+        close(access_log.fd);
+        access_log.fd = -1;
+        return -1;
+    }
+
+    access_log.enabled = 1;
+    INFO("Writing access log to %s", server_config.access_log);
+    return 0;
+}
+
+void access_log_cleanup(void) {
+    if (!access_log.enabled) {
+        return;
+    }
+
+    log_ring_stop(&access_log.rings);
+    access_log.enabled = 0;
+    close(access_log.fd);
+    access_log.fd = -1;
+}
+
+int access_log_enabled(void) {
+    return access_log.enabled;
+}
+
+long long access_log_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+unsigned long access_log_dropped(void) {
+    return log_ring_dropped(&access_log.rings);
+}
+
+// Copy a slice into a fixed field, truncating it
+static void copy_slice(char *out, size_t size, http_slice slice) {
+    size_t length = slice.length < size - 1 ? slice.length : size - 1;
+    if (length > 0) {
+        memcpy(out, slice.data, length);
+    }
+    out[length] = '\0';
+}
+
+void access_log_begin(access_record *record, const char *client_ip, const http_request_t *req, long long start) {
+    record->next = NULL;
+    record->start = start;
+    record->first_byte = 0;
+    record->queued = 0;
+    record->sent = 0;
+    record->queuing = 1;
+    record->status = 0;
+    record->route = ROUTE_NONE;
+    memcpy(record->client_ip, client_ip, sizeof(record->client_ip));
+    copy_slice(record->method, sizeof(record->method), req->method);
+    copy_slice(record->target, sizeof(record->target), req->path);
+    copy_slice(record->protocol, sizeof(record->protocol), req->version);
+
+    // The query follows the path after a '?', truncated along with it when the target is too long
+    size_t length = strlen(record->target);
+    if (req->query.length > 0 && length + 2 < sizeof(record->target)) {
+        record->target[length] = '?';
+        copy_slice(record->target + length + 1, sizeof(record->target) - length - 1, req->query);
+    }
+}
+
+// Whether sampling keeps a record with this status
+static int sampled(int status) {
+    int status_class = status / 100;
+    if (status_class >= 1 && status_class <= 5 && (server_config.access_log_always & (1 << status_class))) {
+        return 1;
+    }
+    if (server_config.access_log_sample >= 1) {
+        return 1;
+    }
+    if (server_config.access_log_sample <= 0) {
+        return 0;
+    }
+
+    if (sample_state == 0) {
+        sample_state = (uint64_t)access_log_now() | 1;
+    }
+    sample_state ^= sample_state << 13;
+    sample_state ^= sample_state >> 7;
+    sample_state ^= sample_state << 17;
+    return (sample_state >> 11) * (1.0 / 9007199254740992.0) < server_config.access_log_sample;
+}
+
+// Wall clock text for the current second, "2026-01-02T03:04:05" or "02/Jan/2026:03:04:05 +0000"
+static const char *format_time(time_t seconds, size_t *length) {
+    if (seconds != stamp.seconds) {
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        const char *format = server_config.access_log_format == ACCESS_LOG_CLF ? "%d/%b/%Y:%H:%M:%S +0000"
+                                                                                : "%Y-%m-%dT%H:%M:%S";
+        stamp.length = strftime(stamp.text, sizeof(stamp.text), format, &tm);
+        stamp.seconds = seconds;
+    }
+    *length = stamp.length;
+    return stamp.text;
+}
+
+// Length of the well-formed UTF-8 sequence starting at str, 0 when there isn't one. Overlong
+// forms, surrogates and code points past U+10FFFF are refused through the second byte's range
+static size_t utf8_length(const unsigned char *str) {
+    size_t length;
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+    if (str[0] >= 0xc2 && str[0] <= 0xdf) {
+        length = 2;
+    } else if (str[0] >= 0xe0 && str[0] <= 0xef) {
+        length = 3;
+        low = str[0] == 0xe0 ? 0xa0 : low;
+        high = str[0] == 0xed ? 0x9f : high;
+    } else if (str[0] >= 0xf0 && str[0] <= 0xf4) {
+        length = 4;
+        low = str[0] == 0xf0 ? 0x90 : low;
+        high = str[0] == 0xf4 ? 0x8f : high;
+    } else {
+        return 0;
+    }
+
+    // The terminating NUL fails either check, so nothing past the string is read
+    if (str[1] < low || str[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if ((str[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+// Escape a string for a JSON value or a quoted CLF field. Valid UTF-8 is kept, control bytes and
+// bytes outside a valid sequence become \u00XX
+static size_t escape(char *out, size_t size, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+    size_t length = 0;
+    for (; *str && length + 6 < size; str++) {
+        unsigned char c = (unsigned char)*str;
+        size_t sequence = c >= 0x80 ? utf8_length((const unsigned char *)str) : 0;
+        if (sequence > 0) {
+            // At most four bytes, the loop leaves room for six
+            memcpy(out + length, str, sequence);
+            length += sequence;
+            str += sequence - 1;
+        } else if (c == '"' || c == '\\') {
+            out[length++] = '\\';
+            out[length++] = c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            out[length++] = '\\';
+            out[length++] = 'u';
+            out[length++] = '0';
+            out[length++] = '0';
+            out[length++] = hex[c >> 4];
+            out[length++] = hex[c & 15];
+        } else {
+            out[length++] = c;
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+void access_log_write(const access_record *record, long long end) {
+    if (!access_log.enabled || !sampled(record->status)) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    size_t time_length;
+    const char *time_text = format_time(now.tv_sec, &time_length);
+
+    long long ttfb = record->first_byte ? (record->first_byte - record->start) / 1000 : -1;
+    long long total = (end - record->start) / 1000;
+
+    char method[sizeof(record->method) * 6];
+    char target[sizeof(record->target) * 6];
+    char protocol[sizeof(record->protocol) * 6];
+    escape(method, sizeof(method), record->method);
+    escape(target, sizeof(target), record->target);
+    escape(protocol, sizeof(protocol), record->protocol);
+
+    char line[ACCESS_LINE_MAX + sizeof(target) + sizeof(protocol)];
+    int length;
+    if (server_config.access_log_format == ACCESS_LOG_CLF) {
+        // The request line is "GET /path?query HTTP/1.1", an unparsable one is logged as "-"
+        const char *separator = method[0] ? " " : "-";
+        length = snprintf(line, sizeof(line), "%s - - [%.*s] \"%s%s%s%s%s\" %d %zu %lld %lld\n",
+                          record->client_ip, (int)time_length, time_text, method, separator, target,
+                          protocol[0] ? " " : "", protocol, record->status, record->sent, ttfb, total);
+    } else {
+        length = snprintf(line, sizeof(line),
+                          "{\"time\":\"%.*s.%03ldZ\",\"ip\":\"%s\",\"method\":\"%s\",\"target\":\"%s\","
+                          "\"protocol\":\"%s\",\"status\":%d,\"bytes\":%zu,\"ttfb_us\":%lld,\"total_us\":%lld}\n",
+                          (int)time_length, time_text, now.tv_nsec / 1000000, record->client_ip, method, target,
+                          protocol, record->status, record->sent, ttfb, total);
+    }
+    if (length <= 0 || (size_t)length >= sizeof(line)) {
+        log_ring_drop(&access_log.rings);
+        return;
+    }
+
+    log_ring_enqueue(&access_log.rings, line, length, 0);
+}
+
+// Move the current file to .1, shifting older ones up and dropping the oldest
+static void rotate(void) {
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    close(access_log.fd);
+    for (int i = ACCESS_LOG_KEEP - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", server_config.access_log, i);
+        snprintf(to, sizeof(to), "%s.%d", server_config.access_log, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", server_config.access_log);
+    rename(server_config.access_log, to);
+
+    if (open_log() == -1) {
+        ERROR("Failed to reopen access log %s: %s", server_config.access_log, strerror(errno));
+    }
+}
+
+// Write a batch out completely, rotating first when the file has grown past its limit
+static void write_batch(struct iovec *iov, int count) {
+    if (server_config.access_log_max_size > 0 && access_log.file_size >= server_config.access_log_max_size) {
+        rotate();
+    }
+    if (access_log.fd != -1) {
+        access_log.file_size += log_ring_writev(access_log.fd, iov, count);
+    }
+}
+
+// Runs on the writer thread each time it wakes
+static void drain_rings(log_ring *rings) {
+    log_ring_flush(&access_log.rings, rings, write_batch);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "arena.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include <stdlib.h>
+#include <stdalign.h>
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;                // Usable bytes after the header
+    int pooled;                 // Came from the buffer pool rather than malloc
+    alignas(max_align_t) char data[];
+} arena_block;
+
+#define ALIGN_UP(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+#define POOLED_SIZE (BUFFER_SIZE - sizeof(arena_block))
+
+void arena_init(arena_t *arena) {
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = ALIGN_UP(size);
+    arena_block *current = arena->blocks;
+    if (current && current->pooled && current->size - arena->used >= size) {
+        void *ptr = current->data + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    // Oversized allocations get a block to themselves, queued behind the one being bumped
+    if (size > POOLED_SIZE) {
+        arena_block *block = malloc(sizeof(arena_block) + size);
+        if (!block) {
+            return NULL;
+        }
+        block->size = size;
+        block->pooled = 0;
+        if (current) {
+            block->next = current->next;
+            current->next = block;
+        } else {
+            block->next = NULL;
+            arena->blocks = block;
+            arena->used = size;
+        }
+        arena->reserved += sizeof(arena_block) + size;
+        return block->data;
+    }
+
+    arena_block *block = buffer_pool_get();
+    if (!block) {
+        return NULL;
+    }
+    block->size = POOLED_SIZE;
+    block->pooled = 1;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->used = size;
+    arena->reserved += BUFFER_SIZE;
+    return block->data;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_block *block = arena->blocks;
+    while (block) {
+        arena_block *next = block->next;
+        if (block->pooled) {
+            buffer_pool_put(block);
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    arena_init(arena);
+}
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "buffer_pool.h"
+#include "config.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+// Free buffers are chained through their first bytes
+typedef struct free_buffer {
+    struct free_buffer *next;
+} free_buffer;
+
+// Buffers kept by one thread, only it touches the array
+typedef struct thread_cache {
+    struct thread_cache *next;
+    size_t count;                               // Read by buffer_pool_stats from other threads
+    void *buffers[BUFFER_POOL_CACHE];
+} thread_cache;
+
+static struct {
+    pthread_mutex_t mutex;                      // Guards everything below
+    free_buffer *free_list;
+    size_t free_count;
+    size_t total;                               // Buffers allocated and not yet freed, updated atomically
+    thread_cache *caches;
+    pthread_once_t key_once;
+    pthread_key_t cache_key;
+} pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .key_once = PTHREAD_ONCE_INIT
+};
+
+static __thread thread_cache *current_cache;
+
+// Hand count buffers from the top of a cache to the shared list, freeing what it can't keep
+static void spill(thread_cache *cache, size_t count) {
+    pthread_mutex_lock(&pool.mutex);
+    while (count-- > 0) {
+        void *buffer = cache->buffers[--cache->count];
+        if (pool.free_count >= BUFFER_POOL_KEEP) {
+            free(buffer);
+            __atomic_sub_fetch(&pool.total, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        free_buffer *node = buffer;
+        node->next = pool.free_list;
+        pool.free_list = node;
+        pool.free_count++;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+// Runs at thread exit, returns the cache's buffers to the shared list
+static void retire_cache(void *arg) {
+    thread_cache *cache = arg;
+    spill(cache, cache->count);
+
+    pthread_mutex_lock(&pool.mutex);
+    thread_cache **link = &pool.caches;
+    while (*link != cache) {
+        link = &(*link)->next;
+    }
+    *link = cache->next;
+    pthread_mutex_unlock(&pool.mutex);
+
+    free(cache);
+}
+
+static void create_key(void) {
+    pthread_key_create(&pool.cache_key, retire_cache);
+}
+
+static void *allocate_buffer(void) {
+    void *buffer = malloc(BUFFER_SIZE);
+    if (buffer) {
+        __atomic_add_fetch(&pool.total, 1, __ATOMIC_RELAXED);
+    }
+    return buffer;
+}
+
+// The calling thread's cache, created and registered on first use
+static thread_cache *get_cache(void) {
+    if (current_cache) {
+        return current_cache;
+    }
+
+    thread_cache *cache = calloc(1, sizeof(thread_cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    pthread_once(&pool.key_once, create_key);
+    pthread_mutex_lock(&pool.mutex);
+    cache->next = pool.caches;
+    pool.caches = cache;
+    pthread_mutex_unlock(&pool.mutex);
+
+    pthread_setspecific(pool.cache_key, cache);
+    current_cache = cache;
+    return cache;
+}
+
+void *buffer_pool_get(void) {
+    thread_cache *cache = get_cache();
+    if (!cache) {
+        return allocate_buffer();
+    }
+
+    if (cache->count == 0) {
+        // Refill a batch at once so the lock is taken once per BUFFER_POOL_BATCH buffers
+        pthread_mutex_lock(&pool.mutex);
+        size_t taken = 0;
+        while (pool.free_list && taken < BUFFER_POOL_BATCH) {
+            free_buffer *node = pool.free_list;
+            pool.free_list = node->next;
+            cache->buffers[taken++] = node;
+        }
+        pool.free_count -= taken;
+        pthread_mutex_unlock(&pool.mutex);
+        __atomic_store_n(&cache->count, taken, __ATOMIC_RELAXED);
+
+        if (taken == 0) {
+            return allocate_buffer();
+        }
+    }
+
+    void *buffer = cache->buffers[cache->count - 1];
+    __atomic_store_n(&cache->count, cache->count - 1, __ATOMIC_RELAXED);
+    return buffer;
+}
+
+void buffer_pool_put(void *buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    thread_cache *cache = get_cache();
+    if (!cache) {
+        thread_cache single = { .count = 1, .buffers = { buffer } };
+        spill(&single, 1);
+        return;
+    }
+
+    if (cache->count == BUFFER_POOL_CACHE) {
+        spill(cache, BUFFER_POOL_BATCH);
+    }
+    cache->buffers[cache->count] = buffer;
+    __atomic_store_n(&cache->count, cache->count + 1, __ATOMIC_RELAXED);
+}
+
+void buffer_pool_stats(buffer_pool_stats_t *stats) {
+    size_t cached = 0;
+
+    pthread_mutex_lock(&pool.mutex);
+    for (thread_cache *cache = pool.caches; cache; cache = cache->next) {
+        cached += __atomic_load_n(&cache->count, __ATOMIC_RELAXED);
+    }
+    size_t total = __atomic_load_n(&pool.total, __ATOMIC_RELAXED);
+    stats->free = pool.free_count;
+    pthread_mutex_unlock(&pool.mutex);
+
+    // Caches are sampled while their threads run, so the sum can briefly exceed the total
+    stats->cached = cached;
+    stats->in_use = total > cached + stats->free ? total - cached - stats->free : 0;
+}
+
+void buffer_pool_cleanup(void) {
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.free_list) {
+        free_buffer *node = pool.free_list;
+        pool.free_list = node->next;
+        free(node);
+        __atomic_sub_fetch(&pool.total, 1, __ATOMIC_RELAXED);
+    }
+    pool.free_count = 0;
+    pthread_mutex_unlock(&pool.mutex);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "compression.h"
+#include <stdlib.h>
+#include <zlib.h>
+
+int gzip_compress(const void *input, size_t input_length, char **output, size_t *output_length) {
+    z_stream stream = {0};
+
+    // 15 window bits plus 16 selects the gzip wrapper
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    size_t bound = deflateBound(&stream, input_length);
+    char *buffer = malloc(bound);
+    if (!buffer) {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in = (Bytef *)input;
+    stream.avail_in = input_length;
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = bound;
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&stream);
+        free(buffer);
+        return -1;
+    }
+
+    *output = buffer;
+    *output_length = stream.total_out;
+    deflateEnd(&stream);
+    return 0;
+}
\ No newline at end of file
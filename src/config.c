@@ -0,0 +1,172 @@
+#include "config.h"
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+
+server_config_t server_config = {
+    .mode = SERVER_MODE_EPOLL,
+    .workers = 1,
+    .pin_cpus = 0,
+    .listen_backlog = LISTEN_BACKLOG,
+    .threads = THREAD_POOL_SIZE,
+    .thread_queue = THREAD_QUEUE_SIZE,
+    .keepalive_timeout = KEEPALIVE_TIMEOUT,
+    .header_timeout = HEADER_TIMEOUT,
+    .body_timeout = BODY_TIMEOUT,
+    .response_timeout = RESPONSE_TIMEOUT,
+    .keepalive_max_requests = KEEPALIVE_MAX_REQUESTS,
+    .max_body_size = MAX_BODY_SIZE,
+    .file_cache_size = FILE_CACHE_SIZE,
+    .fd_cache_ttl = FD_CACHE_TTL,
+    .mime_types = NULL,
+    .access_log = NULL,
+    .site_pack = NULL,
+    .access_log_format = ACCESS_LOG_JSON,
+    .access_log_sample = 1.0,
+    .access_log_always = 0,
+    .access_log_max_size = ACCESS_LOG_MAX_SIZE,
+    .http2 = 1,
+    .h2_max_streams = H2_MAX_STREAMS
+};
+
+void config_load(void) {
+    // SERVER_MODE selects the connection model: "epoll" (default), "threaded" or "uring"
+    const char *env_mode = getenv("SERVER_MODE");
+    if (env_mode) {
+        if (strcasecmp(env_mode, "threaded") == 0) server_config.mode = SERVER_MODE_THREADED;
+        else if (strcasecmp(env_mode, "epoll") == 0) server_config.mode = SERVER_MODE_EPOLL;
+        else if (strcasecmp(env_mode, "uring") == 0) server_config.mode = SERVER_MODE_URING;
+    }
+
+    // WORKERS is a loop count, or "auto" for one per online CPU
+    const char *env_workers = getenv("WORKERS");
+    if (env_workers) {
+        if (strcasecmp(env_workers, "auto") == 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            server_config.workers = cpus > 0 ? (int)cpus : 1;
+        } else if (atoi(env_workers) > 0) {
+            server_config.workers = atoi(env_workers);
+        }
+    }
+
+    const char *env_pin = getenv("PIN_CPUS");
+    if (env_pin) {
+        server_config.pin_cpus = atoi(env_pin) != 0;
+    }
+
+    const char *env_backlog = getenv("LISTEN_BACKLOG");
+    if (env_backlog && atoi(env_backlog) > 0) {
+        server_config.listen_backlog = atoi(env_backlog);
+    }
+
+    // THREADS and THREAD_QUEUE bound the threaded mode's pool and its queue
+    const char *env_threads = getenv("THREADS");
+    if (env_threads && atoi(env_threads) > 0) {
+        server_config.threads = atoi(env_threads);
+    }
+
+    const char *env_queue = getenv("THREAD_QUEUE");
+    if (env_queue && atoi(env_queue) > 0) {
+        server_config.thread_queue = atoi(env_queue);
+    }
+
+    const char *env_timeout = getenv("KEEPALIVE_TIMEOUT");
+    if (env_timeout && atoi(env_timeout) > 0) {
+        server_config.keepalive_timeout = atoi(env_timeout);
+    }
+
+    const char *env_header_timeout = getenv("HEADER_TIMEOUT");
+    if (env_header_timeout && atoi(env_header_timeout) >= 0) {
+        server_config.header_timeout = atoi(env_header_timeout);
+    }
+
+    const char *env_body_timeout = getenv("BODY_TIMEOUT");
+    if (env_body_timeout && atoi(env_body_timeout) >= 0) {
+        server_config.body_timeout = atoi(env_body_timeout);
+    }
+
+    const char *env_response_timeout = getenv("RESPONSE_TIMEOUT");
+    if (env_response_timeout && atoi(env_response_timeout) >= 0) {
+        server_config.response_timeout = atoi(env_response_timeout);
+    }
+
+    const char *env_max_requests = getenv("KEEPALIVE_MAX_REQUESTS");
+    if (env_max_requests && atoi(env_max_requests) > 0) {
+        server_config.keepalive_max_requests = atoi(env_max_requests);
+    }
+
+    // MAX_BODY_MB caps request bodies, 0 removes the limit
+    const char *env_max_body = getenv("MAX_BODY_MB");
+    if (env_max_body && atoi(env_max_body) >= 0) {
+        server_config.max_body_size = (size_t)atoi(env_max_body) * 1024 * 1024;
+    }
+
+    // FILE_CACHE_MB sets the static file cache budget, 0 turns it off
+    const char *env_cache = getenv("FILE_CACHE_MB");
+    if (env_cache && atoi(env_cache) >= 0) {
+        server_config.file_cache_size = (size_t)atoi(env_cache) * 1024 * 1024;
+    }
+
+    const char *env_fd_ttl = getenv("FD_CACHE_TTL");
+    if (env_fd_ttl && atoi(env_fd_ttl) >= 0) {
+        server_config.fd_cache_ttl = atoi(env_fd_ttl);
+    }
+
+    // MIME_TYPES names a mime.types file extending the built-in types
+    const char *env_mime_types = getenv("MIME_TYPES");
+    if (env_mime_types && *env_mime_types) {
+        server_config.mime_types = env_mime_types;
+    }
+
+    // SITE_PACK names an archive built by ./sitepack, served in place of ROOT_DIR
+    const char *env_site_pack = getenv("SITE_PACK");
+    if (env_site_pack && *env_site_pack) {
+        server_config.site_pack = env_site_pack;
+    }
+
+    // ACCESS_LOG names the access log file, it is off without one
+    const char *env_access_log = getenv("ACCESS_LOG");
+    if (env_access_log && *env_access_log) {
+        server_config.access_log = env_access_log;
+    }
+
+    const char *env_access_format = getenv("ACCESS_LOG_FORMAT");
+    if (env_access_format) {
+        if (strcasecmp(env_access_format, "clf") == 0) server_config.access_log_format = ACCESS_LOG_CLF;
+        else if (strcasecmp(env_access_format, "json") == 0) server_config.access_log_format = ACCESS_LOG_JSON;
+    }
+
+    // ACCESS_LOG_SAMPLE is the share of requests logged, from 0 to 1
+    const char *env_sample = getenv("ACCESS_LOG_SAMPLE");
+    if (env_sample) {
+        double sample = atof(env_sample);
+        server_config.access_log_sample = sample < 0 ? 0 : sample > 1 ? 1 : sample;
+    }
+
+    // ACCESS_LOG_ALWAYS lists status classes that bypass sampling, such as "4xx,5xx"
+    const char *env_always = getenv("ACCESS_LOG_ALWAYS");
+    if (env_always) {
+        server_config.access_log_always = 0;
+        for (const char *p = env_always; *p; p++) {
+            if (*p >= '1' && *p <= '5' && (p == env_always || p[-1] == ',' || p[-1] == ' ')) {
+                server_config.access_log_always |= 1 << (*p - '0');
+            }
+        }
+    }
+
+    const char *env_access_max = getenv("ACCESS_LOG_MAX_MB");
+    if (env_access_max && atoi(env_access_max) >= 0) {
+        server_config.access_log_max_size = (size_t)atoi(env_access_max) * 1024 * 1024;
+    }
+
+    // HTTP2=0 turns cleartext HTTP/2 off, H2_MAX_STREAMS bounds the streams open on one connection
+    const char *env_http2 = getenv("HTTP2");
+    if (env_http2) {
+        server_config.http2 = atoi(env_http2) != 0;
+    }
+
+    const char *env_h2_streams = getenv("H2_MAX_STREAMS");
+    if (env_h2_streams && atoi(env_h2_streams) > 0) {
+        server_config.h2_max_streams = atoi(env_h2_streams);
+    }
+}
\ No newline at end of file
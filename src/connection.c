@@ -0,0 +1,921 @@
+#define _GNU_SOURCE
+#include "connection.h"
+#include "access_log.h"
+#include "buffer_pool.h"
+#include "h2.h"
+#include "request_handler.h"
+#include "utils.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+
+#define IOV_BATCH 16
+#define SPLICE_CHUNK 65536
+
+static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+connection_t *connection_create(int fd, const struct sockaddr_in *addr) {
+    connection_t *conn = malloc(sizeof(connection_t));
+    if (!conn) {
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->addr = *addr;
+    inet_ntop(AF_INET, &(conn->addr.sin_addr), conn->client_ip, INET_ADDRSTRLEN);
+    conn->state = CONN_READING;
+    conn->keep_alive = 0;
+    conn->requests_served = 0;
+    timer_init(&conn->timer, conn);
+    conn->timeout = TIMEOUT_NONE;
+    conn->timeout_mark = 0;
+    conn->in_buf = NULL;
+    conn->in_len = 0;
+    arena_init(&conn->arena);
+    conn->request = NULL;
+    conn->receiving_body = 0;
+    conn->expect_continue = 0;
+    memset(&conn->reader, 0, sizeof(conn->reader));
+    conn->out_head = NULL;
+    conn->out_tail = NULL;
+    conn->pipe_fds[0] = -1;
+    conn->pipe_fds[1] = -1;
+    conn->pipe_pending = 0;
+    conn->request_start = 0;
+    conn->route = ROUTE_NONE;
+    conn->access_head = NULL;
+    conn->access_tail = NULL;
+    conn->h2 = NULL;
+    conn->stream = NULL;
+
+    // Responses are coalesced with MSG_MORE, so Nagle would only add latency
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    metrics_count(METRIC_CONNECTIONS_OPENED);
+    return conn;
+}
+
+// Segments live in the arena, so dropping one only lets go of what it refers to
+static void free_segment(out_segment *seg) {
+    // File segments with a release callback borrow their descriptor
+    if (seg->type == OUT_FILE && !seg->release) {
+        close(seg->fd);
+    }
+    if (seg->release) {
+        seg->release(seg->release_arg);
+    }
+}
+
+void connection_release_segment(out_segment *seg) {
+    free_segment(seg);
+}
+
+// An HTTP/2 stream's allocations live as long as the stream
+void *connection_alloc(connection_t *conn, size_t size) {
+    return conn->stream ? h2_stream_alloc(conn->stream, size) : arena_alloc(&conn->arena, size);
+}
+
+static void release_input(connection_t *conn) {
+    buffer_pool_put(conn->in_buf);
+    conn->in_buf = NULL;
+}
+
+// Hand a finished request to the metrics and the access log
+static void report_record(const access_record *record, long long end) {
+    metrics_request(record->method, record->route, record->status, record->sent, end - record->start);
+    access_log_write(record, end);
+}
+
+void connection_destroy(connection_t *conn) {
+    // A handler still taking a body lets go of what it holds for it
+    if (conn->receiving_body && conn->reader.abort) {
+        conn->reader.abort(conn, conn->reader.ctx);
+    }
+
+    out_segment *seg = conn->out_head;
+    while (seg) {
+        out_segment *next = seg->next;
+        free_segment(seg);
+        seg = next;
+    }
+
+    // Responses cut short are still reported, with the bytes that made it out
+    long long now = conn->access_head ? access_log_now() : 0;
+    while (conn->access_head) {
+        access_record *record = conn->access_head;
+        conn->access_head = record->next;
+        report_record(record, now);
+    }
+    if (conn->h2) {
+        h2_destroy(conn);
+    }
+    arena_reset(&conn->arena);
+    release_input(conn);
+
+    if (conn->pipe_fds[0] != -1) {
+        close(conn->pipe_fds[0]);
+        close(conn->pipe_fds[1]);
+    }
+
+    // A backend may have closed the socket already
+    if (conn->fd != -1) {
+        close(conn->fd);
+    }
+    free(conn);
+    metrics_count(METRIC_CONNECTIONS_CLOSED);
+}
+
+// Read the status code off a response's first bytes
+static int sniff_status(const out_segment *seg) {
+    const char *data = seg->data;
+    if (seg->type != OUT_MEMORY || seg->remaining < 12 || memcmp(data, "HTTP/1.", 7) != 0) {
+        return 0;
+    }
+    if (data[9] < '1' || data[9] > '5' || data[10] < '0' || data[10] > '9' || data[11] < '0' || data[11] > '9') {
+        return 0;
+    }
+    return (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+}
+
+static void link_segment(connection_t *conn, out_segment *seg) {
+    seg->next = NULL;
+    if (conn->out_tail) {
+        conn->out_tail->next = seg;
+    } else {
+        conn->out_head = seg;
+    }
+    conn->out_tail = seg;
+}
+
+static void append_segment(connection_t *conn, out_segment *seg) {
+    // An HTTP/2 handler's output is held by its stream until it is framed
+    if (conn->stream) {
+        h2_stream_queue(conn->stream, seg);
+        return;
+    }
+
+    // Output queued while a request is handled belongs to its response, whose status is read off
+    // the first head queued after any interim 100 Continue
+    access_record *record = conn->access_tail;
+    seg->record = NULL;
+    if (record && record->queuing) {
+        if (record->queued == 0 || (record->status >= 100 && record->status < 200)) {
+            record->status = sniff_status(seg);
+        }
+        record->queued += seg->remaining;
+        seg->record = record;
+    }
+    link_segment(conn, seg);
+}
+
+void connection_queue_segment(connection_t *conn, out_segment *seg, access_record *record) {
+    seg->record = record;
+    if (record) {
+        record->queued += seg->remaining;
+    }
+    link_segment(conn, seg);
+}
+
+int connection_queue_data(connection_t *conn, const void *data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    out_segment *seg = connection_alloc(conn, sizeof(out_segment) + length);
+    if (!seg) {
+        return -1;
+    }
+
+    memcpy(seg->payload, data, length);
+    seg->type = OUT_MEMORY;
+    seg->data = seg->payload;
+    seg->remaining = length;
+    seg->fd = -1;
+    seg->offset = 0;
+    seg->method = FILE_SENDFILE;
+    seg->file_id = 0;
+    seg->release = NULL;
+    seg->release_arg = NULL;
+    append_segment(conn, seg);
+    return 0;
+}
+
+int connection_queue_ref(connection_t *conn, const void *data, size_t length,
+                         void (*release)(void *), void *release_arg) {
+    out_segment *seg = connection_alloc(conn, sizeof(out_segment));
+    if (!seg) {
+        if (release) {
+            release(release_arg);
+        }
+        return -1;
+    }
+
+    seg->type = OUT_MEMORY;
+    seg->data = data;
+    seg->remaining = length;
+    seg->fd = -1;
+    seg->offset = 0;
+    seg->method = FILE_SENDFILE;
+    seg->file_id = 0;
+    seg->release = release;
+    seg->release_arg = release_arg;
+
+    if (length == 0) {
+        free_segment(seg);
+        return 0;
+    }
+
+    append_segment(conn, seg);
+    return 0;
+}
+
+int connection_queue_file(connection_t *conn, int file_fd, off_t offset, size_t length) {
+    if (length == 0) {
+        close(file_fd);
+        return 0;
+    }
+
+    out_segment *seg = connection_alloc(conn, sizeof(out_segment));
+    if (!seg) {
+        close(file_fd);
+        return -1;
+    }
+
+    seg->type = OUT_FILE;
+    seg->data = NULL;
+    seg->remaining = length;
+    seg->fd = file_fd;
+    seg->offset = offset;
+    seg->method = FILE_SENDFILE;
+    seg->file_id = 0;
+    seg->release = NULL;
+    seg->release_arg = NULL;
+    append_segment(conn, seg);
+    return 0;
+}
+
+int connection_queue_file_ref(connection_t *conn, int file_fd, uint64_t file_id, off_t offset, size_t length,
+                              void (*release)(void *), void *release_arg) {
+    out_segment *seg = connection_alloc(conn, sizeof(out_segment));
+    if (!seg) {
+        release(release_arg);
+        return -1;
+    }
+
+    seg->type = OUT_FILE;
+    seg->data = NULL;
+    seg->remaining = length;
+    seg->fd = file_fd;
+    seg->offset = offset;
+    seg->method = FILE_SENDFILE;
+    seg->file_id = file_id;
+    seg->release = release;
+    seg->release_arg = release_arg;
+
+    if (length == 0) {
+        free_segment(seg);
+        return 0;
+    }
+
+    append_segment(conn, seg);
+    return 0;
+}
+
+// Start a record for req, output queued from here on is counted against it
+static void begin_record(connection_t *conn, const http_request_t *req) {
+    conn->route = ROUTE_NONE;
+
+    if (!req) {
+        return;
+    }
+    access_record *record = connection_alloc(conn, sizeof(access_record));
+    if (!record) {
+        return;
+    }
+
+    long long start = conn->request_start ? conn->request_start : access_log_now();
+    access_log_begin(record, conn->client_ip, req, start);
+    connection_begin_record(conn, record);
+}
+
+void connection_begin_record(connection_t *conn, access_record *record) {
+    if (conn->access_tail) {
+        conn->access_tail->next = record;
+    } else {
+        conn->access_head = record;
+    }
+    conn->access_tail = record;
+}
+
+// Pop and report every record whose response has been sent in full. HTTP/1 responses complete in
+// order, so only the front is looked at, HTTP/2 streams complete in any order
+static void finish_records(connection_t *conn) {
+    long long now = 0;
+    access_record **link = &conn->access_head;
+    access_record *previous = NULL;
+    while (*link) {
+        access_record *record = *link;
+        if (record->queuing || record->sent != record->queued) {
+            if (!conn->h2) {
+                break;
+            }
+            previous = record;
+            link = &record->next;
+            continue;
+        }
+
+        *link = record->next;
+        if (conn->access_tail == record) {
+            conn->access_tail = previous;
+        }
+        if (!now) {
+            now = access_log_now();
+        }
+        report_record(record, now);
+        if (conn->h2) {
+            h2_record_sent(conn, record);
+        }
+    }
+}
+
+void connection_end_record(connection_t *conn, access_record *record) {
+    record->queuing = 0;
+    finish_records(conn);
+}
+
+// Stop counting output against the newest record
+static void end_record(connection_t *conn) {
+    if (conn->access_tail && conn->access_tail->queuing) {
+        conn->access_tail->route = conn->route;
+        connection_end_record(conn, conn->access_tail);
+    }
+}
+
+// Answer a request that can't be processed and close once the response is out
+static void reject_request(connection_t *conn, const char *status) {
+    WARN("Rejecting request from %s: %s", conn->client_ip, status);
+    conn->keep_alive = 0;
+    begin_record(conn, conn->request);
+    send_simple_response(conn, status, "text/plain");
+    end_record(conn);
+    conn->state = CONN_WRITING;
+}
+
+// Whether the request being received has already queued its final response
+static int responded(const connection_t *conn) {
+    const access_record *record = conn->access_tail;
+    return record && record->queuing && record->status >= 200;
+}
+
+static void stop_body(connection_t *conn) {
+    conn->receiving_body = 0;
+    conn->expect_continue = 0;
+    memset(&conn->reader, 0, sizeof(conn->reader));
+}
+
+// Give up on a body that can't be received, answering for the handler unless it already has,
+// and close once the response is out
+static void reject_body(connection_t *conn, const char *status) {
+    WARN("Rejecting request body from %s: %s", conn->client_ip, status);
+    body_reader reader = conn->reader;
+    stop_body(conn);
+    if (reader.abort) {
+        reader.abort(conn, reader.ctx);
+    }
+
+    conn->keep_alive = 0;
+    if (!responded(conn)) {
+        send_simple_response(conn, status, "text/plain");
+    }
+    end_record(conn);
+    conn->state = CONN_WRITING;
+}
+
+void connection_read_body(connection_t *conn, const body_reader *reader) {
+    if (conn->stream) {
+        h2_stream_read_body(conn->stream, reader);
+        return;
+    }
+
+    conn->reader = *reader;
+    if (conn->expect_continue) {
+        connection_queue_ref(conn, continue_response, sizeof(continue_response) - 1, NULL, NULL);
+        conn->expect_continue = 0;
+    }
+}
+
+// Decode the body bytes behind the head and hand them to the reader. The head stays at the front
+// of in_buf and the body streams through the room after it, so memory stays bounded whatever the
+// body's size. Returns the request's length once the body is complete, 0 while more is expected
+// or after rejecting it
+static size_t receive_body(connection_t *conn) {
+    http_request_t *req = conn->request;
+    char *window = conn->in_buf + req->header_length;
+    size_t available = conn->in_len - req->header_length;
+    size_t offset = 0;
+    http_body_result result;
+
+    do {
+        size_t used;
+        http_slice data;
+        result = http_body_decode(&conn->body, window + offset, available - offset, &used, &data);
+        if (result == HTTP_BODY_ERROR) {
+            reject_body(conn, "400 Bad Request");
+            return 0;
+        }
+        if (server_config.max_body_size && conn->body.received > (long long)server_config.max_body_size) {
+            reject_body(conn, "413 Payload Too Large");
+            return 0;
+        }
+        if (data.length > 0 && conn->reader.data) {
+            conn->reader.data(conn, conn->reader.ctx, data.data, data.length);
+        }
+        offset += used;
+        if (used == 0) {
+            break;
+        }
+    } while (result == HTTP_BODY_INCOMPLETE);
+
+    if (result == HTTP_BODY_DONE) {
+        body_reader reader = conn->reader;
+        stop_body(conn);
+        if (reader.end) {
+            reader.end(conn, reader.ctx);
+        }
+        return req->header_length + offset;
+    }
+
+    // Keep only a partial framing line behind the head
+    memmove(window, window + offset, available - offset);
+    conn->in_len -= offset;
+    return 0;
+}
+
+// Dispatch every complete request in the buffer, in arrival order
+static void process_requests(connection_t *conn) {
+    http_request_t *req = conn->request;
+    if (!req) {
+        req = connection_alloc(conn, sizeof(http_request_t));
+        if (!req) {
+            ERROR("Failed to allocate request state for %s", conn->client_ip);
+            conn->state = CONN_DONE;
+            return;
+        }
+        http_parser_init(req);
+        conn->request = req;
+    }
+
+    while (conn->state == CONN_READING) {
+        // A connection opening with the HTTP/2 preface speaks HTTP/2 from its first byte
+        if (conn->requests_served == 0 && server_config.http2 && !conn->receiving_body) {
+            int preface = h2_preface(conn->in_buf, conn->in_len);
+            if (preface == 0) {
+                return;
+            }
+            if (preface == 1) {
+                h2_start(conn);
+                return;
+            }
+        }
+
+        if (!conn->receiving_body) {
+            http_parse_result result = http_parse_request(req, conn->in_buf, conn->in_len);
+            if (result == HTTP_PARSE_INCOMPLETE) {
+                return;
+            }
+            if (result == HTTP_PARSE_TOO_LARGE) {
+                reject_request(conn, "431 Request Header Fields Too Large");
+                return;
+            }
+            if (result == HTTP_PARSE_ERROR) {
+                reject_request(conn, "400 Bad Request");
+                return;
+            }
+            if (server_config.max_body_size && req->content_length > (long long)server_config.max_body_size) {
+                reject_request(conn, "413 Payload Too Large");
+                return;
+            }
+
+            // 100-continue is the only expectation defined
+            const http_slice *expect = http_get_header(req, "Expect");
+            if (expect && !http_slice_equals_nocase(*expect, "100-continue")) {
+                reject_request(conn, "417 Expectation Failed");
+                return;
+            }
+
+            // An h2c upgrade is answered as the new connection's first stream
+            if (server_config.http2 && http_get_header(req, "Upgrade") && h2_upgrade(conn, req) == 0) {
+                return;
+            }
+
+            INFO("Request from %s: %.*s %.*s %.*s", conn->client_ip,
+                 (int)req->method.length, req->method.data,
+                 (int)req->path.length, req->path.data,
+                 (int)req->version.length, req->version.data);
+            TRACE("Request head:\n%.*s", (int)req->header_length, conn->in_buf);
+
+            conn->requests_served++;
+            conn->keep_alive = req->keep_alive &&
+                               conn->requests_served < server_config.keepalive_max_requests;
+
+            http_body_init(&conn->body, req);
+            conn->receiving_body = 1;
+            // An interim response is only owed while none of the body has been sent
+            conn->expect_continue = expect && req->version_minor == 1 && conn->in_len == req->header_length &&
+                                    (req->chunked || req->content_length > 0);
+
+            begin_record(conn, req);
+            handle_request(conn, req);
+
+            if (conn->expect_continue) {
+                // The handler answered without wanting the body the client is holding back,
+                // so close after the response rather than wait for it
+                stop_body(conn);
+                conn->keep_alive = 0;
+                end_record(conn);
+                conn->state = CONN_WRITING;
+                return;
+            }
+        }
+
+        size_t request_length = receive_body(conn);
+        if (request_length == 0) {
+            return;
+        }
+        end_record(conn);
+
+        // Drop the request, keeping any pipelined bytes behind it
+        conn->in_len -= request_length;
+        memmove(conn->in_buf, conn->in_buf + request_length, conn->in_len);
+        http_parser_init(req);
+        conn->request_start = conn->in_len > 0 ? access_log_now() : 0;
+
+        if (!conn->keep_alive) {
+            conn->state = CONN_WRITING;
+        }
+    }
+}
+
+uint64_t connection_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+
+static conn_timeout_t current_timeout(const connection_t *conn) {
+    if (conn->out_head || conn->state == CONN_WRITING) {
+        return TIMEOUT_RESPONSE;
+    }
+    if (conn->h2) {
+        return h2_timeout(conn);
+    }
+    if (conn->receiving_body) {
+        return TIMEOUT_BODY;
+    }
+    return conn->in_len > 0 ? TIMEOUT_HEADER : TIMEOUT_IDLE;
+}
+
+static int timeout_seconds(conn_timeout_t timeout) {
+    switch (timeout) {
+    case TIMEOUT_IDLE: return server_config.keepalive_timeout;
+    case TIMEOUT_HEADER: return server_config.header_timeout;
+    case TIMEOUT_BODY: return server_config.body_timeout;
+    case TIMEOUT_RESPONSE: return server_config.response_timeout;
+    default: return 0;
+    }
+}
+
+void connection_watch(connection_t *conn, timer_wheel_t *wheel) {
+    conn_timeout_t timeout = current_timeout(conn);
+    if (timeout == conn->timeout && timer_pending(&conn->timer) &&
+        (timeout != TIMEOUT_BODY || conn->body.received == conn->timeout_mark)) {
+        return;
+    }
+
+    conn->timeout = timeout;
+    conn->timeout_mark = conn->body.received;
+    int seconds = timeout_seconds(timeout);
+    if (seconds > 0) {
+        timer_schedule(wheel, &conn->timer, wheel->now + (uint64_t)seconds * 1000 / TIMER_TICK_MS);
+    } else {
+        timer_cancel(wheel, &conn->timer);
+    }
+}
+
+void connection_expired(connection_t *conn) {
+    static const char *const names[] = { "idle", "header", "body", "response" };
+    static const metrics_counter_t counters[] = {
+        METRIC_TIMEOUTS_IDLE, METRIC_TIMEOUTS_HEADER, METRIC_TIMEOUTS_BODY, METRIC_TIMEOUTS_RESPONSE
+    };
+    if (conn->timeout < TIMEOUT_NONE) {
+        DEBUG("Closing connection from %s past its %s deadline", conn->client_ip, names[conn->timeout]);
+        metrics_count(counters[conn->timeout]);
+    }
+}
+
+const char *connection_token(const connection_t *conn) {
+    return conn->keep_alive ? "keep-alive" : "close";
+}
+
+size_t connection_prepare_read(connection_t *conn) {
+    if (conn->state != CONN_READING) {
+        return 0;
+    }
+
+    if (conn->out_head) {
+        // Flush responses before reading further
+        conn->state = CONN_WRITING;
+        return 0;
+    }
+
+    // HTTP/2 never leaves a full buffer behind, it takes DATA as it comes and refuses larger frames
+    if (conn->in_len == BUFFER_SIZE && !conn->h2) {
+        // A body only stalls here when the head leaves too little room for its framing
+        if (conn->receiving_body) {
+            reject_body(conn, "431 Request Header Fields Too Large");
+        } else {
+            reject_request(conn, "431 Request Header Fields Too Large");
+        }
+        return 0;
+    }
+
+    // Nothing queued refers into the arena any more. A request still arriving is parsed again
+    // from the start, so the arena doesn't keep growing for a client that never stops pipelining.
+    // HTTP/2 keeps requests in their streams, its arena only ever holds frames
+    if (conn->h2 || (!conn->access_head && !conn->receiving_body &&
+                     (conn->in_len == 0 || conn->arena.reserved > BUFFER_SIZE))) {
+        arena_reset(&conn->arena);
+        conn->request = NULL;
+    }
+    if (conn->in_len == 0 && conn->in_buf) {
+        release_input(conn);
+    }
+
+    return BUFFER_SIZE - conn->in_len;
+}
+
+char *connection_input(connection_t *conn) {
+    if (!conn->in_buf) {
+        conn->in_buf = buffer_pool_get();
+        if (!conn->in_buf) {
+            return NULL;
+        }
+    }
+    return conn->in_buf + conn->in_len;
+}
+
+void connection_received(connection_t *conn, size_t length) {
+    if (conn->in_len == 0) {
+        conn->request_start = access_log_now();
+    }
+    conn->in_len += length;
+    if (conn->h2) {
+        h2_received(conn);
+        return;
+    }
+    process_requests(conn);
+}
+
+conn_io_t connection_read(connection_t *conn) {
+    while (conn->state == CONN_READING) {
+        size_t space = connection_prepare_read(conn);
+        if (space == 0) {
+            break;
+        }
+
+        char *input = connection_input(conn);
+        if (!input) {
+            ERROR("Failed to allocate an input buffer for %s", conn->client_ip);
+            return CONN_IO_ERROR;
+        }
+
+        ssize_t received = recv(conn->fd, input, space, 0);
+        if (received > 0) {
+            connection_received(conn, received);
+            continue;
+        }
+
+        if (received == 0) {
+            return CONN_IO_CLOSED;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Idle connections wait without an input buffer
+            if (conn->in_len == 0) {
+                release_input(conn);
+            }
+            return CONN_IO_AGAIN;
+        }
+
+        ERROR("Failed to receive data from client %s", conn->client_ip);
+        return CONN_IO_ERROR;
+    }
+
+    return CONN_IO_DONE;
+}
+
+// Advance the queue past sent bytes, crediting them to their records and releasing drained segments
+static void consume_output(connection_t *conn, size_t sent) {
+    long long now = 0;
+    int credited = 0;
+
+    while (sent > 0 && conn->out_head) {
+        out_segment *seg = conn->out_head;
+        size_t step = sent < seg->remaining ? sent : seg->remaining;
+
+        access_record *record = seg->record;
+        if (record) {
+            if (!record->first_byte) {
+                if (!now) {
+                    now = access_log_now();
+                }
+                record->first_byte = now;
+            }
+            record->sent += step;
+            credited = 1;
+        }
+
+        if (seg->type == OUT_MEMORY) {
+            seg->data += step;
+        } else {
+            seg->offset += step;
+        }
+        seg->remaining -= step;
+        sent -= step;
+
+        if (seg->remaining == 0) {
+            conn->out_head = seg->next;
+            if (!conn->out_head) {
+                conn->out_tail = NULL;
+            }
+            free_segment(seg);
+        }
+    }
+
+    if (credited) {
+        finish_records(conn);
+    }
+
+    // HTTP/2 frames more of its streams' output once the queue has drained
+    if (conn->h2 && !conn->out_head) {
+        arena_reset(&conn->arena);
+        conn->request = NULL;
+        h2_write(conn);
+    }
+}
+
+// A handler still waiting for its body keeps the connection reading even when it closes afterwards
+int connection_closing(const connection_t *conn) {
+    if (conn->h2) {
+        return h2_closing(conn);
+    }
+    return !conn->keep_alive && !(conn->receiving_body && conn->reader.end);
+}
+
+void connection_sent(connection_t *conn, size_t length) {
+    consume_output(conn, length);
+    if (!conn->out_head) {
+        conn->state = connection_closing(conn) ? CONN_DONE : CONN_READING;
+    }
+}
+
+// Last resort for files the kernel can't splice: copy through a userspace buffer
+static ssize_t copy_file_chunk(connection_t *conn, out_segment *seg) {
+    char buffer[BUFFER_SIZE];
+    size_t want = seg->remaining < sizeof(buffer) ? seg->remaining : sizeof(buffer);
+
+    ssize_t bytes = pread(seg->fd, buffer, want, seg->offset);
+    if (bytes <= 0) {
+        // File shrank underneath us, the promised length can't be delivered
+        if (bytes == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    return send(conn->fd, buffer, bytes, MSG_NOSIGNAL);
+}
+
+// Move file pages to the socket through a per-connection pipe
+static ssize_t splice_file_chunk(connection_t *conn, out_segment *seg) {
+    if (conn->pipe_fds[0] == -1 && pipe2(conn->pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return -1;
+    }
+
+    // The pipe only ever holds the bytes at the front of this segment
+    if (conn->pipe_pending == 0) {
+        loff_t offset = seg->offset;
+        size_t want = seg->remaining < SPLICE_CHUNK ? seg->remaining : SPLICE_CHUNK;
+        ssize_t filled = splice(seg->fd, &offset, conn->pipe_fds[1], NULL, want,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (filled <= 0) {
+            if (filled == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        conn->pipe_pending = filled;
+    }
+
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (seg->remaining > conn->pipe_pending || seg->next) {
+        flags |= SPLICE_F_MORE;
+    }
+    ssize_t sent = splice(conn->pipe_fds[0], NULL, conn->fd, NULL, conn->pipe_pending, flags);
+    if (sent > 0) {
+        conn->pipe_pending -= sent;
+    }
+    return sent;
+}
+
+// Send part of a file segment, preferring sendfile, then splice, then a plain copy
+static ssize_t send_file_chunk(connection_t *conn, out_segment *seg) {
+    if (seg->method == FILE_SENDFILE) {
+        off_t offset = seg->offset;
+        ssize_t sent = sendfile(conn->fd, seg->fd, &offset, seg->remaining);
+        if (sent == 0) {
+            // File shrank underneath us, the promised length can't be delivered
+            errno = EIO;
+            return -1;
+        }
+        if (sent > 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return sent;
+        }
+        seg->method = FILE_SPLICE;
+    }
+
+    if (seg->method == FILE_SPLICE) {
+        ssize_t sent = splice_file_chunk(conn, seg);
+        if (sent >= 0 || (errno != EINVAL && errno != ENOSYS) || conn->pipe_pending > 0) {
+            return sent;
+        }
+        seg->method = FILE_COPY;
+    }
+
+    return copy_file_chunk(conn, seg);
+}
+
+// Send a run of memory segments with one sendmsg, corked if a file body follows
+static ssize_t send_memory_chunk(connection_t *conn, out_segment *seg) {
+    struct iovec iov[IOV_BATCH];
+    int iovcnt = 0;
+    out_segment *s = seg;
+
+    for (; s && s->type == OUT_MEMORY && iovcnt < IOV_BATCH; s = s->next) {
+        iov[iovcnt].iov_base = (void *)s->data;
+        iov[iovcnt].iov_len = s->remaining;
+        iovcnt++;
+    }
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = iovcnt
+    };
+    // Hold the header back so it leaves in the same segment as the file's first bytes
+    int flags = MSG_NOSIGNAL | (s ? MSG_MORE : 0);
+    return sendmsg(conn->fd, &msg, flags);
+}
+
+conn_io_t connection_flush(connection_t *conn) {
+    while (conn->out_head) {
+        out_segment *seg = conn->out_head;
+        ssize_t sent;
+
+        if (seg->type == OUT_MEMORY) {
+            sent = send_memory_chunk(conn, seg);
+        } else {
+            sent = send_file_chunk(conn, seg);
+        }
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return CONN_IO_AGAIN;
+            }
+            if (errno == EPIPE || errno == ECONNRESET) {
+                return CONN_IO_CLOSED;
+            }
+            ERROR("Failed to send response to client %s: %s", conn->client_ip, strerror(errno));
+            return CONN_IO_ERROR;
+        }
+
+        consume_output(conn, sent);
+    }
+
+    // Persistent connections go back to reading the next request
+    conn->state = connection_closing(conn) ? CONN_DONE : CONN_READING;
+    return CONN_IO_DONE;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "directory_listing.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+// Collects small writes into chunks before handing them to the sink
+typedef struct {
+    listing_sink sink;
+    void *arg;
+    size_t length;
+    char buffer[LISTING_CHUNK_SIZE];
+} listing_writer;
+
+static void flush_writer(listing_writer *writer) {
+    if (writer->length > 0) {
+        writer->sink(writer->arg, writer->buffer, writer->length);
+        writer->length = 0;
+    }
+}
+
+static void put(listing_writer *writer, const char *data, size_t length) {
+    while (length > 0) {
+        size_t room = sizeof(writer->buffer) - writer->length;
+        size_t bytes = length < room ? length : room;
+        memcpy(writer->buffer + writer->length, data, bytes);
+        writer->length += bytes;
+        data += bytes;
+        length -= bytes;
+        if (writer->length == sizeof(writer->buffer)) {
+            flush_writer(writer);
+        }
+    }
+}
+
+static void put_string(listing_writer *writer, const char *str) {
+    put(writer, str, strlen(str));
+}
+
+// Write text with the characters that are special in HTML escaped
+static void put_escaped(listing_writer *writer, const char *str) {
+    const char *run = str;
+    for (; *str; str++) {
+        const char *entity;
+        switch (*str) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            default: continue;
+        }
+        put(writer, run, str - run);
+        put_string(writer, entity);
+        run = str + 1;
+    }
+    put(writer, run, str - run);
+}
+
+// Write a name as a relative URL, percent-encoding everything but unreserved characters
+static void put_href(listing_writer *writer, const char *name) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (; *name; name++) {
+        unsigned char c = (unsigned char)*name;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            put(writer, name, 1);
+        } else {
+            char escaped[3] = {'%', hex[c >> 4], hex[c & 15]};
+            put(writer, escaped, sizeof(escaped));
+        }
+    }
+}
+
+// Classify an entry from d_type, only symlinks and filesystems without it need a stat
+static int entry_is_directory(int dir_fd, const struct dirent *entry, struct stat *st, int *have_stat) {
+    *have_stat = 0;
+    if (entry->d_type == DT_DIR) {
+        return 1;
+    }
+    if (entry->d_type == DT_REG) {
+        return 0;
+    }
+    if (fstatat(dir_fd, entry->d_name, st, 0) == -1) {
+        return -1;
+    }
+    *have_stat = 1;
+    return S_ISDIR(st->st_mode) ? 1 : 0;
+}
+
+int generate_directory_listing(const char *dir_path, struct stat *st, listing_sink sink, void *arg) {
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        return -1;
+    }
+    // Taken before reading, so a change made meanwhile invalidates whatever gets cached
+    if (fstat(dir_fd, st) == -1) {
+        close(dir_fd);
+        return -1;
+    }
+    DIR *dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return -1;
+    }
+
+    listing_writer writer;
+    writer.sink = sink;
+    writer.arg = arg;
+    writer.length = 0;
+
+    put_string(&writer,
+        "<!DOCTYPE html>\n"
+        "<html>\n"
+        "<head>\n"
+        "<title>Directory listing</title>\n"
+        "<script src=\"https://cdnjs.cloudflare.com/ajax/libs/jquery/3.7.1/jquery.min.js\"></script>\n"
+        "</head>\n"
+        "<body>\n"
+        "<h1>Directory listing for ");
+    put_escaped(&writer, dir_path);
+    put_string(&writer,
+        "</h1>\n"
+        "<table>\n"
+        "<tr><th>Name</th><th>Size</th><th>Last Modified</th></tr>\n");
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0) continue;
+
+        struct stat file_stat;
+        int have_stat;
+        int is_directory = entry_is_directory(dir_fd, entry, &file_stat, &have_stat);
+        if (is_directory == -1) continue;
+
+        put_string(&writer, "<tr><td><a href=\"");
+        put_href(&writer, entry->d_name);
+        put_string(&writer, is_directory ? "/\">" : "\">");
+        put_escaped(&writer, entry->d_name);
+        put_string(&writer, is_directory ? "/</a></td>" : "</a></td>");
+
+        // Subdirectories show no size, so they never need a stat of their own
+        char columns[SMALL_BUFFER / 4];
+        int length;
+        if (is_directory) {
+            length = snprintf(columns, sizeof(columns), "<td>-</td><td>-</td></tr>\n");
+        } else if (have_stat || fstatat(dir_fd, entry->d_name, &file_stat, 0) == 0) {
+            char time_str[80];
+            struct tm tm;
+            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime_r(&file_stat.st_mtime, &tm));
+            length = snprintf(columns, sizeof(columns), "<td>%ld</td><td>%s</td></tr>\n",
+                              (long)file_stat.st_size, time_str);
+        } else {
+            length = snprintf(columns, sizeof(columns), "<td>-</td><td>-</td></tr>\n");
+        }
+        put(&writer, columns, length);
+    }
+    closedir(dir);
+
+    put_string(&writer,
+        "</table>\n"
+        "</body>\n"
+        "</html>");
+    flush_writer(&writer);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include "config.h"
+#include "connection.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    timer_wheel_t timers;       // Every connection's deadline
+} event_loop;
+
+static void close_connection(event_loop *loop, connection_t *conn) {
+    timer_cancel(&loop->timers, &conn->timer);
+    // Closing the socket also removes it from the epoll set
+    connection_destroy(conn);
+}
+
+static void expire_connection(void *data, void *arg) {
+    connection_expired(data);
+    close_connection(arg, data);
+}
+
+// Drive a connection's state machine until its socket would block
+static void drive_connection(event_loop *loop, connection_t *conn) {
+    conn_io_t io = CONN_IO_DONE;
+
+    while (io == CONN_IO_DONE && conn->state != CONN_DONE) {
+        if (conn->state == CONN_READING) {
+            io = connection_read(conn);
+        } else {
+            io = connection_flush(conn);
+        }
+    }
+
+    if (conn->state == CONN_DONE || io == CONN_IO_CLOSED || io == CONN_IO_ERROR) {
+        close_connection(loop, conn);
+    } else {
+        connection_watch(conn, &loop->timers);
+    }
+}
+
+static void accept_connections(event_loop *loop) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int client_fd = accept4(loop->listen_fd, (struct sockaddr *)&client_addr, &addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ERROR("accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        connection_t *conn = connection_create(client_fd, &client_addr);
+        if (!conn) {
+            ERROR("Failed to allocate connection");
+            close(client_fd);
+            continue;
+        }
+
+        DEBUG("New connection from %s", conn->client_ip);
+
+        // Register for both directions once, edge-triggered, so state changes need no epoll_ctl
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            ERROR("epoll_ctl failed for %s: %s", conn->client_ip, strerror(errno));
+            connection_destroy(conn);
+            continue;
+        }
+
+        // Data may already be waiting, the edge for it has passed
+        drive_connection(loop, conn);
+    }
+}
+
+int event_loop_run(int listen_fd) {
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl failed");
+        return EXIT_FAILURE;
+    }
+
+    event_loop loop = {
+        .epoll_fd = epoll_create1(EPOLL_CLOEXEC),
+        .listen_fd = listen_fd
+    };
+    timer_wheel_init(&loop.timers, connection_clock());
+    if (loop.epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        return EXIT_FAILURE;
+    }
+
+    // The listener is tagged with a NULL pointer, clients carry their connection
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        perror("epoll_ctl failed");
+        close(loop.epoll_fd);
+        return EXIT_FAILURE;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        // Wake every tick to close connections past their deadlines
+        int ready = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, TIMER_TICK_MS);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_connections(&loop);
+            } else {
+                drive_connection(&loop, events[i].data.ptr);
+            }
+        }
+
+        // Only after the events, whose connections an expiry could free
+        timer_wheel_advance(&loop.timers, connection_clock(), expire_connection, &loop);
+    }
+
+    close(loop.epoll_fd);
+    return EXIT_FAILURE;
+}
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "fd_cache.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define CACHE_SHARDS 16
+#define SHARD_BUCKETS 512
+
+typedef struct {
+    pthread_mutex_t mutex;
+    fd_cache_entry *buckets[SHARD_BUCKETS];
+    fd_cache_entry *hand;       // CLOCK hand, entries form a circular list
+    int count;
+} cache_shard;
+
+static struct {
+    int ttl;
+    int shard_capacity;
+    uint64_t next_id;
+    cache_shard shards[CACHE_SHARDS];
+} cache = {
+    .ttl = 0,
+    .next_id = 1
+};
+
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+// FNV-1a
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static cache_shard *shard_for(uint32_t hash) {
+    return &cache.shards[hash % CACHE_SHARDS];
+}
+
+static fd_cache_entry **bucket_for(cache_shard *shard, uint32_t hash) {
+    return &shard->buckets[(hash / CACHE_SHARDS) % SHARD_BUCKETS];
+}
+
+int fd_cache_init(int ttl, int max_entries) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_init(&cache.shards[i].mutex, NULL);
+        memset(cache.shards[i].buckets, 0, sizeof(cache.shards[i].buckets));
+        cache.shards[i].hand = NULL;
+        cache.shards[i].count = 0;
+    }
+
+    cache.shard_capacity = max_entries / CACHE_SHARDS;
+    cache.ttl = cache.shard_capacity > 0 ? ttl : 0;
+    return 0;
+}
+
+void fd_cache_retain(fd_cache_entry *entry) {
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void fd_cache_release(fd_cache_entry *entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (entry->fd != -1) {
+            close(entry->fd);
+        }
+        free(entry);
+    }
+}
+
+static fd_cache_entry *find_entry(cache_shard *shard, const char *path, uint32_t hash) {
+    for (fd_cache_entry *entry = *bucket_for(shard, hash); entry; entry = entry->hash_next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Remove an entry from its shard, the cache's reference is handed to the caller
+static void unlink_entry(cache_shard *shard, fd_cache_entry *entry) {
+    fd_cache_entry **link = bucket_for(shard, entry->hash);
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if (entry->clock_next == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if (shard->hand == entry) {
+            shard->hand = entry->clock_next;
+        }
+    }
+
+    shard->count--;
+    entry->linked = 0;
+}
+
+// Sweep the CLOCK hand until there is room for one more entry
+static void evict(cache_shard *shard) {
+    while (shard->hand && shard->count >= cache.shard_capacity) {
+        fd_cache_entry *entry = shard->hand;
+        if (entry->referenced) {
+            entry->referenced = 0;
+            shard->hand = entry->clock_next;
+            continue;
+        }
+
+        unlink_entry(shard, entry);
+        fd_cache_release(entry);
+    }
+}
+
+void fd_cache_cleanup(void) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard *shard = &cache.shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        while (shard->hand) {
+            fd_cache_entry *entry = shard->hand;
+            unlink_entry(shard, entry);
+            fd_cache_release(entry);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    cache.ttl = 0;
+}
+
+// Open and stat path, recording a miss instead of failing
+static fd_cache_entry *resolve(const char *path, uint32_t hash, time_t now) {
+    size_t path_length = strlen(path);
+    fd_cache_entry *entry = malloc(sizeof(fd_cache_entry) + path_length + 1);
+    if (!entry) {
+        return NULL;
+    }
+
+    memcpy(entry->path, path, path_length + 1);
+    entry->hash = hash;
+    entry->refcount = 1;
+    entry->referenced = 1;
+    entry->linked = 0;
+    entry->expires = now + cache.ttl;
+    entry->missing = 0;
+    entry->id = __atomic_fetch_add(&cache.next_id, 1, __ATOMIC_RELAXED);
+
+    // O_NONBLOCK keeps a FIFO under the root from stalling the open
+    entry->fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (entry->fd == -1 || fstat(entry->fd, &entry->st) == -1) {
+        if (entry->fd != -1) {
+            close(entry->fd);
+            entry->fd = -1;
+        }
+        entry->missing = 1;
+        return entry;
+    }
+
+    // Only regular files keep their descriptor
+    if (!S_ISREG(entry->st.st_mode)) {
+        close(entry->fd);
+        entry->fd = -1;
+    }
+
+    return entry;
+}
+
+fd_cache_entry *fd_cache_open(const char *path) {
+    uint32_t hash = hash_path(path);
+    time_t now = monotonic_seconds();
+
+    if (cache.ttl == 0) {
+        metrics_count(METRIC_FD_CACHE_MISSES);
+        return resolve(path, hash, now);
+    }
+
+    cache_shard *shard = shard_for(hash);
+    fd_cache_entry *expired = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    fd_cache_entry *entry = find_entry(shard, path, hash);
+    if (entry && now >= entry->expires) {
+        // In-flight users keep the old descriptor alive until they are done
+        unlink_entry(shard, entry);
+        expired = entry;
+        entry = NULL;
+    }
+    if (entry) {
+        entry->referenced = 1;
+        __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (expired) {
+        fd_cache_release(expired);
+    }
+    if (entry) {
+        metrics_count(METRIC_FD_CACHE_HITS);
+        return entry;
+    }
+
+    metrics_count(METRIC_FD_CACHE_MISSES);
+    entry = resolve(path, hash, now);
+    if (!entry) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+
+    // Another thread may have resolved the same path meanwhile
+    fd_cache_entry *existing = find_entry(shard, path, hash);
+    if (existing) {
+        __atomic_add_fetch(&existing->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&shard->mutex);
+        fd_cache_release(entry);
+        return existing;
+    }
+
+    evict(shard);
+
+    fd_cache_entry **bucket = bucket_for(shard, hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    if (shard->hand) {
+        entry->clock_next = shard->hand;
+        entry->clock_prev = shard->hand->clock_prev;
+        entry->clock_prev->clock_next = entry;
+        shard->hand->clock_prev = entry;
+    } else {
+        entry->clock_next = entry;
+        entry->clock_prev = entry;
+        shard->hand = entry;
+    }
+    shard->count++;
+    entry->linked = 1;
+    entry->refcount++;
+
+    pthread_mutex_unlock(&shard->mutex);
+    return entry;
+}
\ No newline at end of file
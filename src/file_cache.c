@@ -0,0 +1,324 @@
+#include "file_cache.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define CACHE_SHARDS 16
+#define SHARD_BUCKETS 1024
+
+typedef struct {
+    pthread_mutex_t mutex;
+    file_cache_entry *buckets[SHARD_BUCKETS];
+    file_cache_entry *hand;     // CLOCK hand, entries form a circular list
+    size_t bytes;
+} cache_shard;
+
+static struct {
+    int enabled;
+    size_t shard_budget;
+    cache_shard shards[CACHE_SHARDS];
+} cache = {
+    .enabled = 0
+};
+
+static time_t monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+// FNV-1a over path, a separator and variant
+static uint32_t hash_key(const char *path, const char *variant) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    hash *= 16777619u;
+    while (*variant) {
+        hash ^= (unsigned char)*variant++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static cache_shard *shard_for(uint32_t hash) {
+    return &cache.shards[hash % CACHE_SHARDS];
+}
+
+static file_cache_entry **bucket_for(cache_shard *shard, uint32_t hash) {
+    return &shard->buckets[(hash / CACHE_SHARDS) % SHARD_BUCKETS];
+}
+
+static size_t entry_cost(const file_cache_entry *entry) {
+    return sizeof(file_cache_entry) + entry->header_length + entry->body_length +
+           strlen(entry->path) + strlen(entry->variant) + 2;
+}
+
+int file_cache_init(size_t budget) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_init(&cache.shards[i].mutex, NULL);
+        memset(cache.shards[i].buckets, 0, sizeof(cache.shards[i].buckets));
+        cache.shards[i].hand = NULL;
+        cache.shards[i].bytes = 0;
+    }
+
+    cache.shard_budget = budget / CACHE_SHARDS;
+    cache.enabled = budget > 0;
+    return 0;
+}
+
+void file_cache_retain(file_cache_entry *entry) {
+    __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void file_cache_release(file_cache_entry *entry) {
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(entry);
+    }
+}
+
+static file_cache_entry *find_entry(cache_shard *shard, const char *path, const char *variant, uint32_t hash) {
+    for (file_cache_entry *entry = *bucket_for(shard, hash); entry; entry = entry->hash_next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0 && strcmp(entry->variant, variant) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Remove an entry from its shard, the cache's reference is handed to the caller
+static void unlink_entry(cache_shard *shard, file_cache_entry *entry) {
+    file_cache_entry **link = bucket_for(shard, entry->hash);
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    if (entry->clock_next == entry) {
+        shard->hand = NULL;
+    } else {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+        if (shard->hand == entry) {
+            shard->hand = entry->clock_next;
+        }
+    }
+
+    shard->bytes -= entry_cost(entry);
+    entry->linked = 0;
+}
+
+// Sweep the CLOCK hand until needed bytes fit in the shard budget
+static void evict(cache_shard *shard, size_t needed) {
+    while (shard->hand && shard->bytes + needed > cache.shard_budget) {
+        file_cache_entry *entry = shard->hand;
+        if (entry->referenced) {
+            entry->referenced = 0;
+            shard->hand = entry->clock_next;
+            continue;
+        }
+
+        TRACE("Evicting %s from file cache", entry->path);
+        unlink_entry(shard, entry);
+        file_cache_release(entry);
+    }
+}
+
+void file_cache_cleanup(void) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard *shard = &cache.shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        while (shard->hand) {
+            file_cache_entry *entry = shard->hand;
+            unlink_entry(shard, entry);
+            file_cache_release(entry);
+        }
+        pthread_mutex_unlock(&shard->mutex);
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    cache.enabled = 0;
+}
+
+static void invalidate(file_cache_entry *entry) {
+    cache_shard *shard = shard_for(entry->hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    int was_linked = entry->linked;
+    if (was_linked) {
+        unlink_entry(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (was_linked) {
+        file_cache_release(entry);
+    }
+}
+
+file_cache_entry *file_cache_lookup(const char *path, const char *variant) {
+    if (!cache.enabled) {
+        return NULL;
+    }
+
+    uint32_t hash = hash_key(path, variant);
+    cache_shard *shard = shard_for(hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    file_cache_entry *entry = find_entry(shard, path, variant, hash);
+    if (entry) {
+        entry->referenced = 1;
+        __atomic_add_fetch(&entry->refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (!entry) {
+        metrics_count(METRIC_FILE_CACHE_MISSES);
+        return NULL;
+    }
+
+    // Revalidate against the file at most once per interval
+    time_t now = monotonic_seconds();
+    if (now - __atomic_load_n(&entry->validated, __ATOMIC_RELAXED) >= FILE_CACHE_REVALIDATE) {
+        struct stat st;
+        if (stat(path, &st) == -1 || st.st_size != entry->size || st.st_ino != entry->ino ||
+            st.st_mtim.tv_sec != entry->mtime.tv_sec || st.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+            DEBUG("File cache entry for %s is stale", path);
+            invalidate(entry);
+            file_cache_release(entry);
+            metrics_count(METRIC_FILE_CACHE_MISSES);
+            return NULL;
+        }
+        __atomic_store_n(&entry->validated, now, __ATOMIC_RELAXED);
+    }
+
+    metrics_count(METRIC_FILE_CACHE_HITS);
+    return entry;
+}
+
+// Allocate an entry with room for header, body, path and variant
+static file_cache_entry *alloc_entry(const char *path, const char *variant, const struct stat *st,
+                                     const char *header, size_t header_length, size_t body_length) {
+    size_t path_length = strlen(path);
+    size_t variant_length = strlen(variant);
+    file_cache_entry *entry = malloc(sizeof(file_cache_entry) + header_length + body_length +
+                                     path_length + variant_length + 2);
+    if (!entry) {
+        return NULL;
+    }
+
+    char *header_copy = entry->data;
+    char *body = header_copy + header_length;
+    memcpy(header_copy, header, header_length);
+
+    entry->path = body + body_length;
+    memcpy(entry->path, path, path_length + 1);
+    entry->variant = entry->path + path_length + 1;
+    memcpy(entry->variant, variant, variant_length + 1);
+    entry->hash = hash_key(path, variant);
+    entry->refcount = 2;
+    entry->referenced = 1;
+    entry->linked = 1;
+    entry->validated = monotonic_seconds();
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->ino = st->st_ino;
+    entry->header = header_copy;
+    entry->header_length = header_length;
+    entry->body = body;
+    entry->body_length = body_length;
+    return entry;
+}
+
+// Publish a filled entry, or return the copy another thread published first
+static file_cache_entry *publish(file_cache_entry *entry) {
+    size_t cost = entry_cost(entry);
+    if (cost > cache.shard_budget) {
+        free(entry);
+        return NULL;
+    }
+
+    cache_shard *shard = shard_for(entry->hash);
+    pthread_mutex_lock(&shard->mutex);
+
+    file_cache_entry *existing = find_entry(shard, entry->path, entry->variant, entry->hash);
+    if (existing) {
+        __atomic_add_fetch(&existing->refcount, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&shard->mutex);
+        free(entry);
+        return existing;
+    }
+
+    evict(shard, cost);
+
+    file_cache_entry **bucket = bucket_for(shard, entry->hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    // New entries go just behind the hand, the last place it reaches
+    if (shard->hand) {
+        entry->clock_next = shard->hand;
+        entry->clock_prev = shard->hand->clock_prev;
+        entry->clock_prev->clock_next = entry;
+        shard->hand->clock_prev = entry;
+    } else {
+        entry->clock_next = entry;
+        entry->clock_prev = entry;
+        shard->hand = entry;
+    }
+    shard->bytes += cost;
+
+    pthread_mutex_unlock(&shard->mutex);
+    return entry;
+}
+
+file_cache_entry *file_cache_insert(const char *path, const char *variant, int fd, const struct stat *st,
+                                    const char *header, size_t header_length) {
+    if (!cache.enabled || !S_ISREG(st->st_mode) || st->st_size > FILE_CACHE_MAX_FILE) {
+        return NULL;
+    }
+
+    size_t body_length = st->st_size;
+    file_cache_entry *entry = alloc_entry(path, variant, st, header, header_length, body_length);
+    if (!entry) {
+        return NULL;
+    }
+
+    char *body = entry->data + header_length;
+    size_t filled = 0;
+    while (filled < body_length) {
+        ssize_t bytes = pread(fd, body + filled, body_length - filled, filled);
+        if (bytes <= 0) {
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            // Changed while reading, serve it uncached
+            free(entry);
+            return NULL;
+        }
+        filled += bytes;
+    }
+
+    return publish(entry);
+}
+
+file_cache_entry *file_cache_store(const char *path, const char *variant, const struct stat *st,
+                                   const char *header, size_t header_length,
+                                   const void *body, size_t body_length) {
+    if (!cache.enabled) {
+        return NULL;
+    }
+
+    file_cache_entry *entry = alloc_entry(path, variant, st, header, header_length, body_length);
+    if (!entry) {
+        return NULL;
+    }
+
+    memcpy(entry->data + header_length, body, body_length);
+    return publish(entry);
+}
\ No newline at end of file
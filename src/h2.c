@@ -0,0 +1,1553 @@
+#include "h2.h"
+#include "hpack.h"
+#include "request_handler.h"
+#include "utils.h"
+#include "logger.h"
+#include "metrics.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_HEADER 9
+#define DEFAULT_WINDOW 65535
+#define DEFAULT_MAX_FRAME 16384
+#define MAX_FRAME_LIMIT 16777215
+#define MAX_WINDOW 0x7fffffff
+
+// Largest HTTP2-Settings header decoded on an upgrade, far more settings than are defined
+#define UPGRADE_SETTINGS_MAX 96
+
+// Streams reset by the server that are remembered once freed, frames racing the reset are ignored
+#define RESET_MEMORY 16
+
+enum {
+    FRAME_DATA = 0,
+    FRAME_HEADERS = 1,
+    FRAME_PRIORITY = 2,
+    FRAME_RST_STREAM = 3,
+    FRAME_SETTINGS = 4,
+    FRAME_PUSH_PROMISE = 5,
+    FRAME_PING = 6,
+    FRAME_GOAWAY = 7,
+    FRAME_WINDOW_UPDATE = 8,
+    FRAME_CONTINUATION = 9
+};
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+enum {
+    SETTINGS_HEADER_TABLE_SIZE = 1,
+    SETTINGS_ENABLE_PUSH = 2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 4,
+    SETTINGS_MAX_FRAME_SIZE = 5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 6
+};
+
+enum {
+    ERROR_NONE = 0x0,
+    ERROR_PROTOCOL = 0x1,
+    ERROR_INTERNAL = 0x2,
+    ERROR_FLOW_CONTROL = 0x3,
+    ERROR_STREAM_CLOSED = 0x5,
+    ERROR_FRAME_SIZE = 0x6,
+    ERROR_REFUSED_STREAM = 0x7,
+    ERROR_COMPRESSION = 0x9,
+    ERROR_ENHANCE_YOUR_CALM = 0xb
+};
+
+static const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define PREFACE_LENGTH (sizeof(client_preface) - 1)
+
+static const char switching_protocols[] =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Connection: Upgrade\r\n"
+    "Upgrade: h2c\r\n\r\n";
+
+// Header fields that only mean something to one HTTP/1 hop, never sent over HTTP/2
+static const char *const connection_fields[] = {
+    "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"
+};
+
+typedef struct {
+    size_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+} h2_frame;
+
+typedef struct h2_stream {
+    struct h2_stream *prev;         // All streams of the session
+    struct h2_stream *next;
+    struct h2_stream *ready_next;   // Streams with output to frame, taking turns
+    uint32_t id;
+    arena_t arena;                  // The request, the handler's allocations and its output segments
+    http_request_t *request;
+    access_record record;
+    body_reader reader;
+    int remote_closed;              // The client has sent END_STREAM, or the stream was reset
+    int discarding;                 // Body bytes are no longer handed to the reader
+    int responded;                  // The handler has queued its whole response
+    int failed;                     // Part of the response could not be queued
+    int head_sent;
+    int end_sent;                   // END_STREAM has gone out on HEADERS or DATA
+    int ended;                      // Nothing more is sent, the stream only waits for its output to drain
+    int ready;                      // On the ready list
+    long long content_length;       // Declared request body length, -1 when absent
+    long long received;             // Request body bytes so far
+    int64_t send_window;
+    size_t recv_unacked;            // Body bytes taken since the stream's window was last topped up
+    out_segment *out_head;          // Response output not framed yet
+    out_segment *out_tail;
+} h2_stream;
+
+typedef struct h2_session {
+    hpack_table decoder;
+    hpack_table encoder;
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    int64_t send_window;
+    size_t recv_unacked;            // DATA bytes taken since the connection's window was last topped up
+    h2_stream *streams;
+    h2_stream *ready_head;
+    h2_stream *ready_tail;
+    int open_streams;               // Streams not ended yet, bounded by h2_max_streams
+    uint32_t last_stream_id;
+    uint32_t reset_ids[RESET_MEMORY];   // The latest streams sent RST_STREAM, oldest overwritten
+    unsigned reset_next;
+    int preface_pending;            // The client preface is still to be read
+    int peer_goaway;
+    int closing;                    // Nothing more is framed, close once the queue is sent
+
+    // DATA or ignored frame whose payload is still arriving, taken as it comes
+    h2_stream *data_stream;         // NULL when the data is dropped
+    size_t data_left;
+    size_t skip_left;               // Padding or an ignored payload
+    int data_end;                   // The frame carries END_STREAM
+} h2_session;
+
+static void frame_header(unsigned char *out, size_t length, uint8_t type, uint8_t flags, uint32_t stream_id) {
+    out[0] = (unsigned char)(length >> 16);
+    out[1] = (unsigned char)(length >> 8);
+    out[2] = (unsigned char)length;
+    out[3] = type;
+    out[4] = flags;
+    out[5] = (unsigned char)((stream_id >> 24) & 0x7f);
+    out[6] = (unsigned char)(stream_id >> 16);
+    out[7] = (unsigned char)(stream_id >> 8);
+    out[8] = (unsigned char)stream_id;
+}
+
+static uint32_t read_u32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void write_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static void memory_segment(out_segment *seg, const void *data, size_t length) {
+    seg->type = OUT_MEMORY;
+    seg->data = data;
+    seg->remaining = length;
+    seg->fd = -1;
+    seg->offset = 0;
+    seg->method = FILE_SENDFILE;
+    seg->file_id = 0;
+    seg->release = NULL;
+    seg->release_arg = NULL;
+}
+
+// Slices borrow from the segment they were cut from, which keeps what both refer to
+static void keep_slice(void *arg) {
+    (void)arg;
+}
+
+// Frames live in the connection's arena, which is reset each time the queue has drained.
+// Running out of memory for one leaves the connection unusable, so it is closed
+static unsigned char *queue_frame(connection_t *conn, uint8_t type, uint8_t flags, uint32_t stream_id,
+                                  size_t length, access_record *record) {
+    out_segment *seg = arena_alloc(&conn->arena, sizeof(out_segment) + FRAME_HEADER + length);
+    if (!seg) {
+        ERROR("Failed to allocate an HTTP/2 frame for %s", conn->client_ip);
+        conn->h2->closing = 1;
+        return NULL;
+    }
+    unsigned char *frame = (unsigned char *)seg->payload;
+    frame_header(frame, length, type, flags, stream_id);
+    memory_segment(seg, frame, FRAME_HEADER + length);
+    connection_queue_segment(conn, seg, record);
+    return frame + FRAME_HEADER;
+}
+
+static void send_window_update(connection_t *conn, uint32_t stream_id, uint32_t increment) {
+    unsigned char *payload = queue_frame(conn, FRAME_WINDOW_UPDATE, 0, stream_id, 4, NULL);
+    if (payload) {
+        write_u32(payload, increment);
+    }
+}
+
+static void send_rst_stream(connection_t *conn, uint32_t stream_id, uint32_t code) {
+    h2_session *session = conn->h2;
+    session->reset_ids[session->reset_next++ % RESET_MEMORY] = stream_id;
+
+    unsigned char *payload = queue_frame(conn, FRAME_RST_STREAM, 0, stream_id, 4, NULL);
+    if (payload) {
+        write_u32(payload, code);
+    }
+}
+
+static void send_settings(connection_t *conn) {
+    static const struct {
+        uint16_t id;
+        uint32_t value;
+    } settings[] = {
+        { SETTINGS_INITIAL_WINDOW_SIZE, H2_WINDOW },
+        { SETTINGS_MAX_HEADER_LIST_SIZE, MAX_HEADER_SIZE },
+        { SETTINGS_MAX_CONCURRENT_STREAMS, 0 }
+    };
+    size_t count = sizeof(settings) / sizeof(settings[0]);
+
+    unsigned char *payload = queue_frame(conn, FRAME_SETTINGS, 0, 0, count * 6, NULL);
+    if (!payload) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = settings[i].id == SETTINGS_MAX_CONCURRENT_STREAMS ? (uint32_t)server_config.h2_max_streams
+                                                                           : settings[i].value;
+        payload[i * 6] = (unsigned char)(settings[i].id >> 8);
+        payload[i * 6 + 1] = (unsigned char)settings[i].id;
+        write_u32(payload + i * 6 + 2, value);
+    }
+
+    // The connection's window only grows by WINDOW_UPDATE
+    send_window_update(conn, 0, H2_WINDOW - DEFAULT_WINDOW);
+}
+
+// Give up on the connection: tell the client why and close once the queue is sent
+static void connection_error(connection_t *conn, uint32_t code, const char *reason) {
+    h2_session *session = conn->h2;
+    if (session->closing) {
+        return;
+    }
+    WARN("HTTP/2 connection error from %s: %s", conn->client_ip, reason);
+
+    unsigned char *payload = queue_frame(conn, FRAME_GOAWAY, 0, 0, 8, NULL);
+    if (payload) {
+        write_u32(payload, session->last_stream_id);
+        write_u32(payload + 4, code);
+    }
+    session->closing = 1;
+}
+
+// Whether the client may still be sending on a stream the server has reset
+static int recently_reset(const h2_session *session, uint32_t id) {
+    for (int i = 0; i < RESET_MEMORY; i++) {
+        if (session->reset_ids[i] == id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static h2_stream *find_stream(h2_session *session, uint32_t id) {
+    for (h2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (stream->id == id) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static void mark_ready(h2_session *session, h2_stream *stream) {
+    if (stream->ready || stream->ended) {
+        return;
+    }
+    stream->ready = 1;
+    stream->ready_next = NULL;
+    if (session->ready_tail) {
+        session->ready_tail->ready_next = stream;
+    } else {
+        session->ready_head = stream;
+    }
+    session->ready_tail = stream;
+}
+
+static void unmark_ready(h2_session *session, h2_stream *stream) {
+    if (!stream->ready) {
+        return;
+    }
+    h2_stream *previous = NULL;
+    for (h2_stream *s = session->ready_head; s; previous = s, s = s->ready_next) {
+        if (s == stream) {
+            if (previous) {
+                previous->ready_next = s->ready_next;
+            } else {
+                session->ready_head = s->ready_next;
+            }
+            if (session->ready_tail == s) {
+                session->ready_tail = previous;
+            }
+            break;
+        }
+    }
+    stream->ready = 0;
+}
+
+// Streams with output waiting get another turn once a window opens
+static void ready_waiting(h2_session *session) {
+    for (h2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (stream->head_sent && stream->out_head) {
+            mark_ready(session, stream);
+        }
+    }
+}
+
+static h2_stream *create_stream(h2_session *session, uint32_t id) {
+    h2_stream *stream = calloc(1, sizeof(h2_stream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->id = id;
+    arena_init(&stream->arena);
+    stream->content_length = -1;
+    stream->send_window = session->peer_initial_window;
+
+    stream->next = session->streams;
+    if (session->streams) {
+        session->streams->prev = stream;
+    }
+    session->streams = stream;
+    return stream;
+}
+
+static void drop_output(h2_stream *stream) {
+    out_segment *seg = stream->out_head;
+    while (seg) {
+        out_segment *next = seg->next;
+        connection_release_segment(seg);
+        seg = next;
+    }
+    stream->out_head = NULL;
+    stream->out_tail = NULL;
+}
+
+static void free_stream(h2_session *session, h2_stream *stream) {
+    if (stream->prev) {
+        stream->prev->next = stream->next;
+    } else {
+        session->streams = stream->next;
+    }
+    if (stream->next) {
+        stream->next->prev = stream->prev;
+    }
+    drop_output(stream);
+    arena_reset(&stream->arena);
+    free(stream);
+}
+
+// Run a reader callback, or anything else that may queue output, on behalf of stream
+static void abort_reader(connection_t *conn, h2_stream *stream) {
+    body_reader reader = stream->reader;
+    memset(&stream->reader, 0, sizeof(stream->reader));
+    if (reader.abort) {
+        conn->stream = stream;
+        reader.abort(conn, reader.ctx);
+        conn->stream = NULL;
+    }
+}
+
+// The stream sends nothing more. Its record completes once what was queued has gone out, then
+// the stream is freed, so the stream must not be used after this
+static void end_stream(connection_t *conn, h2_stream *stream) {
+    h2_session *session = conn->h2;
+    stream->ended = 1;
+    session->open_streams--;
+    unmark_ready(session, stream);
+    if (session->data_stream == stream) {
+        session->data_stream = NULL;
+    }
+    connection_end_record(conn, &stream->record);
+}
+
+// Abandon a stream, dropping whatever of its response hasn't been framed yet
+static void reset_stream(connection_t *conn, h2_stream *stream, uint32_t code) {
+    DEBUG("Resetting HTTP/2 stream %u from %s with error %u", stream->id, conn->client_ip, code);
+    if (stream->ended) {
+        return;
+    }
+    send_rst_stream(conn, stream->id, code);
+    drop_output(stream);
+    abort_reader(conn, stream);
+    stream->remote_closed = 1;
+    end_stream(conn, stream);
+}
+
+// The handler is done with the stream, whatever it queued is the whole response
+static void finish_handler(connection_t *conn, h2_stream *stream) {
+    stream->responded = 1;
+    if (!conn->keep_alive) {
+        // Only a response that couldn't be queued in full turns this off on HTTP/2
+        stream->failed = 1;
+        conn->keep_alive = 1;
+    }
+    mark_ready(conn->h2, stream);
+}
+
+// Stop handing the body to the reader, answering with status unless the handler already has
+static void reject_body(connection_t *conn, h2_stream *stream, const char *status) {
+    WARN("Rejecting request body from %s: %s", conn->client_ip, status);
+    stream->discarding = 1;
+    abort_reader(conn, stream);
+    if (!stream->responded) {
+        conn->stream = stream;
+        send_simple_response(conn, status, "text/plain");
+        conn->stream = NULL;
+        finish_handler(conn, stream);
+    }
+}
+
+// Hand body bytes to the stream's reader. The stream may be reset and freed on the way
+static void deliver_body(connection_t *conn, h2_stream *stream, const unsigned char *data, size_t length) {
+    stream->received += length;
+    conn->body.received += length;
+
+    if (stream->content_length >= 0 && stream->received > stream->content_length) {
+        reset_stream(conn, stream, ERROR_PROTOCOL);
+        return;
+    }
+    if (stream->discarding) {
+        return;
+    }
+    if (server_config.max_body_size && stream->received > (long long)server_config.max_body_size) {
+        reject_body(conn, stream, "413 Payload Too Large");
+        return;
+    }
+    if (stream->reader.data) {
+        conn->stream = stream;
+        stream->reader.data(conn, stream->reader.ctx, (const char *)data, length);
+        conn->stream = NULL;
+    }
+}
+
+// The client has sent all of the body, the reader answers now
+static void end_body(connection_t *conn, h2_stream *stream) {
+    stream->remote_closed = 1;
+    if (stream->content_length >= 0 && stream->received != stream->content_length) {
+        reset_stream(conn, stream, ERROR_PROTOCOL);
+        return;
+    }
+
+    body_reader reader = stream->reader;
+    memset(&stream->reader, 0, sizeof(stream->reader));
+    if (reader.end && !stream->discarding) {
+        conn->stream = stream;
+        reader.end(conn, reader.ctx);
+        conn->stream = NULL;
+        finish_handler(conn, stream);
+    }
+}
+
+// Take what has arrived of the current DATA frame's payload, returns the bytes used
+static size_t receive_payload(connection_t *conn, const unsigned char *data, size_t available) {
+    h2_session *session = conn->h2;
+    size_t used = session->data_left < available ? session->data_left : available;
+    if (used > 0) {
+        session->data_left -= used;
+        if (session->data_stream) {
+            deliver_body(conn, session->data_stream, data, used);
+        }
+    }
+
+    size_t skip = session->skip_left < available - used ? session->skip_left : available - used;
+    session->skip_left -= skip;
+    used += skip;
+
+    if (session->data_left == 0 && session->skip_left == 0) {
+        if (session->data_stream && session->data_end) {
+            end_body(conn, session->data_stream);
+        }
+        session->data_stream = NULL;
+    }
+    return used;
+}
+
+// Start taking a DATA frame, returns the bytes used, 0 to wait for more or after an error
+static size_t receive_data(connection_t *conn, const h2_frame *frame, const unsigned char *payload,
+                           size_t available) {
+    h2_session *session = conn->h2;
+    size_t pad_field = frame->flags & FLAG_PADDED ? 1 : 0;
+    if (frame->stream_id == 0) {
+        connection_error(conn, ERROR_PROTOCOL, "DATA on stream 0");
+        return 0;
+    }
+    if (available < pad_field) {
+        return 0;
+    }
+    size_t padding = pad_field ? payload[0] : 0;
+    if (pad_field + padding > frame->length) {
+        connection_error(conn, ERROR_PROTOCOL, "DATA padding exceeds the frame");
+        return 0;
+    }
+    if (frame->stream_id > session->last_stream_id) {
+        connection_error(conn, ERROR_PROTOCOL, "DATA on an idle stream");
+        return 0;
+    }
+
+    // The whole frame counts against flow control, windows are topped up as the body is taken.
+    // What is left of a window is the advertised size less what arrived since the last top up
+    if (session->recv_unacked + frame->length > H2_WINDOW) {
+        connection_error(conn, ERROR_FLOW_CONTROL, "DATA exceeds the connection window");
+        return 0;
+    }
+    session->recv_unacked += frame->length;
+    if (session->recv_unacked >= H2_WINDOW / 2) {
+        send_window_update(conn, 0, session->recv_unacked);
+        session->recv_unacked = 0;
+    }
+
+    // Data for streams that are closed or reset is dropped
+    h2_stream *stream = find_stream(session, frame->stream_id);
+    if (stream && (stream->remote_closed || stream->ended)) {
+        stream = NULL;
+    }
+    if (stream && stream->recv_unacked + frame->length > H2_WINDOW) {
+        reset_stream(conn, stream, ERROR_FLOW_CONTROL);
+        stream = NULL;
+    }
+    if (stream && !(frame->flags & FLAG_END_STREAM)) {
+        stream->recv_unacked += frame->length;
+        if (stream->recv_unacked >= H2_WINDOW / 2) {
+            send_window_update(conn, stream->id, stream->recv_unacked);
+            stream->recv_unacked = 0;
+        }
+    }
+
+    session->data_stream = stream;
+    session->data_left = frame->length - pad_field - padding;
+    session->skip_left = padding;
+    session->data_end = frame->flags & FLAG_END_STREAM;
+    return FRAME_HEADER + pad_field + receive_payload(conn, payload + pad_field, available - pad_field);
+}
+
+static int is_connection_field(http_slice name) {
+    for (size_t i = 0; i < sizeof(connection_fields) / sizeof(connection_fields[0]); i++) {
+        if (http_slice_equals(name, connection_fields[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int valid_field(const http_header *field) {
+    for (size_t i = 0; i < field->name.length; i++) {
+        char c = field->name.data[i];
+        if ((c >= 'A' && c <= 'Z') || c <= ' ' || c == 0x7f) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < field->value.length; i++) {
+        char c = field->value.data[i];
+        if (c == '\0' || c == '\r' || c == '\n') {
+            return 0;
+        }
+    }
+    return field->name.length > 0;
+}
+
+static void set_path(http_request_t *req, http_slice target) {
+    const char *question = memchr(target.data, '?', target.length);
+    req->path.data = target.data;
+    req->path.length = question ? (size_t)(question - target.data) : target.length;
+    req->query.data = question ? question + 1 : target.data + target.length;
+    req->query.length = question ? target.length - req->path.length - 1 : 0;
+}
+
+// Build a request from decoded fields: pseudo-headers first, then regular ones with lowercase names
+static http_parse_result build_request(http_request_t *req, const http_header *fields, int count) {
+    static const http_slice version = { "HTTP/2.0", 8 };
+    http_parser_init(req);
+    req->version = version;
+    req->version_major = 2;
+    req->keep_alive = 1;
+
+    http_slice authority = { NULL, 0 };
+    int has_host = 0;
+    int regular = 0;
+    size_t list_size = 0;
+    for (int i = 0; i < count; i++) {
+        const http_header *field = &fields[i];
+        if (!valid_field(field)) {
+            return HTTP_PARSE_ERROR;
+        }
+
+        // The head is held to the SETTINGS_MAX_HEADER_LIST_SIZE advertised, sized as RFC 9113 counts it
+        list_size += field->name.length + field->value.length + 32;
+        if (list_size > MAX_HEADER_SIZE) {
+            return HTTP_PARSE_TOO_LARGE;
+        }
+
+        if (field->name.data[0] == ':') {
+            if (regular) {
+                return HTTP_PARSE_ERROR;
+            }
+            if (http_slice_equals(field->name, ":method") && req->method.length == 0) {
+                req->method = field->value;
+            } else if (http_slice_equals(field->name, ":path") && req->path.length == 0) {
+                if (field->value.length == 0 || (field->value.data[0] != '/' && !http_slice_equals(field->value, "*"))) {
+                    return HTTP_PARSE_ERROR;
+                }
+                set_path(req, field->value);
+            } else if (http_slice_equals(field->name, ":authority")) {
+                authority = field->value;
+            } else if (!http_slice_equals(field->name, ":scheme")) {
+                return HTTP_PARSE_ERROR;
+            }
+            continue;
+        }
+
+        regular = 1;
+        if (is_connection_field(field->name) ||
+            (http_slice_equals(field->name, "te") && !http_slice_equals(field->value, "trailers"))) {
+            return HTTP_PARSE_ERROR;
+        }
+        has_host |= http_slice_equals(field->name, "host");
+        http_parse_result result = http_add_header(req, field->name, field->value);
+        if (result != HTTP_PARSE_DONE) {
+            return result;
+        }
+    }
+
+    if (req->method.length == 0 || req->path.length == 0) {
+        return HTTP_PARSE_ERROR;
+    }
+
+    // Handlers look for Host, which HTTP/2 carries as :authority
+    if (authority.length > 0 && !has_host) {
+        static const http_slice host = { "host", 4 };
+        return http_add_header(req, host, authority);
+    }
+    return HTTP_PARSE_DONE;
+}
+
+// Hand a stream's request to the handlers, its response is framed once they have queued it
+static void dispatch(connection_t *conn, h2_stream *stream, long long start) {
+    http_request_t *req = stream->request;
+    INFO("Request from %s: %.*s %.*s %.*s", conn->client_ip,
+         (int)req->method.length, req->method.data,
+         (int)req->path.length, req->path.data,
+         (int)req->version.length, req->version.data);
+    metrics_count(METRIC_H2_STREAMS);
+    conn->h2->open_streams++;
+
+    access_log_begin(&stream->record, conn->client_ip, req, start);
+    connection_begin_record(conn, &stream->record);
+    stream->content_length = req->content_length;
+
+    conn->stream = stream;
+    conn->route = ROUTE_NONE;
+    if (server_config.max_body_size && req->content_length > (long long)server_config.max_body_size) {
+        WARN("Rejecting request from %s: 413 Payload Too Large", conn->client_ip);
+        stream->discarding = 1;
+        send_simple_response(conn, "413 Payload Too Large", "text/plain");
+    } else {
+        handle_request(conn, req);
+    }
+    stream->record.route = conn->route;
+    conn->stream = NULL;
+
+    // A handler reading the body answers once it is in, which it may be already
+    if (!stream->reader.end) {
+        finish_handler(conn, stream);
+    } else if (stream->remote_closed) {
+        stream->remote_closed = 0;
+        end_body(conn, stream);
+    }
+}
+
+// Answer a stream whose request can't be built with a status, as HTTP/1 rejects a bad head
+static void reject_stream(connection_t *conn, h2_stream *stream, const char *status) {
+    static const http_slice unknown = { "-", 1 };
+    WARN("Rejecting request from %s: %s", conn->client_ip, status);
+    http_parser_init(stream->request);
+    stream->request->method = unknown;
+    stream->request->path = unknown;
+    conn->h2->open_streams++;
+    access_log_begin(&stream->record, conn->client_ip, stream->request, access_log_now());
+    connection_begin_record(conn, &stream->record);
+
+    stream->discarding = 1;
+    conn->stream = stream;
+    send_simple_response(conn, status, "text/plain");
+    conn->stream = NULL;
+    finish_handler(conn, stream);
+}
+
+// Open a stream for a complete header block and dispatch its request
+static void open_stream(connection_t *conn, uint32_t id, const unsigned char *block, size_t length, int end_stream) {
+    h2_session *session = conn->h2;
+    http_header fields[MAX_HEADERS + 8];
+    int max = sizeof(fields) / sizeof(fields[0]);
+    session->last_stream_id = id;
+
+    // Refused streams still go through the decoder, whose table has to stay in step
+    h2_stream *stream = NULL;
+    if (session->open_streams < server_config.h2_max_streams && !session->peer_goaway) {
+        stream = create_stream(session, id);
+    }
+    arena_t *arena = stream ? &stream->arena : &conn->arena;
+    int count = hpack_decode(&session->decoder, block, length, arena, fields, max);
+    if (count < 0) {
+        if (stream) {
+            free_stream(session, stream);
+        }
+        connection_error(conn, ERROR_COMPRESSION, "malformed header block");
+        return;
+    }
+    if (!stream) {
+        DEBUG("Refusing HTTP/2 stream %u from %s", id, conn->client_ip);
+        send_rst_stream(conn, id, ERROR_REFUSED_STREAM);
+        return;
+    }
+
+    stream->remote_closed = end_stream;
+    stream->request = arena_alloc(&stream->arena, sizeof(http_request_t));
+    if (!stream->request) {
+        free_stream(session, stream);
+        send_rst_stream(conn, id, ERROR_INTERNAL);
+        return;
+    }
+
+    http_parse_result result = count > max ? HTTP_PARSE_TOO_LARGE : build_request(stream->request, fields, count);
+    if (result == HTTP_PARSE_TOO_LARGE) {
+        reject_stream(conn, stream, "431 Request Header Fields Too Large");
+        return;
+    }
+    if (result != HTTP_PARSE_DONE) {
+        // A malformed request is a stream error, the connection carries on
+        free_stream(session, stream);
+        DEBUG("Malformed HTTP/2 request on stream %u from %s", id, conn->client_ip);
+        send_rst_stream(conn, id, ERROR_PROTOCOL);
+        return;
+    }
+    dispatch(conn, stream, access_log_now());
+}
+
+// Take a HEADERS frame and its CONTINUATION frames once all of them are in, returns the bytes
+// used, 0 to wait for more or after an error. The fragments are joined in place before decoding
+static size_t receive_headers(connection_t *conn, const h2_frame *frame, unsigned char *start, size_t available) {
+    h2_session *session = conn->h2;
+    if (frame->stream_id == 0 || frame->stream_id % 2 == 0) {
+        connection_error(conn, ERROR_PROTOCOL, "HEADERS on an invalid stream");
+        return 0;
+    }
+
+    // The whole block has to fit the input buffer, that is what bounds a request head here
+    size_t span = FRAME_HEADER + frame->length;
+    int end_headers = frame->flags & FLAG_END_HEADERS;
+    while (span <= BUFFER_SIZE && !end_headers) {
+        if (available < span + FRAME_HEADER) {
+            return 0;
+        }
+        const unsigned char *next = start + span;
+        uint32_t next_id = read_u32(next + 5) & 0x7fffffff;
+        if (next[3] != FRAME_CONTINUATION || next_id != frame->stream_id) {
+            connection_error(conn, ERROR_PROTOCOL, "header block interrupted");
+            return 0;
+        }
+        span += FRAME_HEADER + ((size_t)next[0] << 16 | (size_t)next[1] << 8 | next[2]);
+        end_headers = next[4] & FLAG_END_HEADERS;
+    }
+    if (span > BUFFER_SIZE) {
+        connection_error(conn, ERROR_ENHANCE_YOUR_CALM, "header block too large");
+        return 0;
+    }
+    if (available < span) {
+        return 0;
+    }
+
+    // The pad length and priority fields come ahead of the block, the padding after it
+    unsigned char *block = start + FRAME_HEADER;
+    size_t pad_field = frame->flags & FLAG_PADDED ? 1 : 0;
+    size_t priority = frame->flags & FLAG_PRIORITY ? 5 : 0;
+    size_t padding = pad_field && frame->length > 0 ? block[0] : 0;
+    if (frame->length < pad_field + priority + padding) {
+        connection_error(conn, ERROR_PROTOCOL, "HEADERS padding exceeds the frame");
+        return 0;
+    }
+    block += pad_field + priority;
+    size_t length = frame->length - pad_field - priority - padding;
+
+    for (size_t offset = FRAME_HEADER + frame->length; offset < span;) {
+        const unsigned char *next = start + offset;
+        size_t fragment = (size_t)next[0] << 16 | (size_t)next[1] << 8 | next[2];
+        memmove(block + length, next + FRAME_HEADER, fragment);
+        length += fragment;
+        offset += FRAME_HEADER + fragment;
+    }
+
+    int end_stream = frame->flags & FLAG_END_STREAM;
+    if (frame->stream_id > session->last_stream_id) {
+        open_stream(conn, frame->stream_id, block, length, end_stream);
+        return span;
+    }
+
+    // Streams that were skipped or have closed take nothing more, unless the server reset them and
+    // the frame crossed the reset
+    h2_stream *stream = find_stream(session, frame->stream_id);
+    if (!stream && !recently_reset(session, frame->stream_id)) {
+        connection_error(conn, ERROR_PROTOCOL, "HEADERS on a closed stream");
+        return 0;
+    }
+
+    // Trailers end a body that is still arriving, anything on a finished stream is only decoded
+    http_header fields[MAX_HEADERS];
+    if (hpack_decode(&session->decoder, block, length, &conn->arena, fields, MAX_HEADERS) < 0) {
+        connection_error(conn, ERROR_COMPRESSION, "malformed header block");
+        return 0;
+    }
+    if (stream && !stream->remote_closed && !stream->ended) {
+        if (!end_stream) {
+            reset_stream(conn, stream, ERROR_PROTOCOL);
+        } else {
+            end_body(conn, stream);
+        }
+    }
+    return span;
+}
+
+// Apply the client's settings, returns an error code, 0 when they are acceptable
+static uint32_t apply_settings(connection_t *conn, const unsigned char *payload, size_t length) {
+    h2_session *session = conn->h2;
+    for (size_t i = 0; i + 6 <= length; i += 6) {
+        uint16_t id = (uint16_t)(payload[i] << 8 | payload[i + 1]);
+        uint32_t value = read_u32(payload + i + 2);
+
+        switch (id) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            hpack_set_max_size(&session->encoder, value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1) {
+                return ERROR_PROTOCOL;
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: {
+            if (value > MAX_WINDOW) {
+                return ERROR_FLOW_CONTROL;
+            }
+            // Changes apply to the windows of open streams as a delta
+            int64_t delta = (int64_t)value - session->peer_initial_window;
+            session->peer_initial_window = value;
+            for (h2_stream *stream = session->streams; stream; stream = stream->next) {
+                stream->send_window += delta;
+                if (stream->send_window > MAX_WINDOW) {
+                    return ERROR_FLOW_CONTROL;
+                }
+            }
+            ready_waiting(session);
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < DEFAULT_MAX_FRAME || value > MAX_FRAME_LIMIT) {
+                return ERROR_PROTOCOL;
+            }
+            session->peer_max_frame = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+static void receive_window_update(connection_t *conn, const h2_frame *frame, const unsigned char *payload) {
+    h2_session *session = conn->h2;
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+
+    if (frame->stream_id == 0) {
+        if (increment == 0 || session->send_window + increment > MAX_WINDOW) {
+            connection_error(conn, ERROR_FLOW_CONTROL, "invalid connection window update");
+            return;
+        }
+        session->send_window += increment;
+        ready_waiting(session);
+        return;
+    }
+
+    if (frame->stream_id > session->last_stream_id) {
+        connection_error(conn, ERROR_PROTOCOL, "WINDOW_UPDATE on an idle stream");
+        return;
+    }
+    h2_stream *stream = find_stream(session, frame->stream_id);
+    if (!stream || stream->ended) {
+        return;
+    }
+    if (increment == 0) {
+        reset_stream(conn, stream, ERROR_PROTOCOL);
+        return;
+    }
+    if (stream->send_window + increment > MAX_WINDOW) {
+        reset_stream(conn, stream, ERROR_FLOW_CONTROL);
+        return;
+    }
+    stream->send_window += increment;
+    if (stream->head_sent && stream->out_head) {
+        mark_ready(session, stream);
+    }
+}
+
+// Handle a frame other than DATA and HEADERS, whole in the buffer
+static void receive_control(connection_t *conn, const h2_frame *frame, const unsigned char *payload) {
+    h2_session *session = conn->h2;
+
+    switch (frame->type) {
+    case FRAME_SETTINGS: {
+        if (frame->stream_id != 0) {
+            connection_error(conn, ERROR_PROTOCOL, "SETTINGS on a stream");
+            return;
+        }
+        if (frame->flags & FLAG_ACK) {
+            if (frame->length != 0) {
+                connection_error(conn, ERROR_FRAME_SIZE, "SETTINGS acknowledgement with a payload");
+            }
+            return;
+        }
+        if (frame->length % 6 != 0) {
+            connection_error(conn, ERROR_FRAME_SIZE, "truncated SETTINGS");
+            return;
+        }
+        uint32_t error = apply_settings(conn, payload, frame->length);
+        if (error) {
+            connection_error(conn, error, "invalid SETTINGS");
+            return;
+        }
+        queue_frame(conn, FRAME_SETTINGS, FLAG_ACK, 0, 0, NULL);
+        return;
+    }
+
+    case FRAME_PING: {
+        if (frame->stream_id != 0 || frame->length != 8) {
+            connection_error(conn, frame->length != 8 ? ERROR_FRAME_SIZE : ERROR_PROTOCOL, "invalid PING");
+            return;
+        }
+        if (!(frame->flags & FLAG_ACK)) {
+            unsigned char *pong = queue_frame(conn, FRAME_PING, FLAG_ACK, 0, 8, NULL);
+            if (pong) {
+                memcpy(pong, payload, 8);
+            }
+        }
+        return;
+    }
+
+    case FRAME_WINDOW_UPDATE:
+        if (frame->length != 4) {
+            connection_error(conn, ERROR_FRAME_SIZE, "invalid WINDOW_UPDATE");
+            return;
+        }
+        receive_window_update(conn, frame, payload);
+        return;
+
+    case FRAME_RST_STREAM: {
+        if (frame->length != 4) {
+            connection_error(conn, ERROR_FRAME_SIZE, "invalid RST_STREAM");
+            return;
+        }
+        if (frame->stream_id == 0 || frame->stream_id > session->last_stream_id) {
+            connection_error(conn, ERROR_PROTOCOL, "RST_STREAM on an idle stream");
+            return;
+        }
+        h2_stream *stream = find_stream(session, frame->stream_id);
+        if (stream && !stream->ended) {
+            DEBUG("HTTP/2 stream %u reset by %s", stream->id, conn->client_ip);
+            drop_output(stream);
+            abort_reader(conn, stream);
+            stream->remote_closed = 1;
+            end_stream(conn, stream);
+        }
+        return;
+    }
+
+    case FRAME_GOAWAY:
+        if (frame->stream_id != 0 || frame->length < 8) {
+            connection_error(conn, ERROR_PROTOCOL, "invalid GOAWAY");
+            return;
+        }
+        // Streams already open are still answered
+        session->peer_goaway = 1;
+        return;
+
+    case FRAME_PRIORITY:
+        if (frame->stream_id == 0) {
+            connection_error(conn, ERROR_PROTOCOL, "PRIORITY on stream 0");
+        }
+        return;
+
+    case FRAME_PUSH_PROMISE:
+        connection_error(conn, ERROR_PROTOCOL, "PUSH_PROMISE from a client");
+        return;
+
+    case FRAME_CONTINUATION:
+        connection_error(conn, ERROR_PROTOCOL, "CONTINUATION without HEADERS");
+        return;
+
+    default:
+        return;
+    }
+}
+
+int h2_preface(const char *buf, size_t length) {
+    size_t compared = length < PREFACE_LENGTH ? length : PREFACE_LENGTH;
+    if (memcmp(buf, client_preface, compared) != 0) {
+        return -1;
+    }
+    return length >= PREFACE_LENGTH ? 1 : 0;
+}
+
+static h2_session *create_session(connection_t *conn) {
+    h2_session *session = calloc(1, sizeof(h2_session));
+    if (!session) {
+        return NULL;
+    }
+    hpack_table_init(&session->decoder);
+    hpack_table_init(&session->encoder);
+    session->peer_initial_window = DEFAULT_WINDOW;
+    session->peer_max_frame = DEFAULT_MAX_FRAME;
+    session->send_window = DEFAULT_WINDOW;
+    session->preface_pending = 1;
+
+    conn->h2 = session;
+    conn->keep_alive = 1;
+    conn->body.received = 0;
+    metrics_count(METRIC_H2_CONNECTIONS);
+    DEBUG("Connection from %s switched to HTTP/2", conn->client_ip);
+    return session;
+}
+
+void h2_start(connection_t *conn) {
+    if (!create_session(conn)) {
+        ERROR("Failed to allocate an HTTP/2 session for %s", conn->client_ip);
+        conn->state = CONN_DONE;
+        return;
+    }
+    send_settings(conn);
+    h2_received(conn);
+}
+
+// Decode an HTTP2-Settings value, base64url without padding, returns the length or -1
+static int decode_settings(http_slice value, unsigned char *out, size_t size) {
+    size_t length = 0;
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        char c = value.data[i];
+        int digit;
+        if (c >= 'A' && c <= 'Z') digit = c - 'A';
+        else if (c >= 'a' && c <= 'z') digit = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') digit = c - '0' + 52;
+        else if (c == '-' || c == '+') digit = 62;
+        else if (c == '_' || c == '/') digit = 63;
+        else if (c == '=') break;
+        else return -1;
+
+        bits = bits << 6 | digit;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            if (length == size) {
+                return -1;
+            }
+            out[length++] = (unsigned char)(bits >> bit_count);
+        }
+    }
+    return length % 6 == 0 ? (int)length : -1;
+}
+
+static int copy_slice(arena_t *arena, http_slice *slice) {
+    if (slice->length == 0) {
+        return 0;
+    }
+    char *copy = arena_alloc(arena, slice->length);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, slice->data, slice->length);
+    slice->data = copy;
+    return 0;
+}
+
+// Copy an HTTP/1 request out of the input buffer into the stream's arena
+static int copy_request(h2_stream *stream, const http_request_t *req) {
+    static const http_slice version = { "HTTP/2.0", 8 };
+    http_request_t *copy = arena_alloc(&stream->arena, sizeof(http_request_t));
+    if (!copy) {
+        return -1;
+    }
+    *copy = *req;
+    int failed = copy_slice(&stream->arena, &copy->method) | copy_slice(&stream->arena, &copy->path) |
+                 copy_slice(&stream->arena, &copy->query);
+    for (int i = 0; i < copy->header_count; i++) {
+        failed |= copy_slice(&stream->arena, &copy->headers[i].name) |
+                  copy_slice(&stream->arena, &copy->headers[i].value);
+    }
+
+    // The response goes out over HTTP/2, framed by the stream
+    copy->version = version;
+    copy->version_major = 2;
+    copy->version_minor = 0;
+    stream->request = copy;
+    return failed ? -1 : 0;
+}
+
+int h2_upgrade(connection_t *conn, const http_request_t *req) {
+    const http_slice *upgrade = http_get_header(req, "Upgrade");
+    const http_slice *connection = http_get_header(req, "Connection");
+    const http_slice *settings = http_get_header(req, "HTTP2-Settings");
+    if (req->version_minor != 1 || !upgrade || !connection || !settings || !http_has_token(*upgrade, "h2c") ||
+        !http_has_token(*connection, "upgrade") || !http_has_token(*connection, "http2-settings")) {
+        return -1;
+    }
+
+    // Only a request without a body, with nothing ahead of it still to send, switches over
+    unsigned char payload[UPGRADE_SETTINGS_MAX];
+    int length = decode_settings(*settings, payload, sizeof(payload));
+    if (length < 0 || req->chunked || req->content_length > 0 || conn->access_head) {
+        return -1;
+    }
+
+    h2_session *session = create_session(conn);
+    if (!session) {
+        return -1;
+    }
+    h2_stream *stream = create_stream(session, 1);
+    if (!stream || copy_request(stream, req) != 0 || apply_settings(conn, payload, length) != 0) {
+        h2_destroy(conn);
+        conn->keep_alive = 0;
+        return -1;
+    }
+
+    connection_queue_data(conn, switching_protocols, sizeof(switching_protocols) - 1);
+    send_settings(conn);
+    conn->requests_served++;
+
+    // The request is stream 1, half closed, and the client preface follows it
+    size_t request_length = req->header_length;
+    conn->in_len -= request_length;
+    memmove(conn->in_buf, conn->in_buf + request_length, conn->in_len);
+    conn->request = NULL;
+
+    session->last_stream_id = 1;
+    stream->remote_closed = 1;
+    dispatch(conn, stream, conn->request_start ? conn->request_start : access_log_now());
+    h2_received(conn);
+    return 0;
+}
+
+void h2_received(connection_t *conn) {
+    h2_session *session = conn->h2;
+    unsigned char *buf = (unsigned char *)conn->in_buf;
+    size_t length = conn->in_len;
+    size_t offset = 0;
+
+    if (session->preface_pending && length > 0) {
+        int preface = h2_preface((const char *)buf, length);
+        if (preface == -1) {
+            connection_error(conn, ERROR_PROTOCOL, "missing client preface");
+        } else if (preface == 1) {
+            offset = PREFACE_LENGTH;
+            session->preface_pending = 0;
+        }
+    }
+
+    while (!session->closing && !session->preface_pending && offset < length) {
+        if (session->data_left > 0 || session->skip_left > 0) {
+            offset += receive_payload(conn, buf + offset, length - offset);
+            continue;
+        }
+        if (length - offset < FRAME_HEADER) {
+            break;
+        }
+
+        unsigned char *start = buf + offset;
+        h2_frame frame = {
+            .length = (size_t)start[0] << 16 | (size_t)start[1] << 8 | start[2],
+            .type = start[3],
+            .flags = start[4],
+            .stream_id = read_u32(start + 5) & 0x7fffffff
+        };
+        size_t available = length - offset - FRAME_HEADER;
+        if (frame.length > DEFAULT_MAX_FRAME) {
+            connection_error(conn, ERROR_FRAME_SIZE, "frame larger than SETTINGS_MAX_FRAME_SIZE");
+            break;
+        }
+
+        size_t used;
+        if (frame.type == FRAME_DATA) {
+            used = receive_data(conn, &frame, start + FRAME_HEADER, available);
+        } else if (frame.type == FRAME_HEADERS) {
+            used = receive_headers(conn, &frame, start, length - offset);
+        } else if (frame.type > FRAME_CONTINUATION) {
+            // Unknown frame types are skipped as they arrive
+            session->data_stream = NULL;
+            session->data_left = 0;
+            session->skip_left = frame.length;
+            used = FRAME_HEADER;
+        } else if (frame.length > BUFFER_SIZE - FRAME_HEADER) {
+            connection_error(conn, ERROR_FRAME_SIZE, "control frame too large");
+            used = 0;
+        } else if (available < frame.length) {
+            used = 0;
+        } else {
+            receive_control(conn, &frame, start + FRAME_HEADER);
+            used = FRAME_HEADER + frame.length;
+        }
+        if (used == 0) {
+            break;
+        }
+        offset += used;
+    }
+
+    // Only a partial frame is kept, DATA is taken as it comes and nothing else outgrows the buffer
+    conn->in_len = length - offset;
+    memmove(buf, buf + offset, conn->in_len);
+
+    h2_write(conn);
+    if (session->closing) {
+        conn->state = CONN_WRITING;
+    }
+}
+
+void *h2_stream_alloc(h2_stream *stream, size_t size) {
+    return arena_alloc(&stream->arena, size);
+}
+
+void h2_stream_queue(h2_stream *stream, out_segment *seg) {
+    seg->next = NULL;
+    seg->record = NULL;
+    if (stream->out_tail) {
+        stream->out_tail->next = seg;
+    } else {
+        stream->out_head = seg;
+    }
+    stream->out_tail = seg;
+}
+
+void h2_stream_read_body(h2_stream *stream, const body_reader *reader) {
+    stream->reader = *reader;
+}
+
+// Read the status code off an HTTP/1 status line
+static int head_status(const char *head, size_t length) {
+    if (length < 12 || memcmp(head, "HTTP/1.", 7) != 0 || head[8] != ' ') {
+        return 0;
+    }
+    int status = 0;
+    for (int i = 9; i < 12; i++) {
+        if (head[i] < '0' || head[i] > '9') {
+            return 0;
+        }
+        status = status * 10 + (head[i] - '0');
+    }
+    return status >= 200 && status <= 599 ? status : 0;
+}
+
+// Encode the HTTP/1 head the handler rendered as a header block, into block. Returns its length,
+// or 0 when the head can't be converted
+static size_t encode_head(h2_session *session, const out_segment *head, unsigned char *block, int *status) {
+    const char *p = head->data;
+    const char *end = p + head->remaining;
+    *status = head_status(p, head->remaining);
+    const char *line_end = memchr(p, '\n', end - p);
+    if (*status == 0 || !line_end) {
+        return 0;
+    }
+
+    size_t length = hpack_begin_block(&session->encoder, block);
+    length += hpack_encode_status(&session->encoder, block + length, *status);
+    for (p = line_end + 1; p < end; p = line_end + 1) {
+        line_end = memchr(p, '\n', end - p);
+        if (!line_end) {
+            return 0;
+        }
+        const char *value_end = line_end > p && line_end[-1] == '\r' ? line_end - 1 : line_end;
+        if (value_end == p) {
+            break;
+        }
+        const char *colon = memchr(p, ':', value_end - p);
+        char name[64];
+        size_t name_length = colon ? (size_t)(colon - p) : 0;
+        if (name_length == 0 || name_length > sizeof(name)) {
+            return 0;
+        }
+        for (size_t i = 0; i < name_length; i++) {
+            char c = p[i];
+            name[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+        }
+        http_slice name_slice = { name, name_length };
+        if (is_connection_field(name_slice)) {
+            continue;
+        }
+
+        const char *value = colon + 1;
+        while (value < value_end && (*value == ' ' || *value == '\t')) value++;
+        length += hpack_encode(&session->encoder, block + length, name, name_length, value, value_end - value);
+    }
+    return length;
+}
+
+// Frame the response head as HEADERS, followed by CONTINUATION frames when it is larger than a
+// frame may be. Returns the bytes queued, 0 when it couldn't be sent
+static size_t send_head(connection_t *conn, h2_stream *stream) {
+    h2_session *session = conn->h2;
+    out_segment *head = stream->out_head;
+    stream->out_head = head->next;
+    if (!stream->out_head) {
+        stream->out_tail = NULL;
+    }
+
+    // Every head line spends at least four bytes on ": " and CRLF, the most a field's encoding adds
+    // to its name and value in HPACK_FIELD_MAX is twelve
+    unsigned char *frame = arena_alloc(&conn->arena, FRAME_HEADER + head->remaining * 4 + 16);
+    int status = 0;
+    size_t length = frame ? encode_head(session, head, frame + FRAME_HEADER, &status) : 0;
+    connection_release_segment(head);
+    if (length == 0) {
+        ERROR("Failed to convert a response head for HTTP/2 stream %u from %s", stream->id, conn->client_ip);
+        return 0;
+    }
+    stream->record.status = status;
+    stream->head_sent = 1;
+
+    uint8_t flags = 0;
+    if (stream->responded && !stream->failed && !stream->out_head) {
+        flags |= FLAG_END_STREAM;
+        stream->end_sent = 1;
+    }
+
+    // The first fragment shares the allocation with its frame header, the rest get their own
+    size_t first = length < session->peer_max_frame ? length : session->peer_max_frame;
+    out_segment *seg = arena_alloc(&conn->arena, sizeof(out_segment));
+    if (!seg) {
+        conn->h2->closing = 1;
+        return 0;
+    }
+    frame_header(frame, first, FRAME_HEADERS, flags | (first == length ? FLAG_END_HEADERS : 0), stream->id);
+    memory_segment(seg, frame, FRAME_HEADER + first);
+    connection_queue_segment(conn, seg, &stream->record);
+
+    for (size_t sent = first; sent < length;) {
+        size_t fragment = length - sent < session->peer_max_frame ? length - sent : session->peer_max_frame;
+        out_segment *header = arena_alloc(&conn->arena, sizeof(out_segment) + FRAME_HEADER);
+        out_segment *body = arena_alloc(&conn->arena, sizeof(out_segment));
+        if (!header || !body) {
+            conn->h2->closing = 1;
+            return 0;
+        }
+        frame_header((unsigned char *)header->payload, fragment, FRAME_CONTINUATION,
+                     sent + fragment == length ? FLAG_END_HEADERS : 0, stream->id);
+        memory_segment(header, header->payload, FRAME_HEADER);
+        memory_segment(body, frame + FRAME_HEADER + sent, fragment);
+        connection_queue_segment(conn, header, &stream->record);
+        connection_queue_segment(conn, body, &stream->record);
+        sent += fragment;
+    }
+    return FRAME_HEADER + length;
+}
+
+// Frame the front of the stream's output as one DATA frame, as large as the windows and the
+// client's frame size allow. Whole segments move to the connection's queue, the last one may be
+// cut, with the slice borrowing from it. Returns the bytes queued
+static size_t send_data(connection_t *conn, h2_stream *stream) {
+    h2_session *session = conn->h2;
+    int64_t window = stream->send_window < session->send_window ? stream->send_window : session->send_window;
+    size_t limit = session->peer_max_frame;
+    if (window <= 0) {
+        return 0;
+    }
+    if ((int64_t)limit > window) {
+        limit = window;
+    }
+
+    size_t length = 0;
+    out_segment *seg = stream->out_head;
+    for (; seg && length < limit; seg = seg->next) {
+        length += seg->remaining;
+    }
+    uint8_t flags = 0;
+    if (length <= limit && !seg && stream->responded && !stream->failed) {
+        flags |= FLAG_END_STREAM;
+        stream->end_sent = 1;
+    }
+    if (length > limit) {
+        length = limit;
+    }
+
+    if (!queue_frame(conn, FRAME_DATA, flags, stream->id, 0, &stream->record)) {
+        return 0;
+    }
+    // The frame header went out with an empty payload, it is patched to the real length
+    frame_header((unsigned char *)conn->out_tail->data, length, FRAME_DATA, flags, stream->id);
+
+    for (size_t left = length; left > 0;) {
+        seg = stream->out_head;
+        if (seg->remaining <= left) {
+            stream->out_head = seg->next;
+            if (!stream->out_head) {
+                stream->out_tail = NULL;
+            }
+            left -= seg->remaining;
+            connection_queue_segment(conn, seg, &stream->record);
+            continue;
+        }
+
+        out_segment *slice = arena_alloc(&conn->arena, sizeof(out_segment));
+        if (!slice) {
+            conn->h2->closing = 1;
+            return 0;
+        }
+        *slice = *seg;
+        slice->remaining = left;
+        slice->release = keep_slice;
+        slice->release_arg = NULL;
+        if (seg->type == OUT_MEMORY) {
+            seg->data += left;
+        } else {
+            seg->offset += left;
+        }
+        seg->remaining -= left;
+        connection_queue_segment(conn, slice, &stream->record);
+        left = 0;
+    }
+
+    stream->send_window -= length;
+    session->send_window -= length;
+    return FRAME_HEADER + length;
+}
+
+// Frame the next part of a stream's response, returns the bytes queued. The stream may be ended,
+// and freed, on the way
+static size_t frame_stream(connection_t *conn, h2_stream *stream) {
+    size_t queued = 0;
+
+    if (!stream->head_sent) {
+        if (!stream->out_head) {
+            if (stream->responded) {
+                // The handler answered without a response
+                reset_stream(conn, stream, ERROR_INTERNAL);
+            }
+            return 0;
+        }
+        queued = send_head(conn, stream);
+        if (queued == 0) {
+            reset_stream(conn, stream, ERROR_INTERNAL);
+            return 0;
+        }
+    }
+
+    if (stream->out_head) {
+        queued += send_data(conn, stream);
+    }
+    if (stream->out_head || !stream->responded) {
+        // More to come once a window opens or the handler answers
+        int64_t window = stream->send_window < conn->h2->send_window ? stream->send_window : conn->h2->send_window;
+        if (stream->out_head && window > 0) {
+            mark_ready(conn->h2, stream);
+        }
+        return queued;
+    }
+
+    if (stream->failed) {
+        reset_stream(conn, stream, ERROR_INTERNAL);
+        return queued;
+    }
+    if (!stream->end_sent) {
+        queue_frame(conn, FRAME_DATA, FLAG_END_STREAM, stream->id, 0, &stream->record);
+        stream->end_sent = 1;
+        queued += FRAME_HEADER;
+    }
+
+    // The client may send the rest of its body, it is asked not to
+    if (!stream->remote_closed) {
+        send_rst_stream(conn, stream->id, ERROR_NONE);
+        abort_reader(conn, stream);
+        stream->remote_closed = 1;
+    }
+    end_stream(conn, stream);
+    return queued;
+}
+
+void h2_write(connection_t *conn) {
+    h2_session *session = conn->h2;
+    size_t queued = 0;
+
+    // Streams take turns a frame at a time, so one large response doesn't hold up the others.
+    // After an upgrade, stream 1 waits for the client preface, and with it the client's settings
+    while (!session->closing && !session->preface_pending && session->ready_head && queued < H2_WRITE_BATCH) {
+        h2_stream *stream = session->ready_head;
+        session->ready_head = stream->ready_next;
+        if (!session->ready_head) {
+            session->ready_tail = NULL;
+        }
+        stream->ready = 0;
+        queued += frame_stream(conn, stream);
+    }
+
+    // A client that said goodbye is let go once its streams are answered
+    if (session->peer_goaway && session->open_streams == 0) {
+        session->closing = 1;
+    }
+}
+
+int h2_closing(const connection_t *conn) {
+    return conn->h2->closing;
+}
+
+conn_timeout_t h2_timeout(const connection_t *conn) {
+    const h2_session *session = conn->h2;
+    conn_timeout_t timeout = conn->in_len > 0 ? TIMEOUT_HEADER : TIMEOUT_IDLE;
+    if (session->data_left > 0 || session->skip_left > 0) {
+        timeout = TIMEOUT_BODY;
+    }
+
+    for (const h2_stream *stream = session->streams; stream; stream = stream->next) {
+        if (stream->ended) {
+            continue;
+        }
+        // Output held back by flow control waits for the client as a response does
+        if (stream->head_sent && stream->out_head) {
+            return TIMEOUT_RESPONSE;
+        }
+        if (stream->reader.end && !stream->remote_closed) {
+            timeout = TIMEOUT_BODY;
+        }
+    }
+    return timeout;
+}
+
+void h2_destroy(connection_t *conn) {
+    h2_session *session = conn->h2;
+    while (session->streams) {
+        h2_stream *stream = session->streams;
+        if (!stream->remote_closed) {
+            abort_reader(conn, stream);
+        }
+        free_stream(session, stream);
+    }
+    hpack_table_cleanup(&session->decoder);
+    hpack_table_cleanup(&session->encoder);
+    free(session);
+    conn->h2 = NULL;
+}
+
+void h2_record_sent(connection_t *conn, access_record *record) {
+    h2_stream *stream = (h2_stream *)((char *)record - offsetof(h2_stream, record));
+    free_stream(conn->h2, stream);
+}
\ No newline at end of file
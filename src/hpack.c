@@ -0,0 +1,493 @@
+#include "hpack.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATIC_ENTRIES 61
+#define HUFFMAN_SYMBOLS 257
+#define HUFFMAN_EOS 256
+#define HUFFMAN_MIN_LENGTH 5
+#define HUFFMAN_MAX_LENGTH 30
+
+// Integers and lengths past this are never valid here
+#define INTEGER_LIMIT (1 << 24)
+
+typedef struct hpack_entry {
+    size_t name_length;
+    size_t value_length;
+    char data[];                // Name followed by value
+} hpack_entry;
+
+typedef struct {
+    const char *name;
+    const char *value;
+} static_field;
+
+static const static_field static_table[STATIC_ENTRIES] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""}
+};
+
+// Response fields whose values rarely repeat are sent without taking up table space
+static const char *const unindexed_fields[] = {
+    "content-length", "content-range", "etag", "last-modified", "set-cookie"
+};
+
+// Code lengths of RFC 7541 Appendix B by symbol. The code is canonical, so the codes themselves
+// follow from the lengths
+static const unsigned char huffman_lengths[HUFFMAN_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+// Canonical decoding: the codes of one length are consecutive, starting at first_code
+static struct {
+    uint32_t codes[HUFFMAN_SYMBOLS];
+    uint32_t first_code[HUFFMAN_MAX_LENGTH + 1];
+    uint16_t count[HUFFMAN_MAX_LENGTH + 1];
+    uint16_t offset[HUFFMAN_MAX_LENGTH + 1];    // Where the length's symbols start in symbols
+    uint16_t symbols[HUFFMAN_SYMBOLS];          // By code length, then by symbol
+} huffman;
+
+void hpack_init(void) {
+    memset(&huffman, 0, sizeof(huffman));
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+        huffman.count[huffman_lengths[symbol]]++;
+    }
+
+    uint32_t code = 0;
+    uint16_t offset = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+        code = (code + huffman.count[length - 1]) << 1;
+        huffman.first_code[length] = code;
+        huffman.offset[length] = offset;
+        offset += huffman.count[length];
+    }
+
+    uint16_t next[HUFFMAN_MAX_LENGTH + 1];
+    memset(next, 0, sizeof(next));
+    for (int symbol = 0; symbol < HUFFMAN_SYMBOLS; symbol++) {
+        int length = huffman_lengths[symbol];
+        huffman.codes[symbol] = huffman.first_code[length] + next[length];
+        huffman.symbols[huffman.offset[length] + next[length]] = symbol;
+        next[length]++;
+    }
+}
+
+static int huffman_decode(const unsigned char *in, size_t length, char *out, size_t *out_length) {
+    uint64_t bits = 0;
+    int bit_count = 0;
+    size_t written = 0;
+    size_t i = 0;
+
+    for (;;) {
+        // Keep at least a whole code buffered while input remains
+        while (bit_count <= HUFFMAN_MAX_LENGTH && i < length) {
+            bits = (bits << 8) | in[i++];
+            bit_count += 8;
+        }
+
+        int symbol = -1;
+        for (int code_length = HUFFMAN_MIN_LENGTH; code_length <= bit_count && code_length <= HUFFMAN_MAX_LENGTH;
+             code_length++) {
+            uint32_t code = (uint32_t)(bits >> (bit_count - code_length)) & ((1u << code_length) - 1);
+            if (code - huffman.first_code[code_length] < huffman.count[code_length]) {
+                symbol = huffman.symbols[huffman.offset[code_length] + code - huffman.first_code[code_length]];
+                bit_count -= code_length;
+                break;
+            }
+        }
+
+        if (symbol == HUFFMAN_EOS) {
+            return -1;
+        }
+        if (symbol == -1) {
+            break;
+        }
+        out[written++] = (char)symbol;
+    }
+
+    // What is left can only be padding, fewer than 8 bits taken from the EOS code
+    if (i < length || bit_count > 7 || (bits & ((1u << bit_count) - 1)) != (1u << bit_count) - 1) {
+        return -1;
+    }
+    *out_length = written;
+    return 0;
+}
+
+static size_t huffman_length(const char *in, size_t length) {
+    size_t bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        bits += huffman_lengths[(unsigned char)in[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+static size_t huffman_encode(const char *in, size_t length, unsigned char *out) {
+    uint64_t bits = 0;
+    int bit_count = 0;
+    size_t written = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char symbol = in[i];
+        bits = (bits << huffman_lengths[symbol]) | huffman.codes[symbol];
+        bit_count += huffman_lengths[symbol];
+        while (bit_count >= 8) {
+            bit_count -= 8;
+            out[written++] = (unsigned char)(bits >> bit_count);
+        }
+    }
+    if (bit_count > 0) {
+        out[written++] = (unsigned char)((bits << (8 - bit_count)) | (0xff >> bit_count));
+    }
+    return written;
+}
+
+void hpack_table_init(hpack_table *table) {
+    memset(table->entries, 0, sizeof(table->entries));
+    table->newest = HPACK_MAX_ENTRIES - 1;
+    table->count = 0;
+    table->size = 0;
+    table->max_size = HPACK_TABLE_SIZE;
+    table->size_changed = 0;
+}
+
+static void evict_oldest(hpack_table *table) {
+    unsigned slot = (table->newest + HPACK_MAX_ENTRIES - table->count + 1) % HPACK_MAX_ENTRIES;
+    hpack_entry *entry = table->entries[slot];
+    table->size -= entry->name_length + entry->value_length + 32;
+    table->entries[slot] = NULL;
+    table->count--;
+    free(entry);
+}
+
+void hpack_table_cleanup(hpack_table *table) {
+    while (table->count > 0) {
+        evict_oldest(table);
+    }
+}
+
+// Dynamic entry by 1-based index, newest first
+static const hpack_entry *dynamic_entry(const hpack_table *table, size_t index) {
+    if (index == 0 || index > table->count) {
+        return NULL;
+    }
+    return table->entries[(table->newest + HPACK_MAX_ENTRIES - (index - 1)) % HPACK_MAX_ENTRIES];
+}
+
+// Add a field as the newest entry, evicting as needed. A field larger than the whole table just
+// empties it. Returns -1 when out of memory
+static int insert(hpack_table *table, const char *name, size_t name_length, const char *value, size_t value_length) {
+    size_t size = name_length + value_length + 32;
+    while (table->count > 0 && table->size + size > table->max_size) {
+        evict_oldest(table);
+    }
+    if (size > table->max_size) {
+        return 0;
+    }
+
+    hpack_entry *entry = malloc(sizeof(hpack_entry) + name_length + value_length);
+    if (!entry) {
+        return -1;
+    }
+    entry->name_length = name_length;
+    entry->value_length = value_length;
+    memcpy(entry->data, name, name_length);
+    memcpy(entry->data + name_length, value, value_length);
+
+    table->newest = (table->newest + 1) % HPACK_MAX_ENTRIES;
+    table->entries[table->newest] = entry;
+    table->count++;
+    table->size += size;
+    return 0;
+}
+
+static void resize(hpack_table *table, size_t size) {
+    table->max_size = size;
+    while (table->count > 0 && table->size > table->max_size) {
+        evict_oldest(table);
+    }
+}
+
+static int decode_integer(const unsigned char **p, const unsigned char *end, int prefix_bits, size_t *value) {
+    unsigned int prefix_max = (1u << prefix_bits) - 1;
+    *value = **p & prefix_max;
+    (*p)++;
+    if (*value < prefix_max) {
+        return 0;
+    }
+
+    for (int shift = 0; *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        *value += (size_t)(byte & 0x7f) << shift;
+        if (*value > INTEGER_LIMIT) {
+            return -1;
+        }
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Decode a string literal into arena
+static int decode_string(const unsigned char **p, const unsigned char *end, arena_t *arena, http_slice *out) {
+    if (*p >= end) {
+        return -1;
+    }
+    int huffman_coded = **p & 0x80;
+    size_t length;
+    if (decode_integer(p, end, 7, &length) != 0 || length > (size_t)(end - *p)) {
+        return -1;
+    }
+
+    // The shortest code is 5 bits, so a Huffman string expands at most 8/5 times
+    size_t capacity = huffman_coded ? length * 8 / 5 + 1 : length + 1;
+    char *data = arena_alloc(arena, capacity);
+    if (!data) {
+        return -1;
+    }
+    if (huffman_coded) {
+        if (huffman_decode(*p, length, data, &out->length) != 0) {
+            return -1;
+        }
+    } else {
+        memcpy(data, *p, length);
+        out->length = length;
+    }
+    out->data = data;
+    *p += length;
+    return 0;
+}
+
+// Copy the field at a static or dynamic index into arena
+static int indexed_field(const hpack_table *table, size_t index, arena_t *arena, int with_value, http_header *field) {
+    const char *name;
+    const char *value;
+    size_t name_length;
+    size_t value_length;
+
+    if (index >= 1 && index <= STATIC_ENTRIES) {
+        name = static_table[index - 1].name;
+        value = static_table[index - 1].value;
+        name_length = strlen(name);
+        value_length = strlen(value);
+    } else {
+        const hpack_entry *entry = dynamic_entry(table, index - STATIC_ENTRIES);
+        if (!entry) {
+            return -1;
+        }
+        name = entry->data;
+        name_length = entry->name_length;
+        value = entry->data + entry->name_length;
+        value_length = entry->value_length;
+    }
+
+    // Entries may be evicted later in the same block, so the field gets its own copy
+    char *copy = arena_alloc(arena, name_length + (with_value ? value_length : 0) + 1);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, name, name_length);
+    field->name.data = copy;
+    field->name.length = name_length;
+    if (with_value) {
+        memcpy(copy + name_length, value, value_length);
+        field->value.data = copy + name_length;
+        field->value.length = value_length;
+    }
+    return 0;
+}
+
+int hpack_decode(hpack_table *table, const unsigned char *block, size_t length, arena_t *arena,
+                 http_header *fields, int max) {
+    const unsigned char *p = block;
+    const unsigned char *end = block + length;
+    int count = 0;
+
+    while (p < end) {
+        unsigned char byte = *p;
+        http_header field;
+        http_header *out = count < max ? &fields[count] : &field;
+        size_t index;
+
+        if (byte & 0x80) {
+            // Indexed field
+            if (decode_integer(&p, end, 7, &index) != 0 || indexed_field(table, index, arena, 1, out) != 0) {
+                return -1;
+            }
+            count++;
+            continue;
+        }
+
+        if ((byte & 0xe0) == 0x20) {
+            // Table size update, only allowed ahead of the first field and up to what we advertised
+            if (count > 0 || decode_integer(&p, end, 5, &index) != 0 || index > HPACK_TABLE_SIZE) {
+                return -1;
+            }
+            resize(table, index);
+            continue;
+        }
+
+        // Literal field, with incremental indexing, without indexing or never indexed
+        int indexing = (byte & 0xc0) == 0x40;
+        if (decode_integer(&p, end, indexing ? 6 : 4, &index) != 0) {
+            return -1;
+        }
+        if (index > 0) {
+            if (indexed_field(table, index, arena, 0, out) != 0) {
+                return -1;
+            }
+        } else if (decode_string(&p, end, arena, &out->name) != 0) {
+            return -1;
+        }
+        if (decode_string(&p, end, arena, &out->value) != 0) {
+            return -1;
+        }
+        if (indexing && insert(table, out->name.data, out->name.length, out->value.data, out->value.length) != 0) {
+            return -1;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+static size_t encode_integer(unsigned char *out, unsigned char flags, int prefix_bits, size_t value) {
+    unsigned int prefix_max = (1u << prefix_bits) - 1;
+    if (value < prefix_max) {
+        out[0] = flags | (unsigned char)value;
+        return 1;
+    }
+
+    out[0] = flags | prefix_max;
+    value -= prefix_max;
+    size_t written = 1;
+    while (value >= 0x80) {
+        out[written++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[written++] = (unsigned char)value;
+    return written;
+}
+
+// String literal, Huffman coded when that is shorter
+static size_t encode_string(unsigned char *out, const char *data, size_t length) {
+    size_t coded_length = huffman_length(data, length);
+    if (coded_length < length) {
+        size_t written = encode_integer(out, 0x80, 7, coded_length);
+        return written + huffman_encode(data, length, out + written);
+    }
+    size_t written = encode_integer(out, 0, 7, length);
+    memcpy(out + written, data, length);
+    return written + length;
+}
+
+void hpack_set_max_size(hpack_table *table, size_t size) {
+    if (size > HPACK_TABLE_SIZE) {
+        size = HPACK_TABLE_SIZE;
+    }
+    if (size != table->max_size) {
+        resize(table, size);
+        table->size_changed = 1;
+    }
+}
+
+size_t hpack_begin_block(hpack_table *table, unsigned char *out) {
+    if (!table->size_changed) {
+        return 0;
+    }
+    table->size_changed = 0;
+    return encode_integer(out, 0x20, 5, table->max_size);
+}
+
+size_t hpack_encode_status(hpack_table *table, unsigned char *out, int status) {
+    // Common codes are static entries 8 to 14
+    static const int static_codes[] = { 200, 204, 206, 304, 400, 404, 500 };
+    for (size_t i = 0; i < sizeof(static_codes) / sizeof(static_codes[0]); i++) {
+        if (static_codes[i] == status) {
+            return encode_integer(out, 0x80, 7, 8 + i);
+        }
+    }
+
+    char value[4] = {
+        (char)('0' + status / 100 % 10), (char)('0' + status / 10 % 10), (char)('0' + status % 10), '\0'
+    };
+    return hpack_encode(table, out, ":status", 7, value, 3);
+}
+
+// Static index of the first entry with this name, 0 when there is none
+static size_t static_name_index(const char *name, size_t name_length) {
+    for (size_t i = 0; i < STATIC_ENTRIES; i++) {
+        if (strlen(static_table[i].name) == name_length && memcmp(static_table[i].name, name, name_length) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static int indexed_name(const char *name, size_t name_length) {
+    for (size_t i = 0; i < sizeof(unindexed_fields) / sizeof(unindexed_fields[0]); i++) {
+        if (strlen(unindexed_fields[i]) == name_length && memcmp(unindexed_fields[i], name, name_length) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+size_t hpack_encode(hpack_table *table, unsigned char *out, const char *name, size_t name_length,
+                    const char *value, size_t value_length) {
+    // A field sent before is one index
+    for (size_t i = 1; i <= table->count; i++) {
+        const hpack_entry *entry = dynamic_entry(table, i);
+        if (entry->name_length == name_length && entry->value_length == value_length &&
+            memcmp(entry->data, name, name_length) == 0 &&
+            memcmp(entry->data + name_length, value, value_length) == 0) {
+            return encode_integer(out, 0x80, 7, STATIC_ENTRIES + i);
+        }
+    }
+
+    int indexing = indexed_name(name, name_length);
+    size_t name_index = static_name_index(name, name_length);
+    size_t written = indexing ? encode_integer(out, 0x40, 6, name_index) : encode_integer(out, 0, 4, name_index);
+    if (name_index == 0) {
+        written += encode_string(out + written, name, name_length);
+    }
+    written += encode_string(out + written, value, value_length);
+
+    // Out of memory only means the field isn't remembered, the peer's table gets it regardless,
+    // so the encoder's copy has to be emptied to stay in step
+    if (indexing && insert(table, name, name_length, value, value_length) != 0) {
+        hpack_table_cleanup(table);
+    }
+    return written;
+}
\ No newline at end of file
@@ -0,0 +1,678 @@
+#define _GNU_SOURCE
+#include "http_parser.h"
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+    PARSE_REQUEST_LINE,
+    PARSE_HEADERS,
+    PARSE_COMPLETE
+};
+
+enum {
+    BODY_LENGTH,        // Content-Length bytes
+    BODY_CHUNK_SIZE,    // Chunk size line, with any extensions
+    BODY_CHUNK_DATA,
+    BODY_CHUNK_END,     // CRLF closing the chunk data
+    BODY_TRAILER,       // Trailer fields up to the blank line
+    BODY_COMPLETE
+};
+
+void http_parser_init(http_request_t *req) {
+    // The header array is only read up to header_count, so it is left as is
+    req->method.length = 0;
+    req->path.length = 0;
+    req->query.length = 0;
+    req->version.length = 0;
+    req->header_count = 0;
+    req->version_major = 1;
+    req->version_minor = 0;
+    req->content_length = -1;
+    req->chunked = 0;
+    req->keep_alive = 0;
+    req->header_length = 0;
+    req->state = PARSE_REQUEST_LINE;
+    req->connection_close = 0;
+    req->connection_keep_alive = 0;
+    req->line_start = 0;
+}
+
+// Find the next LF, 16 bytes at a time with SSE2 or 8 at a time otherwise
+static const char *find_lf(const char *p, const char *end) {
+#if defined(__SSE2__)
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // A zero byte in word ^ 0x0a.. marks a LF, the lowest flagged byte is always exact
+    while (end - p >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        uint64_t x = word ^ 0x0a0a0a0a0a0a0a0aULL;
+        uint64_t found = (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+        if (found) {
+            return p + (__builtin_ctzll(found) >> 3);
+        }
+        p += 8;
+    }
+#endif
+    while (p < end) {
+        if (*p == '\n') {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// RFC 9110 character classes, looked up once per byte of methods, field names and field values
+#define CHAR_TOKEN 0x1              // tchar
+#define CHAR_FIELD 0x2              // Allowed in a field value: visible, SP, HTAB and obs-text
+#define CHAR_BOTH (CHAR_TOKEN | CHAR_FIELD)
+
+static const unsigned char char_class[256] = {
+    ['0' ... '9'] = CHAR_BOTH, ['A' ... 'Z'] = CHAR_BOTH, ['a' ... 'z'] = CHAR_BOTH,
+    ['!'] = CHAR_BOTH, ['#'] = CHAR_BOTH, ['$'] = CHAR_BOTH, ['%'] = CHAR_BOTH, ['&'] = CHAR_BOTH,
+    ['\''] = CHAR_BOTH, ['*'] = CHAR_BOTH, ['+'] = CHAR_BOTH, ['-'] = CHAR_BOTH, ['.'] = CHAR_BOTH,
+    ['^'] = CHAR_BOTH, ['_'] = CHAR_BOTH, ['`'] = CHAR_BOTH, ['|'] = CHAR_BOTH, ['~'] = CHAR_BOTH,
+    ['"'] = CHAR_FIELD, ['('] = CHAR_FIELD, [')'] = CHAR_FIELD, [','] = CHAR_FIELD, ['/'] = CHAR_FIELD,
+    [':'] = CHAR_FIELD, [';'] = CHAR_FIELD, ['<'] = CHAR_FIELD, ['='] = CHAR_FIELD, ['>'] = CHAR_FIELD,
+    ['?'] = CHAR_FIELD, ['@'] = CHAR_FIELD, ['['] = CHAR_FIELD, ['\\'] = CHAR_FIELD, [']'] = CHAR_FIELD,
+    ['{'] = CHAR_FIELD, ['}'] = CHAR_FIELD, [' '] = CHAR_FIELD, ['\t'] = CHAR_FIELD,
+    [0x80 ... 0xff] = CHAR_FIELD
+};
+
+// Skip characters of a class, returns the first byte outside it
+static const char *skip_class(const char *p, const char *end, unsigned char class) {
+    while (p < end && (char_class[(unsigned char)*p] & class)) {
+        p++;
+    }
+    return p;
+}
+
+static int parse_request_line(http_request_t *req, const char *line, const char *end) {
+    // The method is validated in the same pass that finds the space after it
+    const char *sp = skip_class(line, end, CHAR_TOKEN);
+    if (sp == line || sp == end || *sp != ' ') {
+        return -1;
+    }
+    req->method.data = line;
+    req->method.length = sp - line;
+
+    const char *target = sp + 1;
+    sp = memchr(target, ' ', end - target);
+    if (!sp || sp == target) {
+        return -1;
+    }
+    for (const char *p = target; p < sp; p++) {
+        if ((unsigned char)*p <= ' ' || *p == 0x7f) {
+            return -1;
+        }
+    }
+
+    // Absolute-form targets are reduced to their path
+    if (sp - target > 7 && strncasecmp(target, "http://", 7) == 0) {
+        const char *slash = memchr(target + 7, '/', sp - target - 7);
+        target = slash ? slash : sp;
+    }
+    if (target == sp) {
+        req->path.data = "/";
+        req->path.length = 1;
+        req->query.length = 0;
+    } else {
+        if (*target != '/' && !(sp - target == 1 && *target == '*')) {
+            return -1;
+        }
+        const char *question = memchr(target, '?', sp - target);
+        const char *path_end = question ? question : sp;
+        req->path.data = target;
+        req->path.length = path_end - target;
+        req->query.data = question ? question + 1 : sp;
+        req->query.length = question ? sp - question - 1 : 0;
+    }
+
+    const char *version = sp + 1;
+    if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+        (version[7] != '0' && version[7] != '1')) {
+        return -1;
+    }
+    req->version.data = version;
+    req->version.length = 8;
+    req->version_minor = version[7] - '0';
+    return 0;
+}
+
+static int parse_content_length(http_request_t *req, http_slice value) {
+    if (value.length == 0) {
+        return -1;
+    }
+
+    long long length = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        char c = value.data[i];
+        if (c < '0' || c > '9' || length > (INT64_MAX - 9) / 10) {
+            return -1;
+        }
+        length = length * 10 + (c - '0');
+    }
+
+    // Repeated headers must agree, and framing by both length and chunked coding is ambiguous
+    if ((req->content_length >= 0 && req->content_length != length) || req->chunked) {
+        return -1;
+    }
+    req->content_length = length;
+    return 0;
+}
+
+// Only chunked is supported, so it has to be the one and final coding. Anything else, a repeat
+// included, would leave the body framed differently by whoever reads it next
+static int parse_transfer_encoding(http_request_t *req, http_slice value) {
+    if (req->chunked || req->content_length >= 0) {
+        return -1;
+    }
+
+    int codings = 0;
+    const char *p = value.data;
+    const char *end = value.data + value.length;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *item = p;
+        while (p < end && *p != ',') p++;
+        const char *item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) item_end--;
+
+        if (item_end > item) {
+            http_slice coding = { item, item_end - item };
+            if (!http_slice_equals_nocase(coding, "chunked")) {
+                return -1;
+            }
+            codings++;
+        }
+    }
+    if (codings != 1) {
+        return -1;
+    }
+    req->chunked = 1;
+    return 0;
+}
+
+http_parse_result http_add_header(http_request_t *req, http_slice name, http_slice value) {
+    if (req->header_count == MAX_HEADERS) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+    http_header *header = &req->headers[req->header_count++];
+    header->name = name;
+    header->value = value;
+
+    // Framing and persistence headers are interpreted once, here
+    if (http_slice_equals_nocase(name, "Content-Length")) {
+        return parse_content_length(req, value) == 0 ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+    }
+    if (http_slice_equals_nocase(name, "Transfer-Encoding")) {
+        return parse_transfer_encoding(req, value) == 0 ? HTTP_PARSE_DONE : HTTP_PARSE_ERROR;
+    }
+    if (http_slice_equals_nocase(name, "Connection")) {
+        req->connection_close |= http_has_token(value, "close");
+        req->connection_keep_alive |= http_has_token(value, "keep-alive");
+    }
+    return HTTP_PARSE_DONE;
+}
+
+static http_parse_result parse_header_line(http_request_t *req, const char *line, const char *end) {
+    // Obsolete line folding is rejected outright
+    if (*line == ' ' || *line == '\t') {
+        return HTTP_PARSE_ERROR;
+    }
+
+    const char *colon = skip_class(line, end, CHAR_TOKEN);
+    if (colon == line || colon == end || *colon != ':') {
+        return HTTP_PARSE_ERROR;
+    }
+
+    // NUL, a bare CR and other control bytes could end the value early for whoever reads it next
+    if (skip_class(colon + 1, end, CHAR_FIELD) != end) {
+        return HTTP_PARSE_ERROR;
+    }
+
+    const char *value = colon + 1;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    const char *value_end = end;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+
+    http_slice name_slice = { line, colon - line };
+    http_slice value_slice = { value, value_end - value };
+    return http_add_header(req, name_slice, value_slice);
+}
+
+http_parse_result http_parse_request(http_request_t *req, const char *buf, size_t length) {
+    const char *end = buf + length;
+
+    while (req->state != PARSE_COMPLETE) {
+        const char *line = buf + req->line_start;
+        const char *lf = find_lf(line, end);
+        if (!lf) {
+            return length > MAX_HEADER_SIZE ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_INCOMPLETE;
+        }
+
+        req->line_start = lf + 1 - buf;
+        if (req->line_start > MAX_HEADER_SIZE) {
+            return HTTP_PARSE_TOO_LARGE;
+        }
+
+        const char *line_end = lf;
+        if (line_end > line && line_end[-1] == '\r') {
+            line_end--;
+        }
+
+        if (req->state == PARSE_REQUEST_LINE) {
+            // Empty lines ahead of a request are ignored
+            if (line_end == line) {
+                continue;
+            }
+            if (parse_request_line(req, line, line_end) != 0) {
+                return HTTP_PARSE_ERROR;
+            }
+            req->state = PARSE_HEADERS;
+        } else if (line_end == line) {
+            req->header_length = req->line_start;
+            req->state = PARSE_COMPLETE;
+        } else {
+            http_parse_result result = parse_header_line(req, line, line_end);
+            if (result != HTTP_PARSE_DONE) {
+                return result;
+            }
+        }
+    }
+
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for them
+    if (req->version_minor == 1) {
+        req->keep_alive = !req->connection_close;
+    } else {
+        req->keep_alive = req->connection_keep_alive && !req->connection_close;
+    }
+
+    return HTTP_PARSE_DONE;
+}
+
+const http_slice *http_get_header(const http_request_t *req, const char *name) {
+    for (int i = 0; i < req->header_count; i++) {
+        if (http_slice_equals_nocase(req->headers[i].name, name)) {
+            return &req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+int http_has_token(http_slice value, const char *token) {
+    size_t token_length = strlen(token);
+    const char *p = value.data;
+    const char *end = value.data + value.length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *item = p;
+        while (p < end && *p != ',') p++;
+        const char *item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) item_end--;
+
+        if ((size_t)(item_end - item) == token_length && strncasecmp(item, token, token_length) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Parse the q parameter of a list item, defaults to 1
+static double item_quality(const char *params, const char *end) {
+    while (params < end) {
+        while (params < end && (*params == ';' || *params == ' ' || *params == '\t')) params++;
+        if (end - params > 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+            double q = 0;
+            double scale = 1;
+            int fraction = 0;
+            for (params += 2; params < end && *params != ';'; params++) {
+                if (*params == '.') {
+                    fraction = 1;
+                } else if (*params >= '0' && *params <= '9') {
+                    if (fraction) {
+                        scale /= 10;
+                        q += (*params - '0') * scale;
+                    } else {
+                        q = q * 10 + (*params - '0');
+                    }
+                }
+            }
+            return q;
+        }
+        while (params < end && *params != ';') params++;
+    }
+    return 1;
+}
+
+int http_accepts_coding(const http_slice *accept, const char *coding) {
+    if (!accept) {
+        return 0;
+    }
+
+    size_t coding_length = strlen(coding);
+    const char *p = accept->data;
+    const char *end = accept->data + accept->length;
+    double wildcard = -1;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *item = p;
+        while (p < end && *p != ',') p++;
+
+        const char *name_end = item;
+        while (name_end < p && *name_end != ';' && *name_end != ' ' && *name_end != '\t') name_end++;
+
+        if ((size_t)(name_end - item) == coding_length && strncasecmp(item, coding, coding_length) == 0) {
+            return item_quality(name_end, p) > 0;
+        }
+        if (name_end - item == 1 && *item == '*') {
+            wildcard = item_quality(name_end, p);
+        }
+    }
+
+    return wildcard > 0;
+}
+
+int http_etag_matches(const http_slice *list, const char *etag) {
+    if (!list) {
+        return 0;
+    }
+
+    // Weak comparison, a W/ prefix on either side is ignored
+    if (etag[0] == 'W' && etag[1] == '/') {
+        etag += 2;
+    }
+    size_t etag_length = strlen(etag);
+    const char *p = list->data;
+    const char *end = list->data + list->length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        const char *item = p;
+        while (p < end && *p != ',') p++;
+        const char *item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) item_end--;
+
+        if (item_end - item == 1 && *item == '*') {
+            return 1;
+        }
+        if (item_end - item > 2 && item[0] == 'W' && item[1] == '/') {
+            item += 2;
+        }
+        if ((size_t)(item_end - item) == etag_length && memcmp(item, etag, etag_length) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+time_t http_parse_date(const http_slice *value) {
+    char date[64];
+    if (!value || value->length >= sizeof(date)) {
+        return -1;
+    }
+    memcpy(date, value->data, value->length);
+    date[value->length] = '\0';
+
+    // Only the IMF-fixdate form, the obsolete ones are treated as absent
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *rest = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!rest || *rest != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// Parse a run of digits, returns the position after it or NULL when there is none
+static const char *parse_position(const char *p, const char *end, long long *value) {
+    const char *start = p;
+    long long result = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (result > (LLONG_MAX - 9) / 10) {
+            return NULL;
+        }
+        result = result * 10 + (*p++ - '0');
+    }
+    *value = result;
+    return p > start ? p : NULL;
+}
+
+int http_parse_ranges(const http_slice *value, long long size, http_range *ranges, int max) {
+    if (!value || value->length < 6 || strncasecmp(value->data, "bytes=", 6) != 0) {
+        return -1;
+    }
+
+    const char *p = value->data + 6;
+    const char *end = value->data + value->length;
+    int count = 0;
+    int items = 0;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if (p == end) {
+            break;
+        }
+
+        long long first = -1;
+        long long last = -1;
+        if (*p != '-' && !(p = parse_position(p, end, &first))) {
+            return -1;
+        }
+        if (p == end || *p++ != '-') {
+            return -1;
+        }
+        if (p < end && *p >= '0' && *p <= '9' && !(p = parse_position(p, end, &last))) {
+            return -1;
+        }
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p < end && *p != ',') {
+            return -1;
+        }
+        items++;
+
+        if (first == -1) {
+            // Suffix range, the final last bytes
+            if (last == -1) {
+                return -1;
+            }
+            if (last == 0 || size == 0) {
+                continue;
+            }
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        } else {
+            if (last != -1 && last < first) {
+                return -1;
+            }
+            if (first >= size) {
+                continue;
+            }
+            if (last == -1 || last >= size) {
+                last = size - 1;
+            }
+        }
+
+        if (count == max) {
+            return -1;
+        }
+        ranges[count].first = first;
+        ranges[count].last = last;
+        count++;
+    }
+
+    return items > 0 ? count : -1;
+}
+
+int http_slice_equals(http_slice slice, const char *str) {
+    size_t length = strlen(str);
+    return slice.length == length && memcmp(slice.data, str, length) == 0;
+}
+
+int http_slice_equals_nocase(http_slice slice, const char *str) {
+    size_t length = strlen(str);
+    return slice.length == length && strncasecmp(slice.data, str, length) == 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int http_decode_path(http_slice path, char *out, size_t out_size) {
+    size_t written = 0;
+
+    for (size_t i = 0; i < path.length; i++) {
+        char c = path.data[i];
+        if (c == '%') {
+            if (i + 2 >= path.length) {
+                return -1;
+            }
+            int high = hex_value(path.data[i + 1]);
+            int low = hex_value(path.data[i + 2]);
+            if (high < 0 || low < 0) {
+                return -1;
+            }
+            c = (char)(high * 16 + low);
+            if (c == '\0') {
+                return -1;
+            }
+            i += 2;
+        }
+
+        if (written + 1 >= out_size) {
+            return -1;
+        }
+        out[written++] = c;
+    }
+
+    out[written] = '\0';
+    return (int)written;
+}
+
+void http_body_init(http_body_t *body, const http_request_t *req) {
+    body->remaining = 0;
+    body->received = 0;
+    body->trailer_length = 0;
+    if (req->chunked) {
+        body->state = BODY_CHUNK_SIZE;
+    } else if (req->content_length > 0) {
+        body->state = BODY_LENGTH;
+        body->remaining = req->content_length;
+    } else {
+        body->state = BODY_COMPLETE;
+    }
+}
+
+// Chunk size in hex, optionally followed by extensions that are ignored
+static int parse_chunk_size(const char *line, const char *end, long long *size) {
+    const char *p = line;
+    long long value = 0;
+    int digit;
+    while (p < end && (digit = hex_value(*p)) >= 0) {
+        if (value > (INT64_MAX >> 4)) {
+            return -1;
+        }
+        value = (value << 4) | digit;
+        p++;
+    }
+    if (p == line) {
+        return -1;
+    }
+
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p < end && *p != ';') {
+        return -1;
+    }
+
+    *size = value;
+    return 0;
+}
+
+http_body_result http_body_decode(http_body_t *body, const char *buf, size_t length, size_t *consumed,
+                                  http_slice *data) {
+    const char *p = buf;
+    const char *end = buf + length;
+    data->data = buf;
+    data->length = 0;
+
+    while (body->state != BODY_COMPLETE) {
+        if (body->state == BODY_LENGTH || body->state == BODY_CHUNK_DATA) {
+            if (p == end) {
+                break;
+            }
+            size_t available = end - p;
+            size_t take = (long long)available < body->remaining ? available : (size_t)body->remaining;
+            data->data = p;
+            data->length = take;
+            p += take;
+            body->remaining -= take;
+            body->received += take;
+            if (body->remaining == 0) {
+                body->state = body->state == BODY_LENGTH ? BODY_COMPLETE : BODY_CHUNK_END;
+            }
+            break;
+        }
+
+        // Framing lines are handled whole
+        const char *lf = find_lf(p, end);
+        if (!lf) {
+            if (end - p > MAX_CHUNK_LINE) {
+                return HTTP_BODY_ERROR;
+            }
+            break;
+        }
+        if (lf - p > MAX_CHUNK_LINE) {
+            return HTTP_BODY_ERROR;
+        }
+        const char *line_end = lf;
+        if (line_end > p && line_end[-1] == '\r') {
+            line_end--;
+        }
+
+        if (body->state == BODY_CHUNK_SIZE) {
+            if (parse_chunk_size(p, line_end, &body->remaining) != 0) {
+                return HTTP_BODY_ERROR;
+            }
+            body->state = body->remaining > 0 ? BODY_CHUNK_DATA : BODY_TRAILER;
+        } else if (body->state == BODY_CHUNK_END) {
+            if (line_end != p) {
+                return HTTP_BODY_ERROR;
+            }
+            body->state = BODY_CHUNK_SIZE;
+        } else if (line_end == p) {
+            body->state = BODY_COMPLETE;
+        } else {
+            // Trailer fields are skipped, within the same budget as the head
+            body->trailer_length += lf + 1 - p;
+            if (body->trailer_length > MAX_HEADER_SIZE) {
+                return HTTP_BODY_ERROR;
+            }
+        }
+        p = lf + 1;
+    }
+
+    *consumed = p - buf;
+    return body->state == BODY_COMPLETE ? HTTP_BODY_DONE : HTTP_BODY_INCOMPLETE;
+}
\ No newline at end of file
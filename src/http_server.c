@@ -1,81 +1,190 @@
+#define _GNU_SOURCE
 #include "http_server.h"
 #include "config.h"
-#include "request_handler.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "thread_pool.h"
+#include "metrics.h"
 #include "logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
 
-void *handle_client(void *arg) {
-    client_info *cinfo = (client_info *)arg;
-    int client_socket = cinfo->client_socket;
-    char buffer[BUFFER_SIZE];
-    ssize_t received;
-
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(cinfo->client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-    
-    DEBUG("New connection from %s", client_ip);
-
-    received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-    if (received < 0) {
-        ERROR("Failed to receive data from client %s", client_ip);
-        close(client_socket);
-        free(cinfo);
-        pthread_exit(NULL);
-    }
-    buffer[received] = '\0';
-
-    char method[SMALL_BUFFER];
-    char path[SMALL_BUFFER];
-    char protocol[SMALL_BUFFER];
-    sscanf(buffer, "%s %s %s", method, path, protocol);
-
-    INFO("Request from %s: %s %s %s", client_ip, method, path, protocol);
-    TRACE("Full request:\n%s", buffer);
-    
-    if (strcasecmp(method, "GET") == 0) {
-        serve_static_file(client_socket, path);
-    }
-    else if (strcasecmp(method, "POST") == 0 && strcmp(path, "/ping") == 0) {
-        char *body = strstr(buffer, "\r\n\r\n");
-        if (body) {
-            body += 4;
-            handle_post_ping(client_socket, body);
+// Threaded mode keeps the deadlines of the connections pool threads serve on one wheel. A reaper
+// thread advances it and shuts down the sockets that miss theirs, which wakes the thread blocked on it
+static struct {
+    pthread_mutex_t mutex;
+    timer_wheel_t wheel;
+} deadlines = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+static void watch_client(connection_t *conn) {
+    pthread_mutex_lock(&deadlines.mutex);
+    connection_watch(conn, &deadlines.wheel);
+    pthread_mutex_unlock(&deadlines.mutex);
+}
+
+static void shut_down_expired(void *data, void *arg) {
+    (void)arg;
+    connection_t *conn = data;
+    connection_expired(conn);
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+static void *reaper_main(void *arg) {
+    (void)arg;
+    pthread_setname_np(pthread_self(), "web-reaper");
+
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = TIMER_TICK_MS * 1000000L };
+    while (1) {
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&deadlines.mutex);
+        timer_wheel_advance(&deadlines.wheel, connection_clock(), shut_down_expired, NULL);
+        pthread_mutex_unlock(&deadlines.mutex);
+    }
+    return NULL;
+}
+
+// One blocking receive, so the deadline is brought up to date as the request arrives
+static conn_io_t receive_request(connection_t *conn) {
+    size_t space = connection_prepare_read(conn);
+    if (space == 0) {
+        return CONN_IO_DONE;
+    }
+
+    char *input = connection_input(conn);
+    if (!input) {
+        ERROR("Failed to allocate an input buffer for %s", conn->client_ip);
+        return CONN_IO_ERROR;
+    }
+
+    ssize_t received = recv(conn->fd, input, space, 0);
+    if (received > 0) {
+        connection_received(conn, received);
+        return CONN_IO_DONE;
+    }
+    if (received == 0) {
+        return CONN_IO_CLOSED;
+    }
+    if (errno == EINTR) {
+        return CONN_IO_DONE;
+    }
+
+    ERROR("Failed to receive data from client %s", conn->client_ip);
+    return CONN_IO_ERROR;
+}
+
+void handle_client(int client_fd, const struct sockaddr_in *client_addr) {
+    connection_t *conn = connection_create(client_fd, client_addr);
+    if (!conn) {
+        ERROR("Failed to allocate connection");
+        close(client_fd);
+        return;
+    }
+
+    DEBUG("New connection from %s", conn->client_ip);
+
+    // Blocking socket: each step runs to completion or until the reaper shuts the socket down
+    watch_client(conn);
+    while (conn->state != CONN_DONE) {
+        conn_io_t io;
+        if (conn->state == CONN_READING) {
+            io = receive_request(conn);
+        } else {
+            io = connection_flush(conn);
         }
-        else {
-            send_simple_response(client_socket, "400 Bad Request", "text/plain");
+
+        if (io != CONN_IO_DONE) {
+            break;
         }
+        watch_client(conn);
     }
-    else {
-        send_simple_response(client_socket, "501 Not Implemented", "text/plain");
+
+    // Off the wheel before the descriptor can be reused
+    pthread_mutex_lock(&deadlines.mutex);
+    timer_cancel(&deadlines.wheel, &conn->timer);
+    pthread_mutex_unlock(&deadlines.mutex);
+    connection_destroy(conn);
+}
+
+// Turn a connection away without reading its request. The response fits in the
+// socket buffer of a fresh connection, so a non-blocking send never stalls accepting
+static void reject_overloaded(int client_fd, const char *response, size_t length) {
+    metrics_count(METRIC_CONNECTIONS_REJECTED);
+    if (send(client_fd, response, length, MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+        DEBUG("Failed to send 503 to an overflowing connection");
     }
+    shutdown(client_fd, SHUT_WR);
+    close(client_fd);
+}
 
-    close(client_socket);
-    free(cinfo);
-    pthread_exit(NULL);
+static int run_threaded(int server_fd) {
+    timer_wheel_init(&deadlines.wheel, connection_clock());
+    pthread_t reaper;
+    if (pthread_create(&reaper, NULL, reaper_main, NULL) != 0) {
+        perror("pthread_create failed");
+        return EXIT_FAILURE;
+    }
+    pthread_detach(reaper);
+
+    if (thread_pool_init(server_config.threads, server_config.thread_queue, handle_client) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    char overload[SMALL_BUFFER];
+    int overload_length = snprintf(overload, sizeof(overload),
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Retry-After: %d\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n",
+        THREAD_RETRY_AFTER);
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int client_fd = accept4(server_fd, (struct sockaddr *)&client_addr, &addr_len, SOCK_CLOEXEC);
+
+        if (client_fd < 0) {
+            perror("accept failed");
+            continue;
+        }
+
+        if (thread_pool_submit(client_fd, &client_addr) == -1) {
+            WARN("Thread pool queue is full, rejecting connection");
+            reject_overloaded(client_fd, overload, overload_length);
+        }
+    }
+
+    return EXIT_SUCCESS;
 }
 
-int initialize_server(void) {
+// Create a socket listening on PORT, returns -1 on failure
+static int create_listen_socket(void) {
     int server_fd;
     struct sockaddr_in address;
     int opt = 1;
 
     if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         perror("socket failed");
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT,
-                   &opt, sizeof(opt)) == -1) {
+    // Each option needs its own call, or-ing the names together sets neither reliably
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
         perror("setsockopt failed");
         close(server_fd);
-        return EXIT_FAILURE;
+        return -1;
     }
 
     address.sin_family = AF_INET;
@@ -85,44 +194,129 @@ int initialize_server(void) {
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
         close(server_fd);
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    if (listen(server_fd, 16) < 0) {
+    if (listen(server_fd, server_config.listen_backlog) < 0) {
         perror("listen failed");
         close(server_fd);
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    INFO("Server is running on port %d\n", PORT);
+    return server_fd;
+}
 
-    while (1) {
-        client_info *cinfo = malloc(sizeof(client_info));
-        if (!cinfo) {
-            perror("malloc failed");
-            continue;
+typedef struct {
+    int id;
+    int listen_fd;
+    int started;
+    pthread_t thread;
+} worker_info;
+
+static void *worker_main(void *arg) {
+    worker_info *worker = (worker_info *)arg;
+
+    char name[16];
+    snprintf(name, sizeof(name), "web-worker-%d", worker->id);
+    pthread_setname_np(pthread_self(), name);
+
+    if (server_config.pin_cpus) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->id % (cpus > 0 ? cpus : 1), &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            WARN("Failed to pin worker %d to a CPU", worker->id);
         }
-        
-        socklen_t addr_len = sizeof(cinfo->client_addr);
-        cinfo->client_socket = accept(server_fd, (struct sockaddr *)&cinfo->client_addr, &addr_len);
-        
-        if (cinfo->client_socket < 0) {
-            perror("accept failed");
-            free(cinfo);
-            continue;
+    }
+
+    DEBUG("Worker %d running on listen socket %d", worker->id, worker->listen_fd);
+    if (server_config.mode == SERVER_MODE_URING) {
+        uring_loop_run(worker->listen_fd);
+    } else {
+        event_loop_run(worker->listen_fd);
+    }
+    return NULL;
+}
+
+// One SO_REUSEPORT listener and event loop per worker, the kernel balances accepts
+static int run_workers(int first_fd) {
+    int count = server_config.workers;
+    worker_info *workers = calloc(count, sizeof(worker_info));
+    if (!workers) {
+        perror("calloc failed");
+        return EXIT_FAILURE;
+    }
+
+    // Bind every listener up front so a failure is reported before any worker starts
+    workers[0].listen_fd = first_fd;
+    for (int i = 1; i < count; i++) {
+        workers[i].listen_fd = create_listen_socket();
+        if (workers[i].listen_fd == -1) {
+            for (int j = 1; j < i; j++) {
+                close(workers[j].listen_fd);
+            }
+            free(workers);
+            return EXIT_FAILURE;
         }
+    }
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, handle_client, (void *)cinfo) != 0) {
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        workers[i].id = i;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
             perror("pthread_create failed");
-            close(cinfo->client_socket);
-            free(cinfo);
             continue;
         }
+        workers[i].started = 1;
+        started++;
+    }
+
+    INFO("Started %d event loop workers%s", started, server_config.pin_cpus ? " pinned to CPUs" : "");
 
-        pthread_detach(tid);
+    for (int i = 0; i < count; i++) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        // The first listener belongs to the caller
+        if (i > 0) {
+            close(workers[i].listen_fd);
+        }
+    }
+
+    free(workers);
+    return started > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int initialize_server(void) {
+    int server_fd = create_listen_socket();
+    if (server_fd == -1) {
+        return EXIT_FAILURE;
+    }
+
+    INFO("Server is running on port %d\n", PORT);
+
+    if (server_config.mode == SERVER_MODE_URING && !uring_loop_available()) {
+        WARN("io_uring is not available, falling back to epoll");
+        server_config.mode = SERVER_MODE_EPOLL;
+    }
+
+    int result;
+    if (server_config.mode == SERVER_MODE_THREADED) {
+        INFO("Using a pool of %d threads", server_config.threads);
+        result = run_threaded(server_fd);
+    } else if (server_config.workers > 1) {
+        INFO("Using %d %s event loops", server_config.workers,
+             server_config.mode == SERVER_MODE_URING ? "io_uring" : "epoll");
+        result = run_workers(server_fd);
+    } else if (server_config.mode == SERVER_MODE_URING) {
+        INFO("Using io_uring event loop");
+        result = uring_loop_run(server_fd);
+    } else {
+        INFO("Using epoll event loop");
+        result = event_loop_run(server_fd);
     }
 
     close(server_fd);
-    return EXIT_SUCCESS;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include "log_record.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *level_prefixes[] = {
+    COLOR_WHITE "TRACE" COLOR_RESET " ",
+    COLOR_CYAN "DEBUG" COLOR_RESET " ",
+    COLOR_GREEN "INFO " COLOR_RESET " ",
+    COLOR_YELLOW "WARN " COLOR_RESET " ",
+    COLOR_RED "ERROR" COLOR_RESET " ",
+    COLOR_MAGENTA "FATAL" COLOR_RESET " "
+};
+
+// Length modifiers, only used to pick the argument type
+enum {
+    LENGTH_NONE,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_J,
+    LENGTH_Z,
+    LENGTH_T,
+    LENGTH_LONG_DOUBLE
+};
+
+// One printf conversion, split into the parts needed to replay it
+typedef struct {
+    const char *flags;
+    size_t flags_length;
+    int width_star;
+    const char *width;
+    size_t width_length;
+    int has_precision;
+    int precision_star;
+    int precision;
+    int length;
+    char conversion;
+} conversion_spec;
+
+// Per-thread timestamp text, rebuilt once per second
+static __thread struct {
+    time_t seconds;
+    size_t length;
+    char text[32];
+} stamp = {
+    .seconds = -1
+};
+
+const char *log_level_prefix(int level) {
+    return level_prefixes[level];
+}
+
+size_t log_timestamp(char *out, time_t seconds, long milliseconds) {
+    if (seconds != stamp.seconds) {
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        stamp.length = strftime(stamp.text, sizeof(stamp.text), "[%Y-%m-%d %H:%M:%S.000] ", &tm);
+        stamp.seconds = seconds;
+    }
+
+    memcpy(out, stamp.text, stamp.length);
+    char *digits = out + stamp.length - 5;
+    digits[0] = '0' + milliseconds / 100;
+    digits[1] = '0' + milliseconds / 10 % 10;
+    digits[2] = '0' + milliseconds % 10;
+    return stamp.length;
+}
+
+// Parse the conversion starting at the '%' in p, returns the position after it
+static const char *parse_conversion(const char *p, conversion_spec *spec) {
+    memset(spec, 0, sizeof(*spec));
+    p++;
+
+    spec->flags = p;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    spec->flags_length = p - spec->flags;
+
+    if (*p == '*') {
+        spec->width_star = 1;
+        p++;
+    } else {
+        spec->width = p;
+        while (*p >= '0' && *p <= '9') p++;
+        spec->width_length = p - spec->width;
+    }
+
+    if (*p == '.') {
+        spec->has_precision = 1;
+        p++;
+        if (*p == '*') {
+            spec->precision_star = 1;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                spec->precision = spec->precision * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    switch (*p) {
+        case 'h': spec->length = p[1] == 'h' ? LENGTH_HH : LENGTH_H; p += p[1] == 'h' ? 2 : 1; break;
+        case 'l': spec->length = p[1] == 'l' ? LENGTH_LL : LENGTH_L; p += p[1] == 'l' ? 2 : 1; break;
+        case 'j': spec->length = LENGTH_J; p++; break;
+        case 'z': spec->length = LENGTH_Z; p++; break;
+        case 't': spec->length = LENGTH_T; p++; break;
+        case 'L': spec->length = LENGTH_LONG_DOUBLE; p++; break;
+    }
+
+    spec->conversion = *p;
+    return *p ? p + 1 : p;
+}
+
+// Bounded append to the payload of a record being encoded
+typedef struct {
+    char *out;
+    size_t size;
+    size_t length;
+    int overflow;
+} encoder;
+
+static void put(encoder *enc, const void *data, size_t length) {
+    if (enc->length + length > enc->size) {
+        enc->overflow = 1;
+        return;
+    }
+    memcpy(enc->out + enc->length, data, length);
+    enc->length += length;
+}
+
+static void put_signed(encoder *enc, int64_t value) {
+    put(enc, &value, sizeof(value));
+}
+
+static void put_unsigned(encoder *enc, uint64_t value) {
+    put(enc, &value, sizeof(value));
+}
+
+size_t log_record_encode(char *out, size_t size, int level, const char *file, int line,
+                         uint64_t timestamp, const char *fmt, va_list args) {
+    encoder enc = { out, size, sizeof(log_record), size < sizeof(log_record) };
+
+    for (const char *p = fmt; *p && !enc.overflow; ) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+
+        conversion_spec spec;
+        p = parse_conversion(p, &spec);
+        if (spec.width_star) {
+            put_signed(&enc, va_arg(args, int));
+        }
+        if (spec.precision_star) {
+            spec.precision = va_arg(args, int);
+            spec.has_precision = spec.precision >= 0;
+            put_signed(&enc, spec.precision);
+        }
+
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+                switch (spec.length) {
+                    case LENGTH_L: put_signed(&enc, va_arg(args, long)); break;
+                    case LENGTH_LL: put_signed(&enc, va_arg(args, long long)); break;
+                    case LENGTH_J: put_signed(&enc, va_arg(args, intmax_t)); break;
+                    case LENGTH_Z: put_signed(&enc, va_arg(args, ptrdiff_t)); break;
+                    case LENGTH_T: put_signed(&enc, va_arg(args, ptrdiff_t)); break;
+                    default: put_signed(&enc, va_arg(args, int)); break;
+                }
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                switch (spec.length) {
+                    case LENGTH_L: put_unsigned(&enc, va_arg(args, unsigned long)); break;
+                    case LENGTH_LL: put_unsigned(&enc, va_arg(args, unsigned long long)); break;
+                    case LENGTH_J: put_unsigned(&enc, va_arg(args, uintmax_t)); break;
+                    case LENGTH_Z: put_unsigned(&enc, va_arg(args, size_t)); break;
+                    case LENGTH_T: put_unsigned(&enc, va_arg(args, size_t)); break;
+                    default: put_unsigned(&enc, va_arg(args, unsigned int)); break;
+                }
+                break;
+            case 'c':
+                put_signed(&enc, va_arg(args, int));
+                break;
+            case 's': {
+                // Strings are copied, the caller's buffer is gone by the time the record is read
+                const char *str = va_arg(args, const char *);
+                if (!str) {
+                    str = "(null)";
+                }
+                uint32_t length = spec.has_precision ? strnlen(str, spec.precision) : strlen(str);
+                put(&enc, &length, sizeof(length));
+                put(&enc, str, length);
+                break;
+            }
+            case 'p':
+                put_unsigned(&enc, (uintptr_t)va_arg(args, void *));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value = spec.length == LENGTH_LONG_DOUBLE ? (double)va_arg(args, long double)
+                                                                 : va_arg(args, double);
+                put(&enc, &value, sizeof(value));
+                break;
+            }
+            case 'n':
+                (void)va_arg(args, void *);
+                break;
+            default:
+                // Unknown conversion, the rest of the format is rendered as literal text
+                p = "";
+                break;
+        }
+    }
+
+    if (enc.overflow) {
+        return 0;
+    }
+
+    log_record record = {
+        .length = enc.length,
+        .kind = LOG_RECORD_MESSAGE,
+        .level = level,
+        .line = line,
+        .reserved = 0,
+        .timestamp = timestamp,
+        .format = (uintptr_t)fmt,
+        .file = (uintptr_t)file
+    };
+    memcpy(out, &record, sizeof(record));
+    return enc.length;
+}
+
+// Sequential reader over the payload of a record
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t position;
+} decoder;
+
+static int take(decoder *dec, void *out, size_t length) {
+    if (dec->position + length > dec->length) {
+        return -1;
+    }
+    memcpy(out, dec->data + dec->position, length);
+    dec->position += length;
+    return 0;
+}
+
+// Append formatted text, the length is clamped so a full buffer just truncates
+#define APPEND(out, size, position, ...) do { \
+    int written_ = snprintf((out) + (position), (size) - (position), __VA_ARGS__); \
+    if (written_ > 0) (position) += (size_t)written_ < (size) - (position) ? (size_t)written_ : (size) - (position) - 1; \
+} while (0)
+
+size_t log_record_render(const log_record *record, const char *fmt, const char *file,
+                         char *out, size_t size) {
+    if (size < 64) {
+        return 0;
+    }
+    // One byte stays free for the newline
+    size--;
+
+    uint64_t timestamp = record->timestamp;
+    size_t position = log_timestamp(out, timestamp / 1000000000, timestamp % 1000000000 / 1000000);
+    APPEND(out, size, position, "%s(%s:%u) ", log_level_prefix(record->level), file, record->line);
+
+    decoder dec = { (const char *)(record + 1), record->length - sizeof(log_record), 0 };
+    const char *p = fmt;
+    while (*p && position + 1 < size) {
+        const char *literal = p;
+        while (*p && (*p != '%' || p[1] == '%')) {
+            p += *p == '%' ? 2 : 1;
+        }
+        for (const char *c = literal; c < p && position + 1 < size; c++) {
+            out[position++] = *c;
+            if (*c == '%') c++;
+        }
+        if (!*p) {
+            break;
+        }
+
+        const char *start = p;
+        conversion_spec spec;
+        p = parse_conversion(p, &spec);
+        if (spec.flags_length + spec.width_length > 16) {
+            spec.conversion = '\0';
+        }
+
+        // Rebuild the conversion with widths resolved and a length modifier matching the stored type
+        char format[48];
+        size_t format_length = 0;
+        format[format_length++] = '%';
+        memcpy(format + format_length, spec.flags, spec.flags_length);
+        format_length += spec.flags_length;
+
+        int64_t number;
+        if (spec.width_star) {
+            if (take(&dec, &number, sizeof(number)) == -1) break;
+            format_length += snprintf(format + format_length, sizeof(format) - format_length, "%d", (int)number);
+        } else {
+            memcpy(format + format_length, spec.width, spec.width_length);
+            format_length += spec.width_length;
+        }
+        if (spec.precision_star) {
+            if (take(&dec, &number, sizeof(number)) == -1) break;
+            spec.precision = (int)number;
+            spec.has_precision = spec.precision >= 0;
+        }
+        if (spec.has_precision && spec.conversion != 's') {
+            format_length += snprintf(format + format_length, sizeof(format) - format_length, ".%d", spec.precision);
+        }
+
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+            case 'c': {
+                int64_t value;
+                if (take(&dec, &value, sizeof(value)) == -1) break;
+                if (spec.conversion == 'c') {
+                    snprintf(format + format_length, sizeof(format) - format_length, "c");
+                    APPEND(out, size, position, format, (int)value);
+                } else {
+                    snprintf(format + format_length, sizeof(format) - format_length, "ll%c", spec.conversion);
+                    APPEND(out, size, position, format, (long long)value);
+                }
+                break;
+            }
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                uint64_t value;
+                if (take(&dec, &value, sizeof(value)) == -1) break;
+                snprintf(format + format_length, sizeof(format) - format_length, "ll%c", spec.conversion);
+                APPEND(out, size, position, format, (unsigned long long)value);
+                break;
+            }
+            case 's': {
+                uint32_t length;
+                if (take(&dec, &length, sizeof(length)) == -1 || dec.position + length > dec.length) break;
+                snprintf(format + format_length, sizeof(format) - format_length, ".*s");
+                APPEND(out, size, position, format, (int)length, dec.data + dec.position);
+                dec.position += length;
+                break;
+            }
+            case 'p': {
+                uint64_t value;
+                if (take(&dec, &value, sizeof(value)) == -1) break;
+                snprintf(format + format_length, sizeof(format) - format_length, "p");
+                APPEND(out, size, position, format, (void *)(uintptr_t)value);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value;
+                if (take(&dec, &value, sizeof(value)) == -1) break;
+                snprintf(format + format_length, sizeof(format) - format_length, "%c", spec.conversion);
+                APPEND(out, size, position, format, value);
+                break;
+            }
+            case 'n':
+                break;
+            default:
+                // Mirrors the encoder, which stopped walking here
+                for (const char *c = start; *c && position + 1 < size; c++) {
+                    out[position++] = *c;
+                }
+                p = "";
+                break;
+        }
+    }
+
+    if (position == 0 || out[position - 1] != '\n') {
+        out[position++] = '\n';
+    }
+    return position;
+}
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "log_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLUSH_MAX_IOV 64
+
+// Runs at thread exit, the writer frees the ring once it is drained
+static void close_ring(void *arg) {
+    __atomic_store_n(&((log_ring *)arg)->closed, 1, __ATOMIC_RELEASE);
+}
+
+// Free the rings of exited threads once everything they enqueued is drained
+static void reap_rings(log_ring_set *set) {
+    log_ring **link = &set->rings;
+    while (*link) {
+        log_ring *ring = *link;
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+}
+
+static void *writer_thread(void *arg) {
+    log_ring_set *set = arg;
+
+    pthread_mutex_lock(&set->mutex);
+    for (;;) {
+        int running = set->running;
+        if (running && set->waiters == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += (long)(set->flush_interval_ms % 1000) * 1000000;
+            deadline.tv_sec += set->flush_interval_ms / 1000 + deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&set->wake, &set->mutex, &deadline);
+            running = set->running;
+        }
+
+        // New rings are pushed at the front, so the list from here on is stable without the lock
+        log_ring *rings = set->rings;
+        pthread_mutex_unlock(&set->mutex);
+
+        set->drain(rings);
+
+        pthread_mutex_lock(&set->mutex);
+        reap_rings(set);
+        if (set->waiters > 0) {
+            pthread_cond_broadcast(&set->drained);
+        }
+        if (!running) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&set->mutex);
+
+    return NULL;
+}
+
+int log_ring_start(log_ring_set *set) {
+    // Timed waits use the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&set->mutex, NULL);
+    pthread_cond_init(&set->wake, &attr);
+    pthread_cond_init(&set->drained, NULL);
+    pthread_condattr_destroy(&attr);
+    pthread_key_create(&set->ring_key, close_ring);
+
+    set->rings = NULL;
+    set->waiters = 0;
+    set->dropped = 0;
+    set->running = 1;
+
+    if (pthread_create(&set->writer_thread, NULL, writer_thread, set) != 0) {
+        set->running = 0;
+        pthread_key_delete(set->ring_key);
+        pthread_mutex_destroy(&set->mutex);
+        pthread_cond_destroy(&set->wake);
+        pthread_cond_destroy(&set->drained);
+        return -1;
+    }
+    return 0;
+}
+
+void log_ring_stop(log_ring_set *set) {
+    pthread_mutex_lock(&set->mutex);
+    set->running = 0;
+    pthread_cond_signal(&set->wake);
+    pthread_cond_broadcast(&set->drained);
+    pthread_mutex_unlock(&set->mutex);
+    pthread_join(set->writer_thread, NULL);
+
+    // Threads still alive drop their lines from here on, running is checked first
+    pthread_key_delete(set->ring_key);
+    while (set->rings) {
+        log_ring *ring = set->rings;
+        set->rings = ring->next;
+        free(ring);
+    }
+
+    pthread_mutex_destroy(&set->mutex);
+    pthread_cond_destroy(&set->wake);
+    pthread_cond_destroy(&set->drained);
+}
+
+// The calling thread's ring, created and registered on first use
+static log_ring *current_ring(log_ring_set *set) {
+    log_ring *ring = pthread_getspecific(set->ring_key);
+    if (ring) {
+        return ring;
+    }
+
+    ring = aligned_alloc(_Alignof(log_ring), sizeof(log_ring) + set->ring_size);
+    if (!ring) {
+        return NULL;
+    }
+    ring->closed = 0;
+    ring->head = 0;
+    ring->tail = 0;
+
+    pthread_mutex_lock(&set->mutex);
+    ring->next = set->rings;
+    set->rings = ring;
+    pthread_mutex_unlock(&set->mutex);
+
+    pthread_setspecific(set->ring_key, ring);
+    return ring;
+}
+
+static void wake_writer(log_ring_set *set) {
+    pthread_mutex_lock(&set->mutex);
+    pthread_cond_signal(&set->wake);
+    pthread_mutex_unlock(&set->mutex);
+}
+
+void log_ring_enqueue(log_ring_set *set, const void *data, size_t length, int urgent) {
+    if (!set->running) {
+        return;
+    }
+
+    log_ring *ring = length <= set->ring_size ? current_ring(set) : NULL;
+    if (!ring) {
+        log_ring_drop(set);
+        return;
+    }
+
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (set->ring_size - (head - tail) < length) {
+        if (!set->block) {
+            log_ring_drop(set);
+            return;
+        }
+
+        pthread_mutex_lock(&set->mutex);
+        if (!set->running) {
+            pthread_mutex_unlock(&set->mutex);
+            return;
+        }
+        set->waiters++;
+        pthread_cond_signal(&set->wake);
+        pthread_cond_wait(&set->drained, &set->mutex);
+        set->waiters--;
+        pthread_mutex_unlock(&set->mutex);
+
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    // Copy in up to two pieces when the line wraps around the end of the ring
+    size_t offset = head & (set->ring_size - 1);
+    size_t first = set->ring_size - offset < length ? set->ring_size - offset : length;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char *)data + first, length - first);
+    __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+
+    // Only the write that crosses the threshold wakes the writer early
+    size_t pending = head + length - tail;
+    if (urgent || (pending >= set->flush_bytes && pending - length < set->flush_bytes)) {
+        wake_writer(set);
+    }
+}
+
+void log_ring_drop(log_ring_set *set) {
+    __atomic_add_fetch(&set->dropped, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long log_ring_dropped(log_ring_set *set) {
+    return __atomic_load_n(&set->dropped, __ATOMIC_RELAXED);
+}
+
+size_t log_ring_pending(log_ring_set *set) {
+    if (!set->running) {
+        return 0;
+    }
+
+    size_t pending = 0;
+    pthread_mutex_lock(&set->mutex);
+    for (log_ring *ring = set->rings; ring; ring = ring->next) {
+        pending += __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+    pthread_mutex_unlock(&set->mutex);
+    return pending;
+}
+
+void log_ring_copy(const log_ring_set *set, const log_ring *ring, size_t position, void *out, size_t length) {
+    size_t offset = position & (set->ring_size - 1);
+    size_t first = set->ring_size - offset < length ? set->ring_size - offset : length;
+    memcpy(out, ring->data + offset, first);
+    memcpy((char *)out + first, ring->data, length - first);
+}
+
+void log_ring_flush(const log_ring_set *set, log_ring *rings, void (*write_batch)(struct iovec *iov, int count)) {
+    struct iovec iov[FLUSH_MAX_IOV];
+    log_ring *owners[FLUSH_MAX_IOV / 2];
+    size_t heads[FLUSH_MAX_IOV / 2];
+    int iov_count = 0;
+    int owner_count = 0;
+
+    for (log_ring *ring = rings; ring; ring = ring->next) {
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            continue;
+        }
+
+        size_t offset = tail & (set->ring_size - 1);
+        size_t length = head - tail;
+        size_t first = set->ring_size - offset < length ? set->ring_size - offset : length;
+        iov[iov_count].iov_base = ring->data + offset;
+        iov[iov_count].iov_len = first;
+        iov_count++;
+        if (length > first) {
+            iov[iov_count].iov_base = ring->data;
+            iov[iov_count].iov_len = length - first;
+            iov_count++;
+        }
+        owners[owner_count] = ring;
+        heads[owner_count] = head;
+        owner_count++;
+
+        if (owner_count == FLUSH_MAX_IOV / 2) {
+            write_batch(iov, iov_count);
+            for (int i = 0; i < owner_count; i++) {
+                __atomic_store_n(&owners[i]->tail, heads[i], __ATOMIC_RELEASE);
+            }
+            iov_count = 0;
+            owner_count = 0;
+        }
+    }
+
+    if (owner_count > 0) {
+        write_batch(iov, iov_count);
+        for (int i = 0; i < owner_count; i++) {
+            __atomic_store_n(&owners[i]->tail, heads[i], __ATOMIC_RELEASE);
+        }
+    }
+}
+
+size_t log_ring_writev(int fd, struct iovec *iov, int count) {
+    size_t total = 0;
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nowhere left to report this, the rest is discarded
+            return total;
+        }
+        total += written;
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return total;
+}
\ No newline at end of file
@@ -1,52 +1,60 @@
 #include "logger.h"
+#include "log_record.h"
+#include "log_ring.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <pthread.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 
 #define MAX_LOG_BUFFER 4096
-#define LOG_QUEUE_SIZE 1024
 
-typedef struct {
-    char *message;
-    size_t length;
-} log_entry_t;
-
-typedef struct {
-    log_entry_t entries[LOG_QUEUE_SIZE];
-    int head;
-    int tail;
-    int count;
-    pthread_mutex_t mutex;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
-} log_queue_t;
+// Per-thread ring of formatted lines, a power of two larger than any message
+#define LOG_RING_SIZE (32 * 1024)
+
+// The writer flushes once a ring holds this much, or after the interval at the latest
+#define LOG_FLUSH_BYTES (8 * 1024)
+#define LOG_FLUSH_INTERVAL_MS 100
+
+// Deferred and binary records are decoded into this before being written
+#define LOG_BATCH_SIZE (64 * 1024)
+
+// Pointers already described in the binary log
+#define LOG_STRING_SLOTS 1024
+
+static void write_start_record(void);
+static void drain_rings(log_ring *rings);
 
 static struct {
-    FILE *log_file;
+    int fd;
     log_level_t level;
-    pthread_t writer_thread;
-    log_queue_t queue;
-    volatile int running;
-    pthread_mutex_t file_mutex;
+    log_format_t format;
+    log_ring_set rings;
 } logger = {
+    .fd = -1,
     .level = LOG_INFO,  // Default level
-    .running = 0
-};
-
-static const char *level_strings[] = {
-    "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
-};
-
-static const char *level_colors[] = {
-    COLOR_WHITE, COLOR_CYAN, COLOR_GREEN, COLOR_YELLOW, COLOR_RED, COLOR_MAGENTA
+    .format = LOG_FORMAT_TEXT,
+    .rings = {
+        .ring_size = LOG_RING_SIZE,
+        .flush_bytes = LOG_FLUSH_BYTES,
+        .flush_interval_ms = LOG_FLUSH_INTERVAL_MS,
+        .drain = drain_rings
+    }
 };
 
-static void *log_writer_thread(void *arg);
+// Writer thread state, the batch and strings serve deferred and binary records
+static struct {
+    char data[LOG_BATCH_SIZE];
+    size_t length;
+    uint64_t strings[LOG_STRING_SLOTS];
+    unsigned long reported;                     // Drops already noted in the log
+} batch;
 
 int logger_init(const char *log_file_path) {
     // Get log level from environment
@@ -60,27 +68,49 @@ int logger_init(const char *log_file_path) {
         else if (strcasecmp(env_level, "FATAL") == 0) logger.level = LOG_FATAL;
     }
 
-    logger.log_file = fopen(log_file_path, "a");
-    if (!logger.log_file) {
+    // Full rings either drop new lines or make their producer wait for the writer
+    const char *env_overflow = getenv("LOG_OVERFLOW");
+    if (env_overflow && strcasecmp(env_overflow, "block") == 0) {
+        logger.rings.block = 1;
+    }
+
+    // Formatting can be moved off the logging threads entirely
+    const char *env_format = getenv("LOG_FORMAT");
+    if (env_format && strcasecmp(env_format, "deferred") == 0) {
+        logger.format = LOG_FORMAT_DEFERRED;
+    } else if (env_format && strcasecmp(env_format, "binary") == 0) {
+        logger.format = LOG_FORMAT_BINARY;
+    }
+
+    const char *env_flush = getenv("LOG_FLUSH_MS");
+    if (env_flush && atoi(env_flush) > 0) {
+        logger.rings.flush_interval_ms = atoi(env_flush);
+    }
+
+    char binary_path[PATH_MAX];
+    if (logger.format == LOG_FORMAT_BINARY) {
+        snprintf(binary_path, sizeof(binary_path), "%s.bin", log_file_path);
+        log_file_path = binary_path;
+    }
+
+    logger.fd = open(log_file_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (logger.fd == -1) {
         fprintf(stderr, "Failed to open log file: %s\n", strerror(errno));
         return -1;
     }
 
-    // Initialize mutexes and condition variables
-    pthread_mutex_init(&logger.queue.mutex, NULL);
-    pthread_mutex_init(&logger.file_mutex, NULL);
-    pthread_cond_init(&logger.queue.not_empty, NULL);
-    pthread_cond_init(&logger.queue.not_full, NULL);
-
-    logger.queue.head = 0;
-    logger.queue.tail = 0;
-    logger.queue.count = 0;
-    logger.running = 1;
+    // A binary log opens with the start of this run, written ahead of the first batch
+    batch.length = 0;
+    batch.reported = 0;
+    if (logger.format == LOG_FORMAT_BINARY) {
+        write_start_record();
+    }
 
     // Start writer thread
-    if (pthread_create(&logger.writer_thread, NULL, log_writer_thread, NULL) != 0) {
+    if (log_ring_start(&logger.rings) != 0) {
         fprintf(stderr, "Failed to create logger thread\n");
-        fclose(logger.log_file);
+        close(logger.fd);
+        logger.fd = -1;
         return -1;
     }
 
@@ -88,17 +118,11 @@ int logger_init(const char *log_file_path) {
 }
 
 void logger_cleanup(void) {
-    logger.running = 0;
-    pthread_cond_signal(&logger.queue.not_empty);
-    pthread_join(logger.writer_thread, NULL);
-
-    pthread_mutex_destroy(&logger.queue.mutex);
-    pthread_mutex_destroy(&logger.file_mutex);
-    pthread_cond_destroy(&logger.queue.not_empty);
-    pthread_cond_destroy(&logger.queue.not_full);
+    log_ring_stop(&logger.rings);
 
-    if (logger.log_file) {
-        fclose(logger.log_file);
+    if (logger.fd != -1) {
+        close(logger.fd);
+        logger.fd = -1;
     }
 }
 
@@ -106,107 +130,169 @@ void logger_set_level(log_level_t level) {
     logger.level = level;
 }
 
-static void enqueue_log(const char *message, size_t length) {
-    pthread_mutex_lock(&logger.queue.mutex);
-
-    while (logger.queue.count >= LOG_QUEUE_SIZE && logger.running) {
-        pthread_cond_wait(&logger.queue.not_full, &logger.queue.mutex);
-    }
-
-    if (!logger.running) {
-        pthread_mutex_unlock(&logger.queue.mutex);
-        return;
-    }
+unsigned long logger_dropped(void) {
+    return log_ring_dropped(&logger.rings);
+}
 
-    log_entry_t *entry = &logger.queue.entries[logger.queue.tail];
-    entry->message = malloc(length + 1);
-    if (entry->message) {
-        memcpy(entry->message, message, length);
-        entry->message[length] = '\0';
-        entry->length = length;
+size_t logger_pending(void) {
+    return log_ring_pending(&logger.rings);
+}
 
-        logger.queue.tail = (logger.queue.tail + 1) % LOG_QUEUE_SIZE;
-        logger.queue.count++;
+// Write a batch out completely, the rings' tails only move once their bytes are on disk
+static void write_batch(struct iovec *iov, int count) {
+    log_ring_writev(logger.fd, iov, count);
+}
 
-        pthread_cond_signal(&logger.queue.not_empty);
+static void flush_batch(void) {
+    struct iovec iov = { .iov_base = batch.data, .iov_len = batch.length };
+    if (batch.length > 0) {
+        write_batch(&iov, 1);
+        batch.length = 0;
     }
-
-    pthread_mutex_unlock(&logger.queue.mutex);
 }
 
-static void *log_writer_thread(void *arg) {
-    (void)arg;
-
-    while (logger.running || logger.queue.count > 0) {
-        pthread_mutex_lock(&logger.queue.mutex);
+static void append_batch(const void *data, size_t length) {
+    if (batch.length + length > sizeof(batch.data)) {
+        flush_batch();
+    }
+    memcpy(batch.data + batch.length, data, length);
+    batch.length += length;
+}
 
-        while (logger.queue.count == 0 && logger.running) {
-            pthread_cond_wait(&logger.queue.not_empty, &logger.queue.mutex);
+// Describe a format or file pointer in the binary log before its first use
+static void define_string(uint64_t pointer) {
+    size_t slot = (pointer >> 3) % LOG_STRING_SLOTS;
+    for (size_t probe = 0; probe < LOG_STRING_SLOTS; probe++) {
+        size_t index = (slot + probe) % LOG_STRING_SLOTS;
+        if (batch.strings[index] == pointer) {
+            return;
         }
-
-        if (logger.queue.count == 0 && !logger.running) {
-            pthread_mutex_unlock(&logger.queue.mutex);
+        if (batch.strings[index] == 0) {
+            batch.strings[index] = pointer;
             break;
         }
+    }
+    // A full table only means strings are described again
+
+    const char *text = (const char *)(uintptr_t)pointer;
+    size_t text_length = strnlen(text, MAX_LOG_BUFFER);
+    log_record record = {
+        .length = sizeof(log_record) + text_length,
+        .kind = LOG_RECORD_STRING,
+        .format = pointer
+    };
+    append_batch(&record, sizeof(record));
+    append_batch(text, text_length);
+}
 
-        log_entry_t *entry = &logger.queue.entries[logger.queue.head];
-        char *message = entry->message;
-        size_t length = entry->length;
+static void write_start_record(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_record record = {
+        .length = sizeof(log_record),
+        .kind = LOG_RECORD_START,
+        .timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec
+    };
+    append_batch(&record, sizeof(record));
+}
 
-        logger.queue.head = (logger.queue.head + 1) % LOG_QUEUE_SIZE;
-        logger.queue.count--;
+// Decode the records of every ring, rendering them as text or passing them through with their strings
+static void drain_records(log_ring *rings) {
+    _Alignas(log_record) char record[MAX_LOG_BUFFER];
+    char line[MAX_LOG_BUFFER];
+
+    for (log_ring *ring = rings; ring; ring = ring->next) {
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        while (tail < head) {
+            log_record header;
+            log_ring_copy(&logger.rings, ring, tail, &header, sizeof(header));
+            log_ring_copy(&logger.rings, ring, tail, record, header.length);
+            tail += header.length;
+
+            if (logger.format == LOG_FORMAT_BINARY) {
+                define_string(header.format);
+                define_string(header.file);
+                append_batch(record, header.length);
+            } else {
+                size_t length = log_record_render((const log_record *)record,
+                                                  (const char *)(uintptr_t)header.format,
+                                                  (const char *)(uintptr_t)header.file, line, sizeof(line));
+                append_batch(line, length);
+            }
+        }
 
-        pthread_cond_signal(&logger.queue.not_full);
-        pthread_mutex_unlock(&logger.queue.mutex);
+        // Everything up to tail has been copied out, so the producer may reuse it
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
 
-        if (message) {
-            pthread_mutex_lock(&logger.file_mutex);
-            fwrite(message, 1, length, logger.log_file);
-            fflush(logger.log_file);
-            pthread_mutex_unlock(&logger.file_mutex);
+    flush_batch();
+}
 
-            free(message);
-        }
+// Note lines lost to full rings since the last report
+static void report_dropped(void) {
+    unsigned long dropped = logger_dropped();
+    if (dropped == batch.reported) {
+        return;
     }
 
-    return NULL;
+    char line[128];
+    int length = snprintf(line, sizeof(line), "Log rings overflowed, %lu messages dropped\n", dropped - batch.reported);
+    struct iovec iov = { .iov_base = line, .iov_len = length };
+    write_batch(&iov, 1);
+    batch.reported = dropped;
+}
+
+// Runs on the writer thread each time it wakes
+static void drain_rings(log_ring *rings) {
+    if (logger.format == LOG_FORMAT_TEXT) {
+        log_ring_flush(&logger.rings, rings, write_batch);
+    } else {
+        drain_records(rings);
+    }
+    report_dropped();
 }
 
 static void log_message(log_level_t level, const char *file, int line, const char *fmt, va_list args) {
     if (level < logger.level) return;
 
     char buffer[MAX_LOG_BUFFER];
-    int offset = 0;
-    struct timeval tv;
-    struct tm *tm_info;
-
-    gettimeofday(&tv, NULL);
-    tm_info = localtime(&tv.tv_sec);
-
-    // Add timestamp
-    offset += strftime(buffer + offset, sizeof(buffer) - offset,
-                      "[%Y-%m-%d %H:%M:%S", tm_info);
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                      ".%03ld] ", tv.tv_usec / 1000);
-
-    // Add level and color
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                      "%s%-5s%s ", level_colors[level], level_strings[level], COLOR_RESET);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    // Deferred formats only capture the arguments, the writer does the rest
+    if (logger.format != LOG_FORMAT_TEXT) {
+        uint64_t timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+        size_t length = log_record_encode(buffer, sizeof(buffer), level, file, line, timestamp, fmt, args);
+        if (length == 0) {
+            log_ring_drop(&logger.rings);
+            return;
+        }
+        log_ring_enqueue(&logger.rings, buffer, length, level >= LOG_ERROR);
+        return;
+    }
 
-    // Add file and line
-    offset += snprintf(buffer + offset, sizeof(buffer) - offset,
-                      "(%s:%d) ", file, line);
+    // Timestamp and level come pre-rendered, one byte stays free for the newline
+    size_t size = sizeof(buffer) - 1;
+    size_t offset = log_timestamp(buffer, now.tv_sec, now.tv_nsec / 1000000);
+    const char *prefix = log_level_prefix(level);
+    size_t prefix_length = strlen(prefix);
+    memcpy(buffer + offset, prefix, prefix_length);
+    offset += prefix_length;
 
-    // Add message
-    offset += vsnprintf(buffer + offset, sizeof(buffer) - offset, fmt, args);
+    // Add file, line and message
+    int written = snprintf(buffer + offset, size - offset, "(%s:%d) ", file, line);
+    offset += written < (int)(size - offset) ? written : (int)(size - offset - 1);
+    written = vsnprintf(buffer + offset, size - offset, fmt, args);
+    offset += written < (int)(size - offset) ? written : (int)(size - offset - 1);
 
     // Add newline if not present
-    if (offset > 0 && buffer[offset - 1] != '\n') {
+    if (buffer[offset - 1] != '\n') {
         buffer[offset++] = '\n';
-        buffer[offset] = '\0';
     }
 
-    enqueue_log(buffer, offset);
+    log_ring_enqueue(&logger.rings, buffer, offset, level >= LOG_ERROR);
 }
 
 void log_trace(const char *file, int line, const char *fmt, ...) {
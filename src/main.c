@@ -1,8 +1,17 @@
 #include "http_server.h"
 #include "config.h"
 #include "logger.h"
+#include "file_cache.h"
+#include "fd_cache.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "mime_types.h"
+#include "hpack.h"
+#include "site_pack.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 
 int main(void) {
     // Initialize logger
@@ -11,12 +20,43 @@ int main(void) {
         return EXIT_FAILURE;
     }
 
+    config_load();
+    metrics_init();
+    hpack_init();
+    file_cache_init(server_config.file_cache_size);
+    fd_cache_init(server_config.fd_cache_ttl, FD_CACHE_ENTRIES);
+    if (mime_types_init(server_config.mime_types) < 0) {
+        logger_cleanup();
+        return EXIT_FAILURE;
+    }
+    if (server_config.site_pack && site_pack_open(server_config.site_pack) != 0) {
+        mime_types_cleanup();
+        logger_cleanup();
+        return EXIT_FAILURE;
+    }
+    if (access_log_init() != 0) {
+        site_pack_close();
+        mime_types_cleanup();
+        logger_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // Peers that disconnect mid-response must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
     INFO("HTTP Server starting on port %d...", PORT);
     DEBUG("Debug mode enabled");
     TRACE("Detailed logging activated");
 
     int result = initialize_server();
 
+    access_log_cleanup();
+    metrics_cleanup();
+    fd_cache_cleanup();
+    file_cache_cleanup();
+    site_pack_close();
+    mime_types_cleanup();
+    buffer_pool_cleanup();
     logger_cleanup();
     return result;
 }
\ No newline at end of file
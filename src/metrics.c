@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include "logger.h"
+#include "access_log.h"
+#include "thread_pool.h"
+#include "buffer_pool.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Log-linear latency buckets in microseconds: exact below 8, then 8 per power of two (12.5% precision)
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS 256
+
+#define STATUS_MIN 100
+#define STATUS_COUNT 500
+
+static const char *method_names[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH", "OTHER"};
+#define METHOD_COUNT (sizeof(method_names) / sizeof(method_names[0]))
+
+static const char *route_names[ROUTE_COUNT] = {"none", "static", "listing", "ping", "metrics"};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// Counters of one thread, only ever written by it
+typedef struct metrics_shard {
+    struct metrics_shard *next;
+    uint64_t counters[METRIC_COUNTERS];
+    uint64_t methods[METHOD_COUNT];
+    uint64_t statuses[STATUS_COUNT];
+    uint64_t bytes;
+    uint64_t duration_sum[ROUTE_COUNT];         // Microseconds
+    uint64_t durations[ROUTE_COUNT][HISTOGRAM_BUCKETS];
+} metrics_shard;
+
+static struct {
+    int initialized;
+    pthread_mutex_t mutex;                      // Guards the shard list and retired
+    metrics_shard *shards;
+    metrics_shard retired;                      // Totals of threads that have exited
+    pthread_key_t shard_key;
+} metrics = {
+    .initialized = 0
+};
+
+static __thread metrics_shard *thread_shard;
+
+// Single writer, so a plain add published with a relaxed store is enough
+static inline void bump(uint64_t *slot, uint64_t value) {
+    __atomic_store_n(slot, *slot + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load(const uint64_t *slot) {
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+static void add_shard(metrics_shard *total, const metrics_shard *shard) {
+    const uint64_t *from = &shard->counters[0];
+    uint64_t *to = &total->counters[0];
+    size_t count = (sizeof(metrics_shard) - offsetof(metrics_shard, counters)) / sizeof(uint64_t);
+    for (size_t i = 0; i < count; i++) {
+        to[i] += load(&from[i]);
+    }
+}
+
+// Runs at thread exit, folds the shard into the retired totals
+static void retire_shard(void *arg) {
+    metrics_shard *shard = arg;
+
+    pthread_mutex_lock(&metrics.mutex);
+    metrics_shard **link = &metrics.shards;
+    while (*link != shard) {
+        link = &(*link)->next;
+    }
+    *link = shard->next;
+    add_shard(&metrics.retired, shard);
+    pthread_mutex_unlock(&metrics.mutex);
+
+    free(shard);
+}
+
+int metrics_init(void) {
+    pthread_mutex_init(&metrics.mutex, NULL);
+    pthread_key_create(&metrics.shard_key, retire_shard);
+    memset(&metrics.retired, 0, sizeof(metrics.retired));
+    metrics.shards = NULL;
+    metrics.initialized = 1;
+    return 0;
+}
+
+void metrics_cleanup(void) {
+    if (!metrics.initialized) {
+        return;
+    }
+
+    metrics.initialized = 0;
+    pthread_key_delete(metrics.shard_key);
+    while (metrics.shards) {
+        metrics_shard *shard = metrics.shards;
+        metrics.shards = shard->next;
+        free(shard);
+    }
+    pthread_mutex_destroy(&metrics.mutex);
+}
+
+// The calling thread's shard, created and registered on first use
+static metrics_shard *current_shard(void) {
+    if (thread_shard) {
+        return thread_shard;
+    }
+    if (!metrics.initialized) {
+        return NULL;
+    }
+
+    metrics_shard *shard = calloc(1, sizeof(metrics_shard));
+    if (!shard) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&metrics.mutex);
+    shard->next = metrics.shards;
+    metrics.shards = shard;
+    pthread_mutex_unlock(&metrics.mutex);
+
+    pthread_setspecific(metrics.shard_key, shard);
+    thread_shard = shard;
+    return shard;
+}
+
+void metrics_count(metrics_counter_t counter) {
+    metrics_shard *shard = current_shard();
+    if (shard) {
+        bump(&shard->counters[counter], 1);
+    }
+}
+
+static size_t method_index(const char *method) {
+    for (size_t i = 0; i < METHOD_COUNT - 1; i++) {
+        if (strcmp(method, method_names[i]) == 0) {
+            return i;
+        }
+    }
+    return METHOD_COUNT - 1;
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    int index = (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+// Highest value that lands in a bucket
+static uint64_t bucket_limit(int index) {
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_COUNT - 1;
+    uint64_t lowest = (uint64_t)(HISTOGRAM_SUB_COUNT + index % HISTOGRAM_SUB_COUNT) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+void metrics_request(const char *method, metrics_route_t route, int status, size_t bytes, long long duration) {
+    metrics_shard *shard = current_shard();
+    if (!shard) {
+        return;
+    }
+
+    uint64_t micros = duration > 0 ? (uint64_t)duration / 1000 : 0;
+    bump(&shard->methods[method_index(method)], 1);
+    if (status >= STATUS_MIN && status < STATUS_MIN + STATUS_COUNT) {
+        bump(&shard->statuses[status - STATUS_MIN], 1);
+    }
+    bump(&shard->bytes, bytes);
+    bump(&shard->duration_sum[route], micros);
+    bump(&shard->durations[route][bucket_index(micros)], 1);
+}
+
+// Report a route's latency quantiles as a summary
+static void render_durations(FILE *out, const metrics_shard *total, int route) {
+    const uint64_t *buckets = total->durations[route];
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        count += buckets[i];
+    }
+    if (count == 0) {
+        return;
+    }
+
+    int bucket = 0;
+    uint64_t seen = buckets[0];
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        uint64_t rank = (uint64_t)(quantiles[q] * count + 0.5);
+        if (rank == 0) {
+            rank = 1;
+        }
+        while (seen < rank && bucket < HISTOGRAM_BUCKETS - 1) {
+            seen += buckets[++bucket];
+        }
+        fprintf(out, "web_http_request_duration_seconds{route=\"%s\",quantile=\"%g\"} %.6f\n",
+                route_names[route], quantiles[q], bucket_limit(bucket) / 1e6);
+    }
+    fprintf(out, "web_http_request_duration_seconds_sum{route=\"%s\"} %.6f\n",
+            route_names[route], total->duration_sum[route] / 1e6);
+    fprintf(out, "web_http_request_duration_seconds_count{route=\"%s\"} %llu\n",
+            route_names[route], (unsigned long long)count);
+}
+
+static void render_counter(FILE *out, const char *name, const char *help, const char *type, unsigned long long value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, value);
+}
+
+char *metrics_render(size_t *length) {
+    metrics_shard *total = calloc(1, sizeof(metrics_shard));
+    if (!total) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&metrics.mutex);
+    add_shard(total, &metrics.retired);
+    for (metrics_shard *shard = metrics.shards; shard; shard = shard->next) {
+        add_shard(total, shard);
+    }
+    pthread_mutex_unlock(&metrics.mutex);
+
+    char *text = NULL;
+    FILE *out = open_memstream(&text, length);
+    if (!out) {
+        free(total);
+        return NULL;
+    }
+
+    fprintf(out, "# HELP web_http_requests_total Requests answered, by method\n"
+                 "# TYPE web_http_requests_total counter\n");
+    for (size_t i = 0; i < METHOD_COUNT; i++) {
+        fprintf(out, "web_http_requests_total{method=\"%s\"} %llu\n",
+                method_names[i], (unsigned long long)total->methods[i]);
+    }
+
+    fprintf(out, "# HELP web_http_responses_total Responses sent, by status code\n"
+                 "# TYPE web_http_responses_total counter\n");
+    for (int i = 0; i < STATUS_COUNT; i++) {
+        if (total->statuses[i]) {
+            fprintf(out, "web_http_responses_total{code=\"%d\"} %llu\n",
+                    STATUS_MIN + i, (unsigned long long)total->statuses[i]);
+        }
+    }
+
+    fprintf(out, "# HELP web_http_request_duration_seconds Time from a request's first byte to its last response byte, by route\n"
+                 "# TYPE web_http_request_duration_seconds summary\n");
+    for (int route = 0; route < ROUTE_COUNT; route++) {
+        render_durations(out, total, route);
+    }
+
+    render_counter(out, "web_http_response_bytes_total", "Response bytes sent", "counter", total->bytes);
+
+    uint64_t opened = total->counters[METRIC_CONNECTIONS_OPENED];
+    uint64_t closed = total->counters[METRIC_CONNECTIONS_CLOSED];
+    render_counter(out, "web_connections_accepted_total", "Connections accepted", "counter", opened);
+    render_counter(out, "web_connections_active", "Connections currently open", "gauge",
+                   opened > closed ? opened - closed : 0);
+    render_counter(out, "web_connections_rejected_total", "Connections answered 503 on a full thread pool queue",
+                   "counter", total->counters[METRIC_CONNECTIONS_REJECTED]);
+    render_counter(out, "web_http2_connections_total", "Connections switched to HTTP/2", "counter",
+                   total->counters[METRIC_H2_CONNECTIONS]);
+    render_counter(out, "web_http2_streams_total", "HTTP/2 streams opened by clients", "counter",
+                   total->counters[METRIC_H2_STREAMS]);
+    fprintf(out, "# HELP web_connection_timeouts_total Connections closed for missing a deadline, by deadline\n"
+                 "# TYPE web_connection_timeouts_total counter\n"
+                 "web_connection_timeouts_total{deadline=\"idle\"} %llu\n"
+                 "web_connection_timeouts_total{deadline=\"header\"} %llu\n"
+                 "web_connection_timeouts_total{deadline=\"body\"} %llu\n"
+                 "web_connection_timeouts_total{deadline=\"response\"} %llu\n",
+            (unsigned long long)total->counters[METRIC_TIMEOUTS_IDLE],
+            (unsigned long long)total->counters[METRIC_TIMEOUTS_HEADER],
+            (unsigned long long)total->counters[METRIC_TIMEOUTS_BODY],
+            (unsigned long long)total->counters[METRIC_TIMEOUTS_RESPONSE]);
+    if (server_config.mode == SERVER_MODE_THREADED) {
+        render_counter(out, "web_thread_pool_queue_depth", "Connections waiting for a pool thread", "gauge",
+                       thread_pool_depth());
+        render_counter(out, "web_thread_pool_busy", "Pool threads serving a connection", "gauge", thread_pool_busy());
+    }
+
+    fprintf(out, "# HELP web_file_cache_lookups_total Static file cache lookups, by result\n"
+                 "# TYPE web_file_cache_lookups_total counter\n"
+                 "web_file_cache_lookups_total{result=\"hit\"} %llu\n"
+                 "web_file_cache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)total->counters[METRIC_FILE_CACHE_HITS],
+            (unsigned long long)total->counters[METRIC_FILE_CACHE_MISSES]);
+    fprintf(out, "# HELP web_fd_cache_lookups_total Descriptor cache lookups, by result\n"
+                 "# TYPE web_fd_cache_lookups_total counter\n"
+                 "web_fd_cache_lookups_total{result=\"hit\"} %llu\n"
+                 "web_fd_cache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)total->counters[METRIC_FD_CACHE_HITS],
+            (unsigned long long)total->counters[METRIC_FD_CACHE_MISSES]);
+
+    buffer_pool_stats_t pool;
+    buffer_pool_stats(&pool);
+    fprintf(out, "# HELP web_buffer_pool_buffers Pooled I/O buffers, by where they are\n"
+                 "# TYPE web_buffer_pool_buffers gauge\n"
+                 "web_buffer_pool_buffers{state=\"in_use\"} %zu\n"
+                 "web_buffer_pool_buffers{state=\"cached\"} %zu\n"
+                 "web_buffer_pool_buffers{state=\"free\"} %zu\n",
+            pool.in_use, pool.cached, pool.free);
+
+    render_counter(out, "web_log_queue_bytes", "Log bytes waiting for the writer", "gauge", logger_pending());
+    render_counter(out, "web_log_dropped_total", "Log lines dropped on full rings", "counter", logger_dropped());
+    render_counter(out, "web_access_log_dropped_total", "Access log lines dropped on full rings", "counter",
+                   access_log_dropped());
+
+    free(total);
+    if (fclose(out) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
\ No newline at end of file
@@ -1,40 +1,886 @@
 #include "mime_types.h"
-#include <string.h>
+#include "logger.h"
 #include <stdio.h>
-#include <strings.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+// Longer extensions are never looked up
+#define EXTENSION_MAX 16
+
+// Average keys per displacement bucket, and the seeds tried per bucket before the table is grown
+#define BUCKET_LOAD 4
+#define SEED_LIMIT 65536
 
 static const mime_map mime_types[] = {
-    {".html", "text/html"},
-    {".htm", "text/html"},
-    {".css", "text/css"},
-    {".js", "application/javascript"},
-    {".json", "application/json"},
-    {".png", "image/png"},
-    {".jpg", "image/jpeg"},
-    {".jpeg", "image/jpeg"},
-    {".gif", "image/gif"},
-    {".svg", "image/svg+xml"},
-    {".ico", "image/x-icon"},
-    {".txt", "text/plain"},
-    {".pdf", "application/pdf"},
-    {".zip", "application/zip"},
-    {".rar", "application/x-rar-compressed"},
-    {".mp3", "audio/mpeg"},
-    {".mp4", "video/mp4"},
+    {"3g2", "audio/3gpp2"},
+    {"3gp", "audio/3gpp"},
+    {"3gpp", "audio/3gpp"},
+    {"3gpp2", "audio/3gpp2"},
+    {"726", "audio/32kadpcm"},
+    {"7z", "application/x-7z-compressed"},
+    {"a", "application/octet-stream"},
+    {"aa3", "audio/ATRAC3"},
+    {"aac", "audio/aac"},
+    {"aal", "audio/ATRAC-ADVANCED-LOSSLESS"},
+    {"ac3", "audio/ac3"},
+    {"acn", "audio/asc"},
+    {"adts", "audio/aac"},
+    {"ai", "application/postscript"},
+    {"aif", "audio/x-aiff"},
+    {"aifc", "audio/x-aiff"},
+    {"aiff", "audio/x-aiff"},
+    {"amr", "audio/AMR"},
+    {"apk", "application/vnd.android.package-archive"},
+    {"apng", "image/apng"},
+    {"art", "image/x-jg"},
+    {"ass", "audio/aac"},
+    {"at3", "audio/ATRAC3"},
+    {"atom", "application/atom+xml"},
+    {"atx", "audio/ATRAC-X"},
+    {"au", "audio/basic"},
+    {"avci", "image/avci"},
+    {"avcs", "image/avcs"},
+    {"avi", "video/x-msvideo"},
+    {"avif", "image/avif"},
+    {"awb", "audio/AMR-WB"},
+    {"axa", "audio/annodex"},
+    {"axv", "video/annodex"},
+    {"azv", "image/vnd.airzip.accelerator.azv"},
+    {"b16", "image/vnd.pco.b16"},
+    {"bat", "text/plain"},
+    {"bcpio", "application/x-bcpio"},
+    {"bib", "text/x-bibtex"},
+    {"bik", "video/vnd.radgamettools.bink"},
+    {"bin", "application/octet-stream"},
+    {"bk2", "video/vnd.radgamettools.bink"},
+    {"bmp", "image/bmp"},
+    {"boo", "text/x-boo"},
+    {"brf", "text/plain"},
+    {"btf", "image/prs.btif"},
+    {"btif", "image/prs.btif"},
+    {"bz2", "application/x-bzip2"},
+    {"c", "text/x-c"},
+    {"c++", "text/x-c++src"},
+    {"cc", "text/x-c++src"},
+    {"cdf", "application/x-netcdf"},
+    {"cdr", "image/x-coreldraw"},
+    {"cdt", "image/x-coreldrawtemplate"},
+    {"cgm", "image/cgm"},
+    {"cls", "text/x-tex"},
+    {"cnd", "text/jcr-cnd"},
+    {"cpio", "application/x-cpio"},
+    {"cpp", "text/x-c++src"},
+    {"cql", "text/cql"},
+    {"cr2", "image/x-canon-cr2"},
+    {"crw", "image/x-canon-crw"},
+    {"csd", "audio/csound"},
+    {"csh", "application/x-csh"},
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"csvs", "text/csv-schema"},
+    {"cxx", "text/x-c++src"},
+    {"d", "text/x-dsrc"},
+    {"deb", "application/vnd.debian.binary-package"},
+    {"dif", "video/dv"},
+    {"diff", "text/x-diff"},
+    {"djv", "image/vnd.djvu"},
+    {"djvu", "image/vnd.djvu"},
+    {"dll", "application/octet-stream"},
+    {"dls", "audio/dls"},
+    {"dmg", "application/x-apple-diskimage"},
+    {"doc", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"dot", "application/msword"},
+    {"dpx", "image/dpx"},
+    {"drle", "image/dicom-rle"},
+    {"dsc", "text/prs.lines.tag"},
+    {"dts", "audio/vnd.dts"},
+    {"dtshd", "audio/vnd.dts.hd"},
+    {"dv", "video/dv"},
+    {"dvb", "video/vnd.dvb.file"},
+    {"dvi", "application/x-dvi"},
+    {"dwg", "image/vnd.dwg"},
+    {"dxf", "image/vnd.dxf"},
+    {"emf", "image/emf"},
+    {"eml", "message/rfc822"},
+    {"enw", "audio/EVRCNW"},
+    {"eol", "audio/vnd.digital-winds"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"eps", "application/postscript"},
+    {"epub", "application/epub+zip"},
+    {"erf", "image/x-epson-erf"},
+    {"es", "text/javascript"},
+    {"etx", "text/x-setext"},
+    {"evb", "audio/EVRCB"},
+    {"evc", "audio/EVRC"},
+    {"evw", "audio/EVRCWB"},
+    {"exe", "application/octet-stream"},
+    {"exr", "image/aces"},
+    {"fbs", "image/vnd.fastbidsheet"},
+    {"fit", "image/fits"},
+    {"fits", "image/fits"},
+    {"flac", "audio/flac"},
+    {"fli", "video/fli"},
+    {"flv", "video/x-flv"},
+    {"fpx", "image/vnd.fpx"},
+    {"fst", "image/vnd.fst"},
+    {"fts", "image/fits"},
+    {"fvt", "video/vnd.fvt"},
+    {"gcd", "text/x-pcs-gcd"},
+    {"geojson", "application/geo+json"},
+    {"gff3", "text/gff3"},
+    {"gif", "image/gif"},
+    {"gl", "video/gl"},
+    {"gsm", "audio/x-gsm"},
+    {"gtar", "application/x-gtar"},
+    {"gz", "application/gzip"},
+    {"h", "text/x-c"},
+    {"h++", "text/x-c++hdr"},
+    {"h5", "application/x-hdf5"},
+    {"hdf", "application/x-hdf"},
+    {"hdr", "image/vnd.radiance"},
+    {"heic", "image/heic"},
+    {"heics", "image/heic-sequence"},
+    {"heif", "image/heif"},
+    {"heifs", "image/heif-sequence"},
+    {"hej2", "image/hej2k"},
+    {"hh", "text/x-c++hdr"},
+    {"hif", "image/avif"},
+    {"hpp", "text/x-c++hdr"},
+    {"hs", "text/x-haskell"},
+    {"hsj2", "image/hsj2"},
+    {"htc", "text/x-component"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"hxx", "text/x-c++hdr"},
+    {"ico", "image/x-icon"},
+    {"ics", "text/calendar"},
+    {"ief", "image/ief"},
+    {"ifb", "text/calendar"},
+    {"iso", "application/x-iso9660-image"},
+    {"jar", "application/java-archive"},
+    {"java", "text/x-java"},
+    {"jfif", "image/jpeg"},
+    {"jhc", "image/jphc"},
+    {"jls", "image/jls"},
+    {"jng", "image/x-jng"},
+    {"jp2", "image/jp2"},
+    {"jpe", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"jpf", "image/jpx"},
+    {"jpg", "image/jpeg"},
+    {"jpg2", "image/jp2"},
+    {"jpgm", "image/jpm"},
+    {"jph", "image/jph"},
+    {"jphc", "image/jphc"},
+    {"jpm", "image/jpm"},
+    {"jpx", "image/jpx"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"jxl", "image/jxl"},
+    {"jxr", "image/jxr"},
+    {"jxra", "image/jxrA"},
+    {"jxrs", "image/jxrS"},
+    {"jxs", "image/jxs"},
+    {"jxsc", "image/jxsc"},
+    {"jxsi", "image/jxsi"},
+    {"jxss", "image/jxss"},
+    {"koz", "audio/vnd.audiokoz"},
+    {"ksh", "text/plain"},
+    {"ktx", "image/ktx"},
+    {"ktx2", "image/ktx2"},
+    {"l16", "audio/L16"},
+    {"latex", "application/x-latex"},
+    {"lbc", "audio/iLBC"},
+    {"lhs", "text/x-literate-haskell"},
+    {"loas", "audio/aac"},
+    {"lsf", "video/x-la-asf"},
+    {"lsx", "video/x-la-asf"},
+    {"ltx", "text/x-tex"},
+    {"lvp", "audio/vnd.lucent.voice"},
+    {"ly", "text/x-lilypond"},
+    {"m1v", "video/mpeg"},
+    {"m2v", "video/mpeg"},
+    {"m3u", "application/vnd.apple.mpegurl"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"m4a", "audio/mp4"},
+    {"m4s", "video/iso.segment"},
+    {"m4u", "video/vnd.mpegurl"},
+    {"m4v", "video/mp4"},
+    {"man", "application/x-troff-man"},
+    {"map", "application/json"},
+    {"markdown", "text/markdown"},
+    {"md", "text/markdown"},
+    {"mdi", "image/vnd.ms-modi"},
+    {"me", "application/x-troff-me"},
+    {"mhas", "audio/mhas"},
+    {"mht", "message/rfc822"},
+    {"mhtml", "message/rfc822"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"mif", "application/x-mif"},
+    {"miz", "text/mizar"},
+    {"mj2", "video/mj2"},
+    {"mjp2", "video/mj2"},
+    {"mjs", "application/javascript"},
+    {"mkv", "video/x-matroska"},
+    {"mlp", "audio/vnd.dolby.mlp"},
+    {"mmr", "image/vnd.fujixerox.edmics-mmr"},
+    {"mng", "video/x-mng"},
+    {"moc", "text/x-moc"},
+    {"mov", "video/quicktime"},
+    {"movie", "video/x-sgi-movie"},
+    {"mp1", "audio/mpeg"},
+    {"mp2", "audio/mpeg"},
+    {"mp3", "audio/mpeg"},
+    {"mp4", "video/mp4"},
+    {"mpa", "video/mpeg"},
+    {"mpe", "video/mpeg"},
+    {"mpeg", "video/mpeg"},
+    {"mpega", "audio/mpeg"},
+    {"mpg", "video/mpeg"},
+    {"mpg4", "video/mp4"},
+    {"mpga", "audio/mpeg"},
+    {"mpv", "video/x-matroska"},
+    {"ms", "application/x-troff-ms"},
+    {"mxmf", "audio/mobile-xmf"},
+    {"mxu", "video/vnd.mpegurl"},
+    {"n3", "text/n3"},
+    {"nc", "application/x-netcdf"},
+    {"nef", "image/x-nikon-nef"},
+    {"nim", "video/vnd.nokia.interleaved-multimedia"},
+    {"nq", "application/n-quads"},
+    {"nt", "application/n-triples"},
+    {"nws", "message/rfc822"},
+    {"o", "application/octet-stream"},
+    {"obj", "application/octet-stream"},
+    {"oda", "application/oda"},
+    {"odp", "application/vnd.oasis.opendocument.presentation"},
+    {"ods", "application/vnd.oasis.opendocument.spreadsheet"},
+    {"odt", "application/vnd.oasis.opendocument.text"},
+    {"oga", "audio/ogg"},
+    {"ogg", "audio/ogg"},
+    {"ogv", "video/ogg"},
+    {"omg", "audio/ATRAC3"},
+    {"opus", "audio/ogg"},
+    {"orc", "audio/csound"},
+    {"orf", "image/x-olympus-orf"},
+    {"otf", "font/otf"},
+    {"p", "text/x-pascal"},
+    {"p12", "application/x-pkcs12"},
+    {"p7c", "application/pkcs7-mime"},
+    {"pas", "text/x-pascal"},
+    {"pat", "image/x-coreldrawpattern"},
+    {"patch", "text/x-diff"},
+    {"pbm", "image/x-portable-bitmap"},
+    {"pct", "image/pict"},
+    {"pcx", "image/vnd.zbrush.pcx"},
+    {"pdf", "application/pdf"},
+    {"pfx", "application/x-pkcs12"},
+    {"pgb", "image/vnd.globalgraphics.pgb"},
+    {"pgm", "image/x-portable-graymap"},
+    {"pic", "image/pict"},
+    {"pict", "image/pict"},
+    {"pl", "text/plain"},
+    {"plj", "audio/vnd.everad.plj"},
+    {"pls", "audio/x-scpls"},
+    {"pm", "text/x-perl"},
+    {"png", "image/png"},
+    {"pnm", "image/x-portable-anymap"},
+    {"pot", "application/vnd.ms-powerpoint"},
+    {"ppa", "application/vnd.ms-powerpoint"},
+    {"ppm", "image/x-portable-pixmap"},
+    {"pps", "application/vnd.ms-powerpoint"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"provn", "text/provenance-notation"},
+    {"ps", "application/postscript"},
+    {"psd", "image/vnd.adobe.photoshop"},
+    {"psid", "audio/prs.sid"},
+    {"pti", "image/prs.pti"},
+    {"pwz", "application/vnd.ms-powerpoint"},
+    {"py", "text/x-python"},
+    {"pya", "audio/vnd.ms-playready.media.pya"},
+    {"pyc", "application/x-python-code"},
+    {"pyo", "application/x-python-code"},
+    {"pyv", "video/vnd.ms-playready.media.pyv"},
+    {"qcp", "audio/EVRC-QCP"},
+    {"qt", "video/quicktime"},
+    {"ra", "audio/x-pn-realaudio"},
+    {"ram", "application/x-pn-realaudio"},
+    {"rar", "application/x-rar-compressed"},
+    {"ras", "image/x-cmu-raster"},
+    {"rdf", "application/xml"},
+    {"rgb", "image/x-rgb"},
+    {"rgbe", "image/vnd.radiance"},
+    {"rip", "audio/vnd.rip"},
+    {"rlc", "image/vnd.fujixerox.edmics-rlc"},
+    {"rm", "audio/x-pn-realaudio"},
+    {"roff", "application/x-troff"},
+    {"rpm", "application/x-redhat-package-manager"},
+    {"rss", "application/rss+xml"},
+    {"rst", "text/prs.fallenstein.rst"},
+    {"rtf", "application/rtf"},
+    {"rtx", "text/richtext"},
+    {"s11", "video/vnd.sealed.mpeg1"},
+    {"s14", "video/vnd.sealed.mpeg4"},
+    {"s1g", "image/vnd.sealedmedia.softseal.gif"},
+    {"s1j", "image/vnd.sealedmedia.softseal.jpg"},
+    {"s1m", "audio/vnd.sealedmedia.softseal.mpeg"},
+    {"s1n", "image/vnd.sealed.png"},
+    {"s1q", "video/vnd.sealedmedia.softseal.mov"},
+    {"scala", "text/x-scala"},
+    {"sco", "audio/csound"},
+    {"sd2", "audio/x-sd2"},
+    {"sfv", "text/x-sfv"},
+    {"sgi", "image/vnd.sealedmedia.softseal.gif"},
+    {"sgif", "image/vnd.sealedmedia.softseal.gif"},
+    {"sgm", "text/x-sgml"},
+    {"sgml", "text/x-sgml"},
+    {"sh", "application/x-sh"},
+    {"shaclc", "text/shaclc"},
+    {"shar", "application/x-shar"},
+    {"shc", "text/shaclc"},
+    {"shex", "text/shex"},
+    {"shtml", "text/html"},
+    {"sid", "audio/prs.sid"},
+    {"sjp", "image/vnd.sealedmedia.softseal.jpg"},
+    {"sjpg", "image/vnd.sealedmedia.softseal.jpg"},
+    {"smk", "video/vnd.radgamettools.smacker"},
+    {"smo", "video/vnd.sealedmedia.softseal.mov"},
+    {"smov", "video/vnd.sealedmedia.softseal.mov"},
+    {"smp", "audio/vnd.sealedmedia.softseal.mpeg"},
+    {"smp3", "audio/vnd.sealedmedia.softseal.mpeg"},
+    {"smpg", "video/vnd.sealed.mpeg1"},
+    {"smv", "audio/SMV"},
+    {"snd", "audio/basic"},
+    {"so", "application/octet-stream"},
+    {"soa", "text/dns"},
+    {"sofa", "audio/sofa"},
+    {"spdx", "text/spdx"},
+    {"spn", "image/vnd.sealed.png"},
+    {"spng", "image/vnd.sealed.png"},
+    {"spx", "audio/ogg"},
+    {"src", "application/x-wais-source"},
+    {"srt", "text/plain"},
+    {"ssw", "video/vnd.sealed.swf"},
+    {"sswf", "video/vnd.sealed.swf"},
+    {"sty", "text/x-tex"},
+    {"sv4cpio", "application/x-sv4cpio"},
+    {"sv4crc", "application/x-sv4crc"},
+    {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
+    {"swf", "application/x-shockwave-flash"},
+    {"t", "application/x-troff"},
+    {"tag", "text/prs.lines.tag"},
+    {"tap", "image/vnd.tencent.tap"},
+    {"tar", "application/x-tar"},
+    {"tcl", "application/x-tcl"},
+    {"tex", "application/x-tex"},
+    {"texi", "application/x-texinfo"},
+    {"texinfo", "application/x-texinfo"},
+    {"text", "text/plain"},
+    {"tfx", "image/tiff-fx"},
+    {"tgz", "application/gzip"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"tk", "text/x-tcl"},
+    {"tm", "text/texmacs"},
+    {"toml", "application/toml"},
+    {"tr", "application/x-troff"},
+    {"trig", "application/trig"},
+    {"ts", "video/mp2t"},
+    {"tsv", "text/tab-separated-values"},
+    {"ttc", "font/collection"},
+    {"ttf", "font/ttf"},
+    {"ttl", "text/turtle"},
+    {"txt", "text/plain"},
+    {"uri", "text/uri-list"},
+    {"uris", "text/uri-list"},
+    {"ustar", "application/x-ustar"},
+    {"uva", "audio/vnd.dece.audio"},
+    {"uvg", "image/vnd.dece.graphic"},
+    {"uvh", "video/vnd.dece.hd"},
+    {"uvi", "image/vnd.dece.graphic"},
+    {"uvm", "video/vnd.dece.mobile"},
+    {"uvp", "video/vnd.dece.pd"},
+    {"uvs", "video/vnd.dece.sd"},
+    {"uvu", "video/vnd.dece.mp4"},
+    {"uvv", "video/vnd.dece.video"},
+    {"uvva", "audio/vnd.dece.audio"},
+    {"uvvg", "image/vnd.dece.graphic"},
+    {"uvvh", "video/vnd.dece.hd"},
+    {"uvvi", "image/vnd.dece.graphic"},
+    {"uvvm", "video/vnd.dece.mobile"},
+    {"uvvp", "video/vnd.dece.pd"},
+    {"uvvs", "video/vnd.dece.sd"},
+    {"uvvu", "video/vnd.dece.mp4"},
+    {"uvvv", "video/vnd.dece.video"},
+    {"vbk", "audio/vnd.nortel.vbk"},
+    {"vcard", "text/vcard"},
+    {"vcf", "text/x-vcard"},
+    {"vcs", "text/x-vcalendar"},
+    {"viv", "video/vnd.vivo"},
+    {"vtf", "image/vnd.valve.source.texture"},
+    {"vtt", "text/vtt"},
+    {"wasm", "application/wasm"},
+    {"wat", "text/plain"},
+    {"wav", "audio/wav"},
+    {"wax", "audio/x-ms-wax"},
+    {"wbmp", "image/vnd.wap.wbmp"},
+    {"webm", "video/webm"},
+    {"webmanifest", "application/manifest+json"},
+    {"webp", "image/webp"},
+    {"wgsl", "text/wgsl"},
+    {"wiz", "application/msword"},
+    {"wm", "video/x-ms-wm"},
+    {"wma", "audio/x-ms-wma"},
+    {"wmf", "image/wmf"},
+    {"wmv", "video/x-ms-wmv"},
+    {"wmx", "video/x-ms-wmx"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"wsdl", "application/xml"},
+    {"wvx", "video/x-ms-wvx"},
+    {"xbm", "image/x-xbitmap"},
+    {"xcf", "image/x-xcf"},
+    {"xhe", "audio/usac"},
+    {"xhtml", "application/xhtml+xml"},
+    {"xif", "image/vnd.xiff"},
+    {"xlb", "application/vnd.ms-excel"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"xml", "application/xml"},
+    {"xpdl", "application/xml"},
+    {"xpm", "image/x-xpixmap"},
+    {"xsl", "application/xml"},
+    {"xul", "text/xul"},
+    {"xwd", "image/x-xwindowdump"},
+    {"xyze", "image/vnd.radiance"},
+    {"xz", "application/x-xz"},
+    {"yaml", "application/yaml"},
+    {"yml", "application/yaml"},
+    {"yt", "video/vnd.youtube.yt"},
+    {"zip", "application/zip"},
+    {"zone", "text/dns"},
     {NULL, NULL}
 };
 
-const char* get_mime_type(const char *path) {
-    const char *ext = strrchr(path, '.');
-    if (!ext) {
-        return "application/octet-stream";
+// First match wins, entries ending in '/' match a whole top-level type
+static const cache_policy cache_policies[] = {
+    {"text/html", "no-cache"},
+    {"application/json", "no-cache"},
+    {"text/", "public, max-age=3600"},
+    {"application/javascript", "public, max-age=3600"},
+    {"image/", "public, max-age=86400"},
+    {"audio/", "public, max-age=86400"},
+    {"video/", "public, max-age=86400"},
+    {"font/", "public, max-age=86400"},
+    {NULL, "public, max-age=3600"}
+};
+
+// Applications types that compress well besides text/*, and any +json or +xml type
+static const char *compressible_types[] = {
+    "application/javascript", "application/json", "application/xml", "application/wasm",
+    "application/yaml", "application/toml", "application/x-sh", "application/rtf",
+    "application/vnd.ms-fontobject", "image/x-icon", "image/bmp", "font/ttf", "font/otf", NULL
+};
+
+typedef struct {
+    const char *extension;
+    const mime_entry *entry;
+} mime_slot;
+
+// Hash-and-displace perfect hash: an extension's bucket picks the seed that places it in its slot
+static struct {
+    mime_slot *slots;
+    size_t mask;
+    uint32_t *seeds;
+    size_t bucket_count;
+    mime_entry **entries;       // One per distinct type
+    size_t entry_count;
+    char *file_data;            // mime.types contents, tokens point into it
+    const mime_entry *fallback;
+} table;
+
+static const char *cache_control_for(const char *mime_type) {
+    int i;
+    for (i = 0; cache_policies[i].mime_type != NULL; i++) {
+        const char *type = cache_policies[i].mime_type;
+        size_t length = strlen(type);
+        if (type[length - 1] == '/' ? strncmp(mime_type, type, length) == 0 : strcmp(mime_type, type) == 0) {
+            break;
+        }
+    }
+    return cache_policies[i].cache_control;
+}
+
+static int is_compressible(const char *mime_type) {
+    if (strncmp(mime_type, "text/", 5) == 0) {
+        return 1;
+    }
+    size_t length = strlen(mime_type);
+    if (length > 5 && (strcmp(mime_type + length - 5, "+json") == 0 || strcmp(mime_type + length - 4, "+xml") == 0)) {
+        return 1;
+    }
+    for (int i = 0; compressible_types[i]; i++) {
+        if (strcmp(mime_type, compressible_types[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Render a type's header lines into one allocation with the entry
+static mime_entry *make_entry(const char *mime_type) {
+    const char *charset = strncmp(mime_type, "text/", 5) == 0 ? "; charset=utf-8" : "";
+    const char *cache_control = cache_control_for(mime_type);
+    int compressible = is_compressible(mime_type);
+
+    size_t type_length = strlen(mime_type);
+    size_t content_length = type_length + strlen(charset);
+    size_t type_header_length = strlen("Content-Type: \r\n") + content_length;
+    size_t policy_length = strlen("Cache-Control: \r\n") + strlen(cache_control) +
+                           (compressible ? strlen("Vary: Accept-Encoding\r\n") : 0);
+
+    mime_entry *entry = malloc(sizeof(mime_entry) + type_length + content_length + type_header_length +
+                               policy_length + 4);
+    if (!entry) {
+        return NULL;
+    }
+
+    char *text = (char *)(entry + 1);
+    entry->mime_type = text;
+    text += sprintf(text, "%s", mime_type) + 1;
+    entry->content_type = text;
+    text += sprintf(text, "%s%s", mime_type, charset) + 1;
+    entry->type_header = text;
+    entry->type_header_length = sprintf(text, "Content-Type: %s%s\r\n", mime_type, charset);
+    text += entry->type_header_length + 1;
+    entry->policy_headers = text;
+    entry->policy_headers_length = sprintf(text, "Cache-Control: %s\r\n%s", cache_control,
+                                           compressible ? "Vary: Accept-Encoding\r\n" : "");
+    entry->cache_control = cache_control;
+    entry->compressible = compressible;
+    return entry;
+}
+
+// FNV-1a of the lowercased extension
+static uint64_t hash_extension(const char *extension) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *extension; extension++) {
+        hash ^= (unsigned char)*extension;
+        hash *= 1099511628211ull;
     }
+    return hash;
+}
+
+// Final mix of splitmix64, spreads a hash and seed over every bit
+static inline uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ull;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+static inline size_t slot_for(uint64_t hash, uint32_t seed, size_t mask) {
+    return mix(hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ull)) & mask;
+}
+
+typedef struct {
+    const char *extension;
+    const char *mime_type;
+    size_t order;               // Later definitions of an extension win
+    const mime_entry *entry;
+    uint64_t hash;
+    size_t bucket;
+} mime_key;
+
+typedef struct {
+    size_t bucket;
+    size_t first;               // Index of its first key once keys are sorted by bucket
+    size_t size;
+} bucket_span;
+
+static int compare_extension(const void *a, const void *b) {
+    const mime_key *left = a;
+    const mime_key *right = b;
+    int result = strcmp(left->extension, right->extension);
+    if (result != 0) {
+        return result;
+    }
+    return left->order < right->order ? -1 : left->order > right->order;
+}
+
+static int compare_type(const void *a, const void *b) {
+    return strcmp(((const mime_key *)a)->mime_type, ((const mime_key *)b)->mime_type);
+}
+
+static int compare_bucket(const void *a, const void *b) {
+    const mime_key *left = a;
+    const mime_key *right = b;
+    return left->bucket < right->bucket ? -1 : left->bucket > right->bucket;
+}
+
+static int compare_span_size(const void *a, const void *b) {
+    const bucket_span *left = a;
+    const bucket_span *right = b;
+    return left->size > right->size ? -1 : left->size < right->size;
+}
 
-    for (int i = 0; mime_types[i].extension != NULL; i++) {
-        if (strcasecmp(ext, mime_types[i].extension) == 0) {
-            return mime_types[i].mime_type;
+// Give every bucket the first seed that lands all its keys in free, distinct slots, largest
+// buckets first. Returns -1 when one finds none and the table has to grow
+static int place_buckets(const mime_key *keys, bucket_span *spans, size_t span_count) {
+    size_t slots[BUCKET_LOAD * 8];
+
+    for (size_t i = 0; i < span_count; i++) {
+        const bucket_span *span = &spans[i];
+        if (span->size > sizeof(slots) / sizeof(slots[0])) {
+            return -1;
+        }
+
+        uint32_t seed = 0;
+        for (; seed < SEED_LIMIT; seed++) {
+            size_t placed = 0;
+            for (; placed < span->size; placed++) {
+                size_t slot = slot_for(keys[span->first + placed].hash, seed, table.mask);
+                size_t j = 0;
+                while (j < placed && slots[j] != slot) j++;
+                if (table.slots[slot].extension || j < placed) {
+                    break;
+                }
+                slots[placed] = slot;
+            }
+            if (placed == span->size) {
+                break;
+            }
+        }
+        if (seed == SEED_LIMIT) {
+            return -1;
+        }
+
+        table.seeds[span->bucket] = seed;
+        for (size_t k = 0; k < span->size; k++) {
+            table.slots[slots[k]].extension = keys[span->first + k].extension;
+            table.slots[slots[k]].entry = keys[span->first + k].entry;
         }
     }
-    
-    return "application/octet-stream";
+    return 0;
+}
+
+// Build the perfect hash over distinct extensions, growing the slot table until every bucket fits
+static int build_hash(mime_key *keys, size_t count) {
+    size_t size = 1;
+    while (size < count + count / 4) size *= 2;
+
+    table.bucket_count = (count + BUCKET_LOAD - 1) / BUCKET_LOAD;
+    if (table.bucket_count == 0) {
+        table.bucket_count = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        keys[i].hash = hash_extension(keys[i].extension);
+        keys[i].bucket = mix(keys[i].hash) % table.bucket_count;
+    }
+    qsort(keys, count, sizeof(mime_key), compare_bucket);
+
+    bucket_span *spans = calloc(table.bucket_count, sizeof(bucket_span));
+    table.seeds = calloc(table.bucket_count, sizeof(uint32_t));
+    if (!spans || !table.seeds) {
+        free(spans);
+        return -1;
+    }
+    size_t span_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || keys[i].bucket != keys[i - 1].bucket) {
+            spans[span_count++] = (bucket_span){ .bucket = keys[i].bucket, .first = i, .size = 0 };
+        }
+        spans[span_count - 1].size++;
+    }
+    qsort(spans, span_count, sizeof(bucket_span), compare_span_size);
+
+    for (;; size *= 2) {
+        free(table.slots);
+        table.slots = calloc(size, sizeof(mime_slot));
+        if (!table.slots) {
+            free(spans);
+            return -1;
+        }
+        table.mask = size - 1;
+        if (place_buckets(keys, spans, span_count) == 0) {
+            break;
+        }
+    }
+
+    free(spans);
+    DEBUG("MIME table: %zu extensions in %zu slots", count, size);
+    return 0;
+}
+
+// Read a mime.types file into pairs appended to keys, tokens point into table.file_data
+static int load_file(const char *path, mime_key **keys, size_t *count, size_t *capacity) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    table.file_data = length >= 0 ? malloc(length + 1) : NULL;
+    if (!table.file_data || fread(table.file_data, 1, length, file) != (size_t)length) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    table.file_data[length] = '\0';
+
+    char *line = table.file_data;
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char *save;
+        const char *type = strtok_r(line, " \t\r", &save);
+        // Types end up in headers, so anything but a plain type/subtype is skipped
+        int valid = type && strchr(type, '/');
+        for (const char *c = type; valid && *c; c++) {
+            valid = isgraph((unsigned char)*c) && *c != ';' && *c != ',';
+        }
+        for (char *ext = valid ? strtok_r(NULL, " \t\r", &save) : NULL; ext; ext = strtok_r(NULL, " \t\r", &save)) {
+            if (strlen(ext) > EXTENSION_MAX) {
+                continue;
+            }
+            for (char *c = ext; *c; c++) {
+                *c = tolower((unsigned char)*c);
+            }
+            if (*count == *capacity) {
+                *capacity *= 2;
+                mime_key *grown = realloc(*keys, *capacity * sizeof(mime_key));
+                if (!grown) {
+                    return -1;
+                }
+                *keys = grown;
+            }
+            (*keys)[*count] = (mime_key){ .extension = ext, .mime_type = type, .order = *count };
+            (*count)++;
+        }
+        line = next;
+    }
+    return 0;
+}
+
+int mime_types_init(const char *path) {
+    size_t capacity = sizeof(mime_types) / sizeof(mime_types[0]);
+    size_t count = 0;
+    mime_key *keys = malloc(capacity * sizeof(mime_key));
+    if (!keys) {
+        return -1;
+    }
+    for (; mime_types[count].extension; count++) {
+        keys[count] = (mime_key){ .extension = mime_types[count].extension,
+                                  .mime_type = mime_types[count].mime_type, .order = count };
+    }
+
+    // A file that fails part way contributes nothing, so the table is exactly the built-in one
+    int result = 0;
+    size_t builtin_count = count;
+    if (path && load_file(path, &keys, &count, &capacity) == -1) {
+        WARN("Failed to load MIME types from %s, using the built-in table", path);
+        count = builtin_count;
+        result = 1;
+    }
+
+    // Keep the last definition of each extension
+    qsort(keys, count, sizeof(mime_key), compare_extension);
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && strcmp(keys[i].extension, keys[i + 1].extension) == 0) {
+            continue;
+        }
+        keys[distinct++] = keys[i];
+    }
+
+    // One rendered entry per type, shared by its extensions
+    qsort(keys, distinct, sizeof(mime_key), compare_type);
+    table.entries = malloc((distinct + 1) * sizeof(mime_entry *));
+    table.entry_count = 0;
+    for (size_t i = 0; table.entries && i < distinct; i++) {
+        if (i == 0 || strcmp(keys[i].mime_type, keys[i - 1].mime_type) != 0) {
+            mime_entry *entry = make_entry(keys[i].mime_type);
+            if (!entry) {
+                break;
+            }
+            table.entries[table.entry_count++] = entry;
+        }
+        keys[i].entry = table.entries[table.entry_count - 1];
+    }
+
+    mime_entry *fallback = table.entries ? make_entry("application/octet-stream") : NULL;
+    if (!fallback || table.entry_count == 0 || build_hash(keys, distinct) == -1) {
+        ERROR("Failed to build the MIME table");
+        free(fallback);
+        free(keys);
+        mime_types_cleanup();
+        return -1;
+    }
+    table.entries[table.entry_count++] = fallback;
+    table.fallback = fallback;
+
+    free(keys);
+    return result;
+}
+
+void mime_types_cleanup(void) {
+    for (size_t i = 0; i < table.entry_count; i++) {
+        free(table.entries[i]);
+    }
+    free(table.entries);
+    free(table.slots);
+    free(table.seeds);
+    free(table.file_data);
+    memset(&table, 0, sizeof(table));
+}
+
+const mime_entry *mime_lookup(const char *path) {
+    const char *name = strrchr(path, '/');
+    const char *dot = strrchr(name ? name + 1 : path, '.');
+    if (!dot || !table.slots) {
+        return table.fallback;
+    }
+
+    // Lowercase and hash in one pass
+    char extension[EXTENSION_MAX + 1];
+    uint64_t hash = 14695981039346656037ull;
+    size_t length = 0;
+    for (const char *c = dot + 1; *c; c++) {
+        if (length == EXTENSION_MAX) {
+            return table.fallback;
+        }
+        char lower = (*c >= 'A' && *c <= 'Z') ? *c + ('a' - 'A') : *c;
+        extension[length++] = lower;
+        hash ^= (unsigned char)lower;
+        hash *= 1099511628211ull;
+    }
+    extension[length] = '\0';
+
+    uint32_t seed = table.seeds[mix(hash) % table.bucket_count];
+    const mime_slot *slot = &table.slots[slot_for(hash, seed, table.mask)];
+    if (slot->extension && strcmp(slot->extension, extension) == 0) {
+        return slot->entry;
+    }
+    return table.fallback;
+}
+
+const char* get_mime_type(const char *path) {
+    const mime_entry *entry = mime_lookup(path);
+    return entry ? entry->mime_type : "application/octet-stream";
 }
\ No newline at end of file
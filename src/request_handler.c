@@ -2,134 +2,671 @@
 #include "config.h"
 #include "mime_types.h"
 #include "utils.h"
+#include "response.h"
+#include "file_cache.h"
+#include "fd_cache.h"
+#include "site_pack.h"
+#include "compression.h"
+#include "directory_listing.h"
+#include "logger.h"
+#include "metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <time.h>
 
-void handle_post_ping(int client_socket, const char *body) {
-    (void)body;
+void handle_request(connection_t *conn, const http_request_t *req) {
+    if (http_slice_equals_nocase(req->method, "GET") && http_slice_equals(req->path, "/metrics")) {
+        conn->route = ROUTE_METRICS;
+        handle_get_metrics(conn);
+    }
+    else if (http_slice_equals_nocase(req->method, "GET")) {
+        conn->route = ROUTE_STATIC;
+        serve_static_file(conn, req);
+    }
+    else if (http_slice_equals_nocase(req->method, "POST") && http_slice_equals(req->path, "/ping")) {
+        conn->route = ROUTE_PING;
+        handle_post_ping(conn);
+    }
+    else {
+        send_simple_response(conn, "501 Not Implemented", "text/plain");
+    }
+}
+
+// The ping body is read in full and ignored, the pong goes out once it is in
+static void finish_ping(connection_t *conn, void *ctx) {
+    (void)ctx;
     char response_body[SMALL_BUFFER];
     int response_length = snprintf(response_body, sizeof(response_body),
         "{ \"response\": \"Pong!\" }");
-    send_response(client_socket, "200 OK", "application/json", response_body, response_length);
-}
-
-void generate_directory_listing(const char *dir_path, char *output, size_t output_size) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat file_stat;
-    char full_path[SMALL_BUFFER];
-    char time_str[80];
-    
-    int written = snprintf(output, output_size,
-        "<!DOCTYPE html>\n"
-        "<html>\n"
-        "<head>\n"
-        "<title>Directory listing</title>\n"
-        "<script src=\"https://cdnjs.cloudflare.com/ajax/libs/jquery/3.7.1/jquery.min.js\"></script>\n"
-        "</head>\n"
-        "<body>\n"
-        "<h1>Directory listing for %s</h1>\n"
-        "<table>\n"
-        "<tr><th>Name</th><th>Size</th><th>Last Modified</th></tr>\n",
-    dir_path);
-
-    output += written;
-    output_size -= written;
-
-    dir = opendir(dir_path);
-    if (dir) {
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0) continue;
-            
-            snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-            
-            if (stat(full_path, &file_stat) == 0) {
-                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", 
-                        localtime(&file_stat.st_mtime));
-                
-                if (S_ISDIR(file_stat.st_mode)) {
-                    written = snprintf(output, output_size,
-                        "<tr><td><a href=\"%s/\">%s/</a></td><td>-</td><td>%s</td></tr>\n",
-                        entry->d_name, entry->d_name, time_str);
-                } else {
-                    written = snprintf(output, output_size,
-                        "<tr><td><a href=\"%s\">%s</a></td><td>%ld</td><td>%s</td></tr>\n",
-                        entry->d_name, entry->d_name, file_stat.st_size, time_str);
-                }
-                output += written;
-                output_size -= written;
-            }
+    send_response(conn, "200 OK", "application/json", response_body, response_length);
+}
+
+void handle_post_ping(connection_t *conn) {
+    static const body_reader reader = { .end = finish_ping };
+    connection_read_body(conn, &reader);
+}
+
+void handle_get_metrics(connection_t *conn) {
+    size_t length;
+    char *text = metrics_render(&length);
+    if (!text) {
+        send_simple_response(conn, "500 Internal Server Error", "text/plain");
+        return;
+    }
+
+    response_t res;
+    response_begin(&res, conn, "200 OK");
+    response_header(&res, "Content-Type", "text/plain; version=0.0.4");
+    response_header(&res, "Content-Length", "%zu", length);
+    response_body_ref(&res, text, length, free, text);
+    response_finish(&res);
+}
+
+static void release_fd_entry(void *arg) {
+    fd_cache_release((fd_cache_entry *)arg);
+}
+
+static void release_cache_entry(void *arg) {
+    file_cache_release((file_cache_entry *)arg);
+}
+
+// Validators of one representation, derived from the file it is read from
+typedef struct {
+    char etag[64];
+    char last_modified[32];
+    time_t mtime;
+} file_validators;
+
+// ETag from inode, size and mtime, suffixed with the content coding of encoded variants
+static void make_validators(file_validators *validators, ino_t ino, off_t size,
+                            const struct timespec *mtime, const char *variant) {
+    unsigned long long stamp = (unsigned long long)mtime->tv_sec * 1000000000ull + mtime->tv_nsec;
+    snprintf(validators->etag, sizeof(validators->etag), "\"%lx-%llx-%llx%s%s\"",
+             (unsigned long)ino, (unsigned long long)size, stamp, *variant ? "-" : "", variant);
+
+    struct tm tm;
+    gmtime_r(&mtime->tv_sec, &tm);
+    strftime(validators->last_modified, sizeof(validators->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    validators->mtime = mtime->tv_sec;
+}
+
+// Answer a request whose preconditions match with a body-less 304, returns 0 when a full response is needed
+static int serve_not_modified(connection_t *conn, const http_request_t *req, const file_validators *validators,
+                              const mime_entry *mime) {
+    // If-None-Match takes precedence, If-Modified-Since is only consulted without it
+    const http_slice *if_none_match = http_get_header(req, "If-None-Match");
+    if (if_none_match) {
+        if (!http_etag_matches(if_none_match, validators->etag)) {
+            return 0;
+        }
+    } else {
+        time_t since = http_parse_date(http_get_header(req, "If-Modified-Since"));
+        if (since == -1 || validators->mtime > since) {
+            return 0;
         }
-        closedir(dir);
     }
 
-    snprintf(output, output_size,
-        "</table>\n"
-        "</body>\n"
-        "</html>");
+    response_t res;
+    response_begin(&res, conn, "304 Not Modified");
+    response_header(&res, "ETag", "%s", validators->etag);
+    response_header(&res, "Last-Modified", "%s", validators->last_modified);
+    response_headers(&res, mime->policy_headers, mime->policy_headers_length);
+    response_finish(&res);
+    return 1;
+}
+
+// Render the status line and entity headers of a file response, the part of its head worth caching.
+// The type's Content-Type and caching lines are copied in as rendered at startup
+static int render_file_header(char *header, size_t size, const mime_entry *mime, const char *encoding,
+                              long length, const file_validators *validators) {
+    return snprintf(header, size,
+        "HTTP/1.1 200 OK\r\n"
+        "%s"
+        "Content-Length: %ld\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "ETag: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "%s"
+        "%s%s%s",
+        mime->type_header, length, validators->etag, validators->last_modified, mime->policy_headers,
+        encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "");
+}
+
+// Queue a cached file, its stored head completed in the arena and the body referenced in place.
+// The caller's reference passes to the body segment
+static void queue_cached_file(connection_t *conn, file_cache_entry *entry) {
+    response_t res;
+    response_begin_rendered(&res, conn, entry->header, entry->header_length);
+    response_body_ref(&res, entry->body, entry->body_length, release_cache_entry, entry);
+    response_finish(&res);
+}
+
+// Whether an If-Range condition allows a partial response, it must match the current validators exactly
+static int range_applies(const http_request_t *req, const file_validators *validators) {
+    const http_slice *if_range = http_get_header(req, "If-Range");
+    if (!if_range) {
+        return 1;
+    }
+    if (if_range->length > 0 && (if_range->data[0] == '"' || if_range->data[0] == 'W')) {
+        // Weak tags never match, ours are all strong
+        return http_slice_equals(*if_range, validators->etag);
+    }
+    return http_parse_date(if_range) == validators->mtime;
 }
 
-void serve_static_file(int client_socket, const char *path) {
-    if (strstr(path, "..")) {
-        send_simple_response(client_socket, "400 Bad Request", "text/plain");
+// Queue bytes first to last of a packed body, cached body or open file, each segment holding its own reference
+static void queue_range(response_t *res, const char *packed, file_cache_entry *cached, fd_cache_entry *file,
+                        const http_range *range) {
+    // The body functions drop the reference themselves when they fail
+    size_t length = range->last - range->first + 1;
+    if (packed) {
+        response_body_ref(res, packed + range->first, length, NULL, NULL);
+        return;
+    }
+    if (cached) {
+        file_cache_retain(cached);
+        response_body_ref(res, cached->body + range->first, length, release_cache_entry, cached);
         return;
     }
 
-    char file_path[SMALL_BUFFER] = ROOT_DIR;
-    strcat(file_path, path);
+    fd_cache_retain(file);
+    response_body_file(res, file->fd, file->id, range->first, length, release_fd_entry, file);
+}
+
+// Render the delimiter and headers that open one part of a multipart/byteranges body
+static int render_part_header(char *header, size_t size, const char *boundary, const mime_entry *mime,
+                              const http_range *range, long long total) {
+    return snprintf(header, size,
+        "\r\n--%s\r\n"
+        "%s"
+        "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+        boundary, mime->type_header, range->first, range->last, total);
+}
+
+// Add the validator and caching headers a 206 shares with the full response
+static void range_validators(response_t *res, const file_validators *validators, const mime_entry *mime) {
+    response_header(res, "ETag", "%s", validators->etag);
+    response_header(res, "Last-Modified", "%s", validators->last_modified);
+    response_headers(res, mime->policy_headers, mime->policy_headers_length);
+}
+
+// Answer a Range request with 206 or 416, returns 0 when the whole representation should be sent.
+// The body comes from packed or cached when either is set, otherwise from the open file, and the caller
+// keeps its reference
+static int serve_ranges(connection_t *conn, const http_request_t *req, const file_validators *validators,
+                        const mime_entry *mime, long long total,
+                        const char *packed, file_cache_entry *cached, fd_cache_entry *file) {
+    const http_slice *range_header = http_get_header(req, "Range");
+    if (!range_header || !range_applies(req, validators)) {
+        return 0;
+    }
+
+    http_range ranges[MAX_RANGES];
+    int count = http_parse_ranges(range_header, total, ranges, MAX_RANGES);
+    if (count < 0) {
+        return 0;
+    }
+
+    response_t res;
+    if (count == 0) {
+        response_begin(&res, conn, "416 Range Not Satisfiable");
+        response_header(&res, "Content-Range", "bytes */%lld", total);
+        response_header(&res, "Content-Length", "0");
+        response_finish(&res);
+        return 1;
+    }
+
+    response_begin(&res, conn, "206 Partial Content");
+    if (count == 1) {
+        response_headers(&res, mime->type_header, mime->type_header_length);
+        response_header(&res, "Content-Length", "%lld", ranges[0].last - ranges[0].first + 1);
+        response_header(&res, "Content-Range", "bytes %lld-%lld/%lld", ranges[0].first, ranges[0].last, total);
+        range_validators(&res, validators, mime);
+        queue_range(&res, packed, cached, file, &ranges[0]);
+        response_finish(&res);
+        return 1;
+    }
+
+    static unsigned int boundary_counter;
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%08lx%08x", (unsigned long)time(NULL),
+             __atomic_add_fetch(&boundary_counter, 1, __ATOMIC_RELAXED));
+
+    // Part headers are rendered twice, once to size the body and once to queue them
+    char part[SMALL_BUFFER / 2];
+    long long content_length = 0;
+    for (int i = 0; i < count; i++) {
+        content_length += render_part_header(part, sizeof(part), boundary, mime, &ranges[i], total);
+        content_length += ranges[i].last - ranges[i].first + 1;
+    }
+    char closing[64];
+    int closing_length = snprintf(closing, sizeof(closing), "\r\n--%s--\r\n", boundary);
+    content_length += closing_length;
+
+    response_header(&res, "Content-Type", "multipart/byteranges; boundary=%s", boundary);
+    response_header(&res, "Content-Length", "%lld", content_length);
+    range_validators(&res, validators, mime);
+
+    // Part headers and file data alternate as segments, flushed as one scatter-gather stream
+    for (int i = 0; i < count; i++) {
+        int part_length = render_part_header(part, sizeof(part), boundary, mime, &ranges[i], total);
+        response_body(&res, part, part_length);
+        queue_range(&res, packed, cached, file, &ranges[i]);
+    }
+    response_body(&res, closing, closing_length);
+    response_finish(&res);
+    return 1;
+}
+
+// Serve a cache hit, or a 304 when the client's copy is still current
+static void serve_cached_file(connection_t *conn, const http_request_t *req, file_cache_entry *entry,
+                              const mime_entry *mime) {
+    file_validators validators;
+    make_validators(&validators, entry->ino, entry->size, &entry->mtime, entry->variant);
+    if (serve_not_modified(conn, req, &validators, mime) ||
+        serve_ranges(conn, req, &validators, mime, entry->body_length, NULL, entry, NULL)) {
+        file_cache_release(entry);
+        return;
+    }
+    queue_cached_file(conn, entry);
+}
+
+// Queue an open regular file, through the file cache when it is small enough
+static void queue_file(connection_t *conn, const char *variant, fd_cache_entry *file,
+                       const char *header, size_t header_length) {
+    file_cache_entry *cached = file_cache_insert(file->path, variant, file->fd, &file->st,
+                                                 header, header_length);
+    if (cached) {
+        fd_cache_release(file);
+        queue_cached_file(conn, cached);
+        return;
+    }
+
+    // The segment holds the reference, so the descriptor outlives eviction until sent
+    response_t res;
+    response_begin_rendered(&res, conn, header, header_length);
+    response_body_file(&res, file->fd, file->id, 0, file->st.st_size, release_fd_entry, file);
+    response_finish(&res);
+}
+
+// Serve a precompressed sibling such as app.js.gz, returns 0 when there is none
+static int serve_precompressed(connection_t *conn, const http_request_t *req, const char *file_path,
+                               const char *suffix, const char *encoding, const mime_entry *mime) {
+    char sibling[SMALL_BUFFER];
+    if (snprintf(sibling, sizeof(sibling), "%s%s", file_path, suffix) >= (int)sizeof(sibling)) {
+        return 0;
+    }
+
+    file_cache_entry *cached = file_cache_lookup(sibling, encoding);
+    if (cached) {
+        serve_cached_file(conn, req, cached, mime);
+        return 1;
+    }
+
+    fd_cache_entry *file = fd_cache_open(sibling);
+    if (!file) {
+        return 0;
+    }
+    if (file->fd == -1) {
+        fd_cache_release(file);
+        return 0;
+    }
+
+    file_validators validators;
+    make_validators(&validators, file->st.st_ino, file->st.st_size, &file->st.st_mtim, encoding);
+    if (serve_not_modified(conn, req, &validators, mime)) {
+        fd_cache_release(file);
+        return 1;
+    }
+
+    char header[SMALL_BUFFER];
+    int header_length = render_file_header(header, sizeof(header), mime, encoding, file->st.st_size, &validators);
+    queue_file(conn, encoding, file, header, header_length);
+    return 1;
+}
+
+// Read a whole file into a new buffer
+static char *read_file(int fd, size_t length) {
+    char *buffer = malloc(length);
+    if (!buffer) {
+        return NULL;
+    }
+
+    size_t filled = 0;
+    while (filled < length) {
+        ssize_t bytes = pread(fd, buffer + filled, length - filled, filled);
+        if (bytes <= 0) {
+            free(buffer);
+            return NULL;
+        }
+        filled += bytes;
+    }
+    return buffer;
+}
+
+// Gzip a file once and serve the cached copy, returns 0 to fall back to the identity encoding
+static int serve_gzipped(connection_t *conn, const http_request_t *req, const char *file_path,
+                         const mime_entry *mime) {
+    file_cache_entry *cached = file_cache_lookup(file_path, "gzip");
+    if (cached) {
+        serve_cached_file(conn, req, cached, mime);
+        return 1;
+    }
+
+    fd_cache_entry *file = fd_cache_open(file_path);
+    if (!file) {
+        return 0;
+    }
+    if (file->fd == -1 || file->st.st_size < COMPRESS_MIN_SIZE || file->st.st_size > COMPRESS_MAX_FILE) {
+        fd_cache_release(file);
+        return 0;
+    }
 
-    struct stat path_stat;
-    if (stat(file_path, &path_stat) == -1) {
-        send_simple_response(client_socket, "404 Not Found", "text/plain");
+    // A revalidation must not pay for compressing the file
+    file_validators validators;
+    make_validators(&validators, file->st.st_ino, file->st.st_size, &file->st.st_mtim, "gzip");
+    if (serve_not_modified(conn, req, &validators, mime)) {
+        fd_cache_release(file);
+        return 1;
+    }
+
+    char *source = read_file(file->fd, file->st.st_size);
+    char *compressed = NULL;
+    size_t compressed_length = 0;
+    int result = source ? gzip_compress(source, file->st.st_size, &compressed, &compressed_length) : -1;
+    free(source);
+
+    if (result != 0 || compressed_length >= (size_t)file->st.st_size) {
+        free(compressed);
+        fd_cache_release(file);
+        return 0;
+    }
+
+    char header[SMALL_BUFFER];
+    int header_length = render_file_header(header, sizeof(header), mime, "gzip", compressed_length, &validators);
+    cached = file_cache_store(file_path, "gzip", &file->st, header, header_length, compressed, compressed_length);
+    fd_cache_release(file);
+
+    if (cached) {
+        free(compressed);
+        queue_cached_file(conn, cached);
+        return 1;
+    }
+
+    // Too large for the cache, send this copy and let the segment free it
+    response_t res;
+    response_begin_rendered(&res, conn, header, header_length);
+    response_body_ref(&res, compressed, compressed_length, free, compressed);
+    response_finish(&res);
+    return 1;
+}
+
+// Queue a packed representation, its stored head completed in the arena and the body referenced in the mapping
+static void queue_packed(connection_t *conn, const pack_variant *variant) {
+    response_t res;
+    response_begin_rendered(&res, conn, site_pack_data(variant->head), variant->head_length);
+    response_body_ref(&res, site_pack_data(variant->body), variant->body_length, NULL, NULL);
+    response_finish(&res);
+}
+
+// Serve a decoded path from the site pack. Heads, validators, encoded variants and listings were all
+// prepared by the packer, so the request is answered without touching the filesystem
+static void serve_packed_file(connection_t *conn, const http_request_t *req, const char *path, size_t length) {
+    const pack_entry *entry = site_pack_lookup(path, length);
+    if (!entry) {
+        send_simple_response(conn, "404 Not Found", "text/plain");
+        return;
+    }
+
+    if (entry->flags & PACK_LISTING) {
+        conn->route = ROUTE_LISTING;
+        queue_packed(conn, &entry->variants[PACK_IDENTITY]);
         return;
     }
 
-    if (S_ISDIR(path_stat.st_mode)) {
-        char *listing = malloc(BUFFER_SIZE * 4);
-        if (!listing) {
-            send_simple_response(client_socket, "500 Internal Server Error", "text/plain");
+    // The type's header lines as they were rendered when packing
+    mime_entry mime = {
+        .compressible = (entry->flags & PACK_COMPRESSIBLE) != 0,
+        .type_header = site_pack_data(entry->type_header),
+        .type_header_length = entry->type_header_length,
+        .policy_headers = site_pack_data(entry->policy_headers),
+        .policy_headers_length = entry->policy_headers_length
+    };
+
+    // Brotli, then gzip, as for files on disk, and ranges only from the identity encoding
+    int chosen = PACK_IDENTITY;
+    if (mime.compressible && !http_get_header(req, "Range")) {
+        const http_slice *accept = http_get_header(req, "Accept-Encoding");
+        if (entry->variants[PACK_BR].head_length && http_accepts_coding(accept, "br")) {
+            chosen = PACK_BR;
+        } else if (entry->variants[PACK_GZIP].head_length && http_accepts_coding(accept, "gzip")) {
+            chosen = PACK_GZIP;
+        }
+    }
+    const pack_variant *variant = &entry->variants[chosen];
+
+    file_validators validators;
+    snprintf(validators.etag, sizeof(validators.etag), "%.*s",
+             (int)variant->etag_length, site_pack_data(variant->etag));
+    snprintf(validators.last_modified, sizeof(validators.last_modified), "%s", entry->last_modified);
+    validators.mtime = entry->mtime;
+    if (serve_not_modified(conn, req, &validators, &mime) ||
+        serve_ranges(conn, req, &validators, &mime, variant->body_length, site_pack_data(variant->body),
+                     NULL, NULL)) {
+        return;
+    }
+    queue_packed(conn, variant);
+}
+
+// Listing being streamed to a client, with a copy kept for the cache while it stays small
+typedef struct {
+    connection_t *conn;
+    response_t res;
+    int chunked;
+    int started;                // Head begun, done with the first piece
+    char *copy;                 // NULL once the listing outgrows LISTING_CACHE_MAX
+    size_t copy_length;
+    size_t copy_capacity;
+} listing_stream;
+
+static void keep_listing_copy(listing_stream *stream, const char *data, size_t length) {
+    if (!stream->copy) {
+        return;
+    }
+    if (stream->copy_length + length > LISTING_CACHE_MAX) {
+        free(stream->copy);
+        stream->copy = NULL;
+        return;
+    }
+    if (stream->copy_length + length > stream->copy_capacity) {
+        size_t capacity = stream->copy_capacity * 2;
+        while (capacity < stream->copy_length + length) capacity *= 2;
+        char *grown = realloc(stream->copy, capacity);
+        if (!grown) {
+            free(stream->copy);
+            stream->copy = NULL;
             return;
         }
+        stream->copy = grown;
+        stream->copy_capacity = capacity;
+    }
+    memcpy(stream->copy + stream->copy_length, data, length);
+    stream->copy_length += length;
+}
+
+// Begin the listing response, chunked for HTTP/1.1 clients
+static void begin_listing(listing_stream *stream) {
+    // Without chunked encoding an HTTP/1.0 body ends by closing the connection, an HTTP/2 one with its stream
+    if (!stream->chunked && !stream->conn->h2) {
+        stream->conn->keep_alive = 0;
+    }
+
+    response_begin(&stream->res, stream->conn, "200 OK");
+    response_header(&stream->res, "Content-Type", "text/html");
+    response_header(&stream->res, "Cache-Control", "no-cache");
+    if (stream->chunked) {
+        response_header(&stream->res, "Transfer-Encoding", "chunked");
+    }
+}
+
+// Queue one piece of a listing as it is rendered
+static void queue_listing_chunk(void *arg, const char *data, size_t length) {
+    listing_stream *stream = arg;
+    keep_listing_copy(stream, data, length);
 
-        generate_directory_listing(file_path, listing, BUFFER_SIZE * 4);
-        send_response(client_socket, "200 OK", "text/html", listing, strlen(listing));
-        free(listing);
+    if (!stream->started) {
+        stream->started = 1;
+        begin_listing(stream);
+    }
+    if (stream->res.failed) {
         return;
     }
 
-    int file_fd = open(file_path, O_RDONLY);
-    if (file_fd == -1) {
-        send_simple_response(client_socket, "404 Not Found", "text/plain");
+    if (!stream->chunked) {
+        response_body(&stream->res, data, length);
+        return;
+    }
+
+    // Size line, data and trailing CRLF go out as a single segment
+    char *chunk = connection_alloc(stream->conn, length + 24);
+    if (!chunk) {
+        stream->res.failed = 1;
+        return;
+    }
+    int prefix = snprintf(chunk, 24, "%zx\r\n", length);
+    memcpy(chunk + prefix, data, length);
+    memcpy(chunk + prefix + length, "\r\n", 2);
+    response_body_ref(&stream->res, chunk, prefix + length + 2, NULL, NULL);
+}
+
+// Serve a directory listing, from the cache with one gathered write while the directory is unchanged
+static void serve_directory_listing(connection_t *conn, const http_request_t *req, const char *dir_path) {
+    conn->route = ROUTE_LISTING;
+    file_cache_entry *cached = file_cache_lookup(dir_path, "listing");
+    if (cached) {
+        queue_cached_file(conn, cached);
         return;
     }
 
-    const char *mime_type = get_mime_type(file_path);
-    
+    listing_stream stream = {
+        .conn = conn,
+        .chunked = req->version_major == 1 && req->version_minor >= 1,
+        .started = 0,
+        .copy = malloc(LISTING_CHUNK_SIZE),
+        .copy_length = 0,
+        .copy_capacity = LISTING_CHUNK_SIZE
+    };
+
     struct stat st;
-    fstat(file_fd, &st);
-    long file_size = st.st_size;
+    if (generate_directory_listing(dir_path, &st, queue_listing_chunk, &stream) == -1) {
+        free(stream.copy);
+        send_simple_response(conn, "403 Forbidden", "text/plain");
+        return;
+    }
 
-    char header[SMALL_BUFFER];
-    int header_length = snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
-        "Connection: close\r\n\r\n",
-        mime_type, file_size);
+    // The listing always has at least its opening markup, so the response has been begun
+    static const char last_chunk[] = "0\r\n\r\n";
+    if (stream.chunked) {
+        response_body_ref(&stream.res, last_chunk, sizeof(last_chunk) - 1, NULL, NULL);
+    }
+    response_finish(&stream.res);
+
+    if (stream.copy) {
+        char header[SMALL_BUFFER];
+        int header_length = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/html\r\n"
+            "Content-Length: %zu\r\n"
+            "Cache-Control: no-cache\r\n",
+            stream.copy_length);
+        cached = file_cache_store(dir_path, "listing", &st, header, header_length, stream.copy, stream.copy_length);
+        if (cached) {
+            file_cache_release(cached);
+        }
+        free(stream.copy);
+    }
+}
+
+void serve_static_file(connection_t *conn, const http_request_t *req) {
+    char file_path[SMALL_BUFFER] = ROOT_DIR;
+    size_t root_length = strlen(ROOT_DIR);
+    if (http_decode_path(req->path, file_path + root_length, sizeof(file_path) - root_length) < 0) {
+        send_simple_response(conn, "400 Bad Request", "text/plain");
+        return;
+    }
+
+    if (strstr(file_path, "..")) {
+        send_simple_response(conn, "400 Bad Request", "text/plain");
+        return;
+    }
+
+    // A pack stands in for ROOT_DIR entirely
+    if (site_pack_loaded()) {
+        serve_packed_file(conn, req, file_path + root_length, strlen(file_path + root_length));
+        return;
+    }
+
+    const mime_entry *mime = mime_lookup(file_path);
 
-    send(client_socket, header, header_length, 0);
+    // Prefer brotli, then gzip, when the client takes them. Ranges are only served from the identity encoding
+    if (mime->compressible && !http_get_header(req, "Range")) {
+        const http_slice *accept = http_get_header(req, "Accept-Encoding");
+        if (http_accepts_coding(accept, "br") &&
+            serve_precompressed(conn, req, file_path, ".br", "br", mime)) {
+            return;
+        }
+        if (http_accepts_coding(accept, "gzip") &&
+            (serve_precompressed(conn, req, file_path, ".gz", "gzip", mime) ||
+             serve_gzipped(conn, req, file_path, mime))) {
+            return;
+        }
+    }
+
+    // A cache hit needs no filesystem access at all
+    file_cache_entry *cached = file_cache_lookup(file_path, "");
+    if (cached) {
+        serve_cached_file(conn, req, cached, mime);
+        return;
+    }
+
+    // Stat results, open descriptors and misses come from the descriptor cache
+    fd_cache_entry *file = fd_cache_open(file_path);
+    if (!file) {
+        send_simple_response(conn, "500 Internal Server Error", "text/plain");
+        return;
+    }
 
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes;
-    while ((bytes = read(file_fd, buffer, sizeof(buffer))) > 0) {
-        send(client_socket, buffer, bytes, 0);
+    if (file->missing) {
+        fd_cache_release(file);
+        send_simple_response(conn, "404 Not Found", "text/plain");
+        return;
+    }
+
+    if (S_ISDIR(file->st.st_mode)) {
+        fd_cache_release(file);
+        serve_directory_listing(conn, req, file_path);
+        return;
     }
 
-    close(file_fd);
+    if (file->fd == -1) {
+        fd_cache_release(file);
+        send_simple_response(conn, "404 Not Found", "text/plain");
+        return;
+    }
+
+    file_validators validators;
+    make_validators(&validators, file->st.st_ino, file->st.st_size, &file->st.st_mtim, "");
+    if (serve_not_modified(conn, req, &validators, mime) ||
+        serve_ranges(conn, req, &validators, mime, file->st.st_size, NULL, NULL, file)) {
+        fd_cache_release(file);
+        return;
+    }
+
+    // Compressible types vary on Accept-Encoding even when sent as is
+    char header[SMALL_BUFFER];
+    int header_length = render_file_header(header, sizeof(header), mime, NULL, file->st.st_size, &validators);
+    queue_file(conn, "", file, header, header_length);
 }
\ No newline at end of file
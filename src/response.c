@@ -0,0 +1,178 @@
+#include "response.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#define DATE_LINE_SIZE 48
+
+// Date line of the current second, each thread renders its own copy
+static __thread time_t date_second = -1;
+static __thread char date_line[DATE_LINE_SIZE];
+static __thread size_t date_length;
+
+static const char *current_date_line(size_t *length) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if (ts.tv_sec != date_second) {
+        struct tm tm;
+        gmtime_r(&ts.tv_sec, &tm);
+        date_length = strftime(date_line, sizeof(date_line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        date_second = ts.tv_sec;
+    }
+    *length = date_length;
+    return date_line;
+}
+
+// Make room for length more head bytes, moving the head to a larger arena block when it is full
+static char *reserve_head(response_t *res, size_t length) {
+    if (res->failed) {
+        return NULL;
+    }
+    if (res->length + length > res->capacity) {
+        size_t capacity = res->capacity ? res->capacity * 2 : SMALL_BUFFER;
+        while (capacity < res->length + length) capacity *= 2;
+        char *grown = connection_alloc(res->conn, capacity);
+        if (!grown) {
+            res->failed = 1;
+            return NULL;
+        }
+        if (res->length > 0) {
+            memcpy(grown, res->head, res->length);
+        }
+        res->head = grown;
+        res->capacity = capacity;
+    }
+    return res->head + res->length;
+}
+
+static void append_head(response_t *res, const char *data, size_t length) {
+    char *at = reserve_head(res, length);
+    if (at) {
+        memcpy(at, data, length);
+        res->length += length;
+    }
+}
+
+static void start(response_t *res, connection_t *conn) {
+    res->conn = conn;
+    res->head = NULL;
+    res->length = 0;
+    res->capacity = 0;
+    res->head_sent = 0;
+    res->failed = 0;
+}
+
+void response_begin(response_t *res, connection_t *conn, const char *status) {
+    start(res, conn);
+    append_head(res, "HTTP/1.1 ", 9);
+    append_head(res, status, strlen(status));
+    append_head(res, "\r\n", 2);
+}
+
+void response_begin_rendered(response_t *res, connection_t *conn, const char *head, size_t length) {
+    start(res, conn);
+    append_head(res, head, length);
+}
+
+void response_header(response_t *res, const char *name, const char *format, ...) {
+    size_t name_length = strlen(name);
+    char *at = reserve_head(res, name_length + 2);
+    if (!at) {
+        return;
+    }
+    memcpy(at, name, name_length);
+    memcpy(at + name_length, ": ", 2);
+    res->length += name_length + 2;
+
+    // Values are short, render into what is left and retry once with room when they are not
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = res->capacity - res->length;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(res->head + res->length, room, format, args);
+        va_end(args);
+        if (written < 0) {
+            res->failed = 1;
+            return;
+        }
+        if ((size_t)written + 2 < room) {
+            res->length += written;
+            append_head(res, "\r\n", 2);
+            return;
+        }
+        if (!reserve_head(res, written + 3)) {
+            return;
+        }
+    }
+}
+
+void response_headers(response_t *res, const char *lines, size_t length) {
+    append_head(res, lines, length);
+}
+
+void response_end_head(response_t *res) {
+    if (res->head_sent) {
+        return;
+    }
+    res->head_sent = 1;
+
+    size_t date_length;
+    const char *date = current_date_line(&date_length);
+    append_head(res, date, date_length);
+    if (res->conn->keep_alive) {
+        append_head(res, "Connection: keep-alive\r\n\r\n", 26);
+    } else {
+        append_head(res, "Connection: close\r\n\r\n", 21);
+    }
+
+    // The head already lives in the arena, so it is queued without another copy
+    if (!res->failed && connection_queue_ref(res->conn, res->head, res->length, NULL, NULL) == -1) {
+        res->failed = 1;
+    }
+}
+
+void response_body(response_t *res, const void *data, size_t length) {
+    response_end_head(res);
+    if (!res->failed && connection_queue_data(res->conn, data, length) == -1) {
+        res->failed = 1;
+    }
+}
+
+void response_body_ref(response_t *res, const void *data, size_t length, void (*release)(void *), void *release_arg) {
+    response_end_head(res);
+    if (res->failed) {
+        if (release) {
+            release(release_arg);
+        }
+        return;
+    }
+    if (connection_queue_ref(res->conn, data, length, release, release_arg) == -1) {
+        res->failed = 1;
+    }
+}
+
+void response_body_file(response_t *res, int file_fd, uint64_t file_id, off_t offset, size_t length,
+                        void (*release)(void *), void *release_arg) {
+    response_end_head(res);
+    if (res->failed) {
+        release(release_arg);
+        return;
+    }
+    if (connection_queue_file_ref(res->conn, file_fd, file_id, offset, length, release, release_arg) == -1) {
+        res->failed = 1;
+    }
+}
+
+int response_finish(response_t *res) {
+    response_end_head(res);
+    if (!res->failed) {
+        return 0;
+    }
+
+    // A truncated response must not be followed by the next one on the same connection
+    ERROR("Failed to queue response for %s", res->conn->client_ip);
+    res->conn->keep_alive = 0;
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "site_pack.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static struct {
+    const char *base;
+    size_t size;
+    const pack_header *header;
+    const pack_entry *entries;
+    const uint32_t *slots;
+} pack;
+
+// FNV-1a, as the file cache keys its entries
+uint32_t site_pack_hash(const char *path, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Whether length bytes at offset lie inside the mapping
+static int in_pack(uint64_t offset, uint64_t length) {
+    return offset <= pack.size && length <= pack.size - offset;
+}
+
+int site_pack_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        ERROR("Failed to open site pack %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(pack_header)) {
+        ERROR("Site pack %s is too short", path);
+        close(fd);
+        return -1;
+    }
+
+    // The mapping outlives the descriptor and is never written, pages are shared with the page cache
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        ERROR("Failed to map site pack %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    pack.base = base;
+    pack.size = st.st_size;
+    pack.header = base;
+
+    // Only the header and the index bounds are checked here, so startup doesn't touch every page.
+    // Each entry is checked as it is looked up
+    const pack_header *header = pack.header;
+    uint32_t slot_count = header->slot_count;
+    if (memcmp(header->magic, SITE_PACK_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SITE_PACK_VERSION || header->size != pack.size ||
+        slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || slot_count <= header->entry_count ||
+        header->entries % sizeof(uint64_t) != 0 || header->slots % sizeof(uint32_t) != 0 ||
+        !in_pack(header->entries, (uint64_t)header->entry_count * sizeof(pack_entry)) ||
+        !in_pack(header->slots, (uint64_t)slot_count * sizeof(uint32_t))) {
+        ERROR("%s is not a site pack built by this version", path);
+        site_pack_close();
+        return -1;
+    }
+
+    pack.entries = (const pack_entry *)(pack.base + header->entries);
+    pack.slots = (const uint32_t *)(pack.base + header->slots);
+    INFO("Serving %u paths from site pack %s", header->entry_count, path);
+    return 0;
+}
+
+void site_pack_close(void) {
+    if (pack.base) {
+        munmap((void *)pack.base, pack.size);
+    }
+    memset(&pack, 0, sizeof(pack));
+}
+
+int site_pack_loaded(void) {
+    return pack.base != NULL;
+}
+
+// Whether everything an entry points at lies inside the mapping. The Content-Type line is also
+// rendered with %s, so it has to be terminated
+static int valid_entry(const pack_entry *entry) {
+    if (!in_pack(entry->type_header, (uint64_t)entry->type_header_length + 1) ||
+        pack.base[entry->type_header + entry->type_header_length] != '\0' ||
+        !in_pack(entry->policy_headers, entry->policy_headers_length) ||
+        memchr(entry->last_modified, '\0', sizeof(entry->last_modified)) == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < PACK_VARIANTS; i++) {
+        const pack_variant *variant = &entry->variants[i];
+        if (!in_pack(variant->head, variant->head_length) || !in_pack(variant->etag, variant->etag_length) ||
+            !in_pack(variant->body, variant->body_length)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const pack_entry *site_pack_lookup(const char *path, size_t length) {
+    uint32_t hash = site_pack_hash(path, length);
+    uint32_t mask = pack.header->slot_count - 1;
+
+    // Linear probing, the table is at most half full so a miss ends soon
+    uint32_t slot = hash & mask;
+    for (uint32_t probes = 0; probes <= mask; probes++, slot = (slot + 1) & mask) {
+        uint32_t index = pack.slots[slot];
+        if (index == 0 || index > pack.header->entry_count) {
+            return NULL;
+        }
+
+        const pack_entry *entry = &pack.entries[index - 1];
+        if (entry->hash != hash || entry->path_length != length || !in_pack(entry->path, length) ||
+            memcmp(pack.base + entry->path, path, length) != 0) {
+            continue;
+        }
+        if (!valid_entry(entry)) {
+            WARN("Site pack entry for %.*s is out of bounds", (int)length, path);
+            return NULL;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+const char *site_pack_data(uint64_t offset) {
+    return pack.base + offset;
+}
\ No newline at end of file
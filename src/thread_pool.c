@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include "thread_pool.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    int client_fd;
+    struct sockaddr_in client_addr;
+} pool_item;
+
+// Bounded FIFO of accepted sockets, filled by the accept thread and drained by the workers
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pool_item *items;
+    int capacity;
+    int head;                   // Next item to hand out
+    int count;
+    int busy;
+    thread_pool_handler handler;
+} pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER
+};
+
+static void *pool_worker(void *arg) {
+    char name[16];
+    snprintf(name, sizeof(name), "web-pool-%d", (int)(long)arg);
+    pthread_setname_np(pthread_self(), name);
+
+    while (1) {
+        pthread_mutex_lock(&pool.mutex);
+        while (pool.count == 0) {
+            pthread_cond_wait(&pool.not_empty, &pool.mutex);
+        }
+        pool_item item = pool.items[pool.head];
+        pool.head = (pool.head + 1) % pool.capacity;
+        pool.count--;
+        pool.busy++;
+        pthread_mutex_unlock(&pool.mutex);
+
+        pool.handler(item.client_fd, &item.client_addr);
+
+        pthread_mutex_lock(&pool.mutex);
+        pool.busy--;
+        pthread_mutex_unlock(&pool.mutex);
+    }
+
+    return NULL;
+}
+
+int thread_pool_init(int threads, int capacity, thread_pool_handler handler) {
+    pool.items = calloc(capacity, sizeof(pool_item));
+    if (!pool.items) {
+        ERROR("Failed to allocate a thread pool queue of %d connections", capacity);
+        return -1;
+    }
+    pool.capacity = capacity;
+    pool.head = 0;
+    pool.count = 0;
+    pool.busy = 0;
+    pool.handler = handler;
+
+    // Workers run for the life of the process
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, pool_worker, (void *)(long)i) != 0) {
+            WARN("Failed to start pool thread %d", i);
+            continue;
+        }
+        pthread_detach(tid);
+        started++;
+    }
+
+    if (started == 0) {
+        ERROR("No pool threads could be started");
+        return -1;
+    }
+
+    INFO("Started %d pool threads with room for %d queued connections", started, capacity);
+    return 0;
+}
+
+int thread_pool_submit(int client_fd, const struct sockaddr_in *client_addr) {
+    pthread_mutex_lock(&pool.mutex);
+    if (pool.count == pool.capacity) {
+        pthread_mutex_unlock(&pool.mutex);
+        return -1;
+    }
+
+    pool_item *item = &pool.items[(pool.head + pool.count) % pool.capacity];
+    item->client_fd = client_fd;
+    item->client_addr = *client_addr;
+    pool.count++;
+    pthread_cond_signal(&pool.not_empty);
+    pthread_mutex_unlock(&pool.mutex);
+    return 0;
+}
+
+int thread_pool_depth(void) {
+    pthread_mutex_lock(&pool.mutex);
+    int depth = pool.count;
+    pthread_mutex_unlock(&pool.mutex);
+    return depth;
+}
+
+int thread_pool_busy(void) {
+    pthread_mutex_lock(&pool.mutex);
+    int busy = pool.busy;
+    pthread_mutex_unlock(&pool.mutex);
+    return busy;
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_SLOT_BITS)
+#define MAX_DELAY ((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now) {
+    wheel->now = now;
+    wheel->count = 0;
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+}
+
+void timer_init(timer_entry *timer, void *data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->data = data;
+}
+
+int timer_pending(const timer_entry *timer) {
+    return timer->pprev != NULL;
+}
+
+static void unlink_timer(timer_entry *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// File the timer by how far it is from base, the next tick whose slot will be processed: the
+// lowest level whose span covers the distance, in the slot the expiry falls in at its resolution
+static void link_timer(timer_wheel_t *wheel, timer_entry *timer, uint64_t base) {
+    uint64_t delay = timer->expires > base ? timer->expires - base : 0;
+    if (delay > MAX_DELAY) {
+        timer->expires = base + MAX_DELAY;
+        delay = MAX_DELAY;
+    }
+
+    // Overdue timers fire with the next slot
+    uint64_t expires = base + delay;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delay >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+
+    timer_entry **slot = &wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+void timer_schedule(timer_wheel_t *wheel, timer_entry *timer, uint64_t expires) {
+    if (timer_pending(timer)) {
+        unlink_timer(timer);
+    } else {
+        wheel->count++;
+    }
+    timer->expires = expires;
+    link_timer(wheel, timer, wheel->now + 1);
+}
+
+void timer_cancel(timer_wheel_t *wheel, timer_entry *timer) {
+    if (timer_pending(timer)) {
+        unlink_timer(timer);
+        wheel->count--;
+    }
+}
+
+// Spread a coarse slot's timers over the levels below now that it has come around. The current
+// tick's own slot is yet to be processed, so timers due at it still fire on time
+static void cascade(timer_wheel_t *wheel, int level) {
+    timer_entry **slot = &wheel->slots[level][(wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK];
+    timer_entry *timer = *slot;
+    *slot = NULL;
+    while (timer) {
+        timer_entry *next = timer->next;
+        link_timer(wheel, timer, wheel->now);
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now, void (*expire)(void *data, void *arg), void *arg) {
+    while (wheel->now < now) {
+        // With nothing scheduled there is nothing to step through
+        if (wheel->count == 0) {
+            wheel->now = now;
+            return;
+        }
+
+        wheel->now++;
+        for (int level = 1; level < TIMER_LEVELS; level++) {
+            if ((wheel->now & ((1ULL << LEVEL_SHIFT(level)) - 1)) != 0) {
+                break;
+            }
+            cascade(wheel, level);
+        }
+
+        timer_entry **slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+        while (*slot) {
+            timer_entry *timer = *slot;
+            unlink_timer(timer);
+            wheel->count--;
+            expire(timer->data, arg);
+        }
+    }
+}
\ No newline at end of file
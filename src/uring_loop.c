@@ -0,0 +1,752 @@
+#define _GNU_SOURCE
+#include "uring_loop.h"
+#include "config.h"
+#include "connection.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#define IOV_BATCH 16
+#define SPARE_FILE_BUFFERS 16
+#define CQ_ENTRIES (URING_ENTRIES * 8)
+#define BUFFER_GROUP 0
+
+// Operation encoded in the low bits of user_data, the rest is the connection
+#define OP_ACCEPT 1
+#define OP_RECV 2
+#define OP_SEND 3
+#define OP_READ 4
+#define OP_CLOSE 5
+#define OP_MASK 7
+
+// Connection with the state of the operations it has in flight
+typedef struct uring_conn {
+    connection_t *conn;
+    int pending;                // Completions still to come, nothing new is submitted until 0
+    int closing;                // Shut down while operations were in flight
+    int plain_recv;             // Provided buffers ran out, receive straight into the input buffer once
+    int recv_result;
+    unsigned recv_flags;
+    int read_result;
+    size_t read_length;         // Bytes asked of the file read ahead of the send, 0 without one
+    int send_result;
+    int close_result;           // 1 when no close was linked
+    struct msghdr msg;
+    struct iovec iov[IOV_BATCH];
+    char *file_buffer;          // URING_FILE_CHUNK bytes, held from the first file segment until the queue drains
+} uring_conn;
+
+typedef struct {
+    int ring_fd;
+    int listen_fd;
+
+    // Submission queue, sqe_tail runs ahead of the shared tail until submitted
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;
+    unsigned submitted;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    // Provided receive buffers
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned short buf_tail;
+
+    // Registered files, direct mapped by descriptor cache id
+    int files_registered;
+    uint64_t file_ids[URING_FILE_SLOTS];
+
+    timer_wheel_t timers;       // Every connection's deadline, the timer's data is the uring_conn
+
+    // File buffers given back by connections that went idle
+    char *spare_files[SPARE_FILE_BUFFERS];
+    int spare_file_count;
+} uring_loop;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                              const void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_teardown(uring_loop *loop) {
+    while (loop->spare_file_count > 0) {
+        free(loop->spare_files[--loop->spare_file_count]);
+    }
+    if (loop->buffers) {
+        munmap(loop->buffers, (size_t)URING_BUFFERS * BUFFER_SIZE);
+    }
+    if (loop->buf_ring) {
+        munmap(loop->buf_ring, loop->buf_ring_size);
+    }
+    if (loop->sqes) {
+        munmap(loop->sqes, loop->sqes_size);
+    }
+    if (loop->cq_ring && loop->cq_ring != loop->sq_ring) {
+        munmap(loop->cq_ring, loop->cq_ring_size);
+    }
+    if (loop->sq_ring) {
+        munmap(loop->sq_ring, loop->sq_ring_size);
+    }
+    if (loop->ring_fd != -1) {
+        close(loop->ring_fd);
+    }
+}
+
+// Hand a receive buffer back to the kernel
+static void recycle_buffer(uring_loop *loop, unsigned short bid) {
+    struct io_uring_buf *buf = &loop->buf_ring->bufs[loop->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->buffers + (size_t)bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int setup_buffers(uring_loop *loop) {
+    loop->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    loop->buf_ring = mmap(NULL, loop->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->buf_ring == MAP_FAILED) {
+        loop->buf_ring = NULL;
+        return -1;
+    }
+    loop->buffers = mmap(NULL, (size_t)URING_BUFFERS * BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (loop->buffers == MAP_FAILED) {
+        loop->buffers = NULL;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)loop->buf_ring,
+        .ring_entries = URING_BUFFERS,
+        .bgid = BUFFER_GROUP
+    };
+    if (sys_io_uring_register(loop->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        return -1;
+    }
+
+    loop->buf_tail = 0;
+    for (unsigned i = 0; i < URING_BUFFERS; i++) {
+        recycle_buffer(loop, i);
+    }
+    return 0;
+}
+
+// Create the rings and register buffers and file slots, returns -1 if the kernel lacks a feature
+static int uring_setup(uring_loop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->ring_fd = -1;
+
+    // Only the loop thread submits, so the kernel can skip cross-thread wakeups
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = CQ_ENTRIES;
+    loop->ring_fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (loop->ring_fd == -1 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = CQ_ENTRIES;
+        loop->ring_fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    }
+    if (loop->ring_fd == -1) {
+        return -1;
+    }
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    loop->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loop->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (loop->cq_ring_size > loop->sq_ring_size) {
+        loop->sq_ring_size = loop->cq_ring_size;
+    }
+    loop->sq_ring = mmap(NULL, loop->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         loop->ring_fd, IORING_OFF_SQ_RING);
+    if (loop->sq_ring == MAP_FAILED) {
+        loop->sq_ring = NULL;
+        return -1;
+    }
+    loop->cq_ring = loop->sq_ring;
+
+    loop->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      loop->ring_fd, IORING_OFF_SQES);
+    if (loop->sqes == MAP_FAILED) {
+        loop->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = loop->sq_ring;
+    loop->sq_head = (unsigned *)(sq + params.sq_off.head);
+    loop->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    loop->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    loop->sq_entries = params.sq_entries;
+    loop->sqe_tail = *loop->sq_tail;
+    loop->submitted = loop->sqe_tail;
+
+    // Slot i of the submission array always names sqe i
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    char *cq = loop->cq_ring;
+    loop->cq_head = (unsigned *)(cq + params.cq_off.head);
+    loop->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    loop->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    if (setup_buffers(loop) == -1) {
+        return -1;
+    }
+
+    // Files are optional, without slots they are read through their plain descriptor
+    struct io_uring_rsrc_register files = {
+        .nr = URING_FILE_SLOTS,
+        .flags = IORING_RSRC_REGISTER_SPARSE
+    };
+    loop->files_registered =
+        sys_io_uring_register(loop->ring_fd, IORING_REGISTER_FILES2, &files, sizeof(files)) == 0;
+    return 0;
+}
+
+int uring_loop_available(void) {
+    uring_loop *loop = malloc(sizeof(uring_loop));
+    if (!loop) {
+        return 0;
+    }
+
+    int available = uring_setup(loop) == 0;
+    if (!available) {
+        DEBUG("io_uring setup failed: %s", strerror(errno));
+    }
+    uring_teardown(loop);
+    free(loop);
+    return available;
+}
+
+// Pass queued submissions to the kernel, optionally waiting for a completion
+static int submit(uring_loop *loop, unsigned wait, const struct __kernel_timespec *timeout) {
+    __atomic_store_n(loop->sq_tail, loop->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg = {
+        .ts = (uint64_t)(uintptr_t)timeout
+    };
+    const void *arg_ptr = NULL;
+    size_t arg_size = 0;
+    if (timeout) {
+        flags |= IORING_ENTER_EXT_ARG;
+        arg_ptr = &arg;
+        arg_size = sizeof(arg);
+    }
+
+    int result = sys_io_uring_enter(loop->ring_fd, loop->sqe_tail - loop->submitted, wait, flags, arg_ptr, arg_size);
+    if (result > 0) {
+        loop->submitted += result;
+    }
+    return result;
+}
+
+// Get count consecutive sqes, submitting first if the queue is too full so a linked chain stays together
+static struct io_uring_sqe *reserve(uring_loop *loop, unsigned count) {
+    unsigned head = __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+    if (loop->sqe_tail - head + count > loop->sq_entries) {
+        if (submit(loop, 0, NULL) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+        if (loop->sqe_tail - head + count > loop->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *first = NULL;
+    for (unsigned i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = &loop->sqes[loop->sqe_tail & loop->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        loop->sqe_tail++;
+        if (!first) {
+            first = sqe;
+        }
+    }
+    return first;
+}
+
+// The sqe after one returned by reserve, the ring may wrap between them
+static struct io_uring_sqe *next_sqe(uring_loop *loop, struct io_uring_sqe *sqe) {
+    return &loop->sqes[(sqe - loop->sqes + 1) & loop->sq_mask];
+}
+
+static uint64_t tag(uring_conn *uc, int op) {
+    return (uint64_t)(uintptr_t)uc | op;
+}
+
+// Keep a connection's file buffer for the next one that needs it
+static void put_file_buffer(uring_loop *loop, uring_conn *uc) {
+    if (!uc->file_buffer) {
+        return;
+    }
+    if (loop->spare_file_count < SPARE_FILE_BUFFERS) {
+        loop->spare_files[loop->spare_file_count++] = uc->file_buffer;
+    } else {
+        free(uc->file_buffer);
+    }
+    uc->file_buffer = NULL;
+}
+
+static void destroy_connection(uring_loop *loop, uring_conn *uc) {
+    timer_cancel(&loop->timers, &uc->conn->timer);
+    connection_destroy(uc->conn);
+    put_file_buffer(loop, uc);
+    free(uc);
+}
+
+// Close now, or once the operations in flight have been cut short by the shutdown
+static void close_connection(uring_loop *loop, uring_conn *uc) {
+    if (uc->pending == 0) {
+        destroy_connection(loop, uc);
+        return;
+    }
+    if (!uc->closing) {
+        uc->closing = 1;
+        timer_cancel(&loop->timers, &uc->conn->timer);
+        shutdown(uc->conn->fd, SHUT_RDWR);
+    }
+}
+
+static void arm_accept(uring_loop *loop) {
+    struct io_uring_sqe *sqe = reserve(loop, 1);
+    if (!sqe) {
+        ERROR("No submission slot for accept");
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static int arm_recv(uring_loop *loop, uring_conn *uc, size_t space) {
+    connection_t *conn = uc->conn;
+    char *input = uc->plain_recv ? connection_input(conn) : NULL;
+    if (uc->plain_recv && !input) {
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = reserve(loop, 1);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    if (uc->plain_recv) {
+        sqe->addr = (uint64_t)(uintptr_t)input;
+        sqe->len = space;
+    } else {
+        // The kernel picks a buffer only once data arrives, idle connections hold none
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->len = space < BUFFER_SIZE ? space : BUFFER_SIZE;
+    }
+    sqe->user_data = tag(uc, OP_RECV);
+    uc->pending = 1;
+    uc->recv_flags = 0;
+    return 0;
+}
+
+// Registered slot for a descriptor cache file, registering it on first use, or -1 to use file_fd
+static int file_slot(uring_loop *loop, const out_segment *seg) {
+    if (!loop->files_registered || seg->file_id == 0) {
+        return -1;
+    }
+
+    int slot = seg->file_id % URING_FILE_SLOTS;
+    if (loop->file_ids[slot] != seg->file_id) {
+        // Replacing the slot drops the ring's reference to the file registered there before
+        int fd = seg->fd;
+        struct io_uring_files_update update = {
+            .offset = slot,
+            .fds = (uint64_t)(uintptr_t)&fd
+        };
+        if (sys_io_uring_register(loop->ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+            return -1;
+        }
+        loop->file_ids[slot] = seg->file_id;
+    }
+    return slot;
+}
+
+static void link_close(struct io_uring_sqe *sqe, uring_conn *uc) {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = uc->conn->fd;
+    sqe->user_data = tag(uc, OP_CLOSE);
+}
+
+// Send the front of the queue: a run of memory segments with one sendmsg, or a file chunk read and
+// sent as a linked pair. The last send of a closing connection carries the close with it
+static int arm_send(uring_loop *loop, uring_conn *uc) {
+    connection_t *conn = uc->conn;
+    out_segment *seg = conn->out_head;
+    uc->read_result = 0;
+    uc->read_length = 0;
+    uc->send_result = 0;
+    uc->close_result = 1;
+
+    if (seg->type == OUT_MEMORY) {
+        int iovcnt = 0;
+        out_segment *s = seg;
+        for (; s && s->type == OUT_MEMORY && iovcnt < IOV_BATCH; s = s->next) {
+            uc->iov[iovcnt].iov_base = (void *)s->data;
+            uc->iov[iovcnt].iov_len = s->remaining;
+            iovcnt++;
+        }
+        int last = connection_closing(conn) && !s;
+
+        struct io_uring_sqe *sqe = reserve(loop, last ? 2 : 1);
+        if (!sqe) {
+            return -1;
+        }
+        memset(&uc->msg, 0, sizeof(uc->msg));
+        uc->msg.msg_iov = uc->iov;
+        uc->msg.msg_iovlen = iovcnt;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd;
+        sqe->addr = (uint64_t)(uintptr_t)&uc->msg;
+        sqe->len = 1;
+        // Hold the header back so it leaves in the same segment as the file's first bytes
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (s ? MSG_MORE : 0);
+        sqe->user_data = tag(uc, OP_SEND);
+        uc->pending = 1;
+        if (last) {
+            sqe->flags |= IOSQE_IO_LINK;
+            link_close(next_sqe(loop, sqe), uc);
+            uc->pending = 2;
+        }
+        return 0;
+    }
+
+    if (!uc->file_buffer) {
+        uc->file_buffer = loop->spare_file_count > 0 ? loop->spare_files[--loop->spare_file_count]
+                                                     : malloc(URING_FILE_CHUNK);
+        if (!uc->file_buffer) {
+            return -1;
+        }
+    }
+
+    size_t chunk = seg->remaining < URING_FILE_CHUNK ? seg->remaining : URING_FILE_CHUNK;
+    int more = chunk < seg->remaining || seg->next;
+    int last = connection_closing(conn) && !more;
+    int slot = file_slot(loop, seg);
+
+    struct io_uring_sqe *read = reserve(loop, last ? 3 : 2);
+    if (!read) {
+        return -1;
+    }
+    read->opcode = IORING_OP_READ;
+    read->fd = slot >= 0 ? slot : seg->fd;
+    read->flags = IOSQE_IO_LINK | (slot >= 0 ? IOSQE_FIXED_FILE : 0);
+    read->addr = (uint64_t)(uintptr_t)uc->file_buffer;
+    read->len = chunk;
+    read->off = seg->offset;
+    read->user_data = tag(uc, OP_READ);
+
+    // A short read fails the link, so the send never goes out with bytes that weren't read
+    struct io_uring_sqe *send = next_sqe(loop, read);
+    send->opcode = IORING_OP_SEND;
+    send->fd = conn->fd;
+    send->addr = (uint64_t)(uintptr_t)uc->file_buffer;
+    send->len = chunk;
+    send->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (more ? MSG_MORE : 0);
+    send->user_data = tag(uc, OP_SEND);
+
+    uc->read_length = chunk;
+    uc->pending = 2;
+    if (last) {
+        send->flags |= IOSQE_IO_LINK;
+        link_close(next_sqe(loop, send), uc);
+        uc->pending = 3;
+    }
+    return 0;
+}
+
+// Submit the next operation for a connection, mirroring the epoll loop's state machine
+static void drive_connection(uring_loop *loop, uring_conn *uc) {
+    connection_t *conn = uc->conn;
+
+    for (;;) {
+        if (conn->state == CONN_READING) {
+            size_t space = connection_prepare_read(conn);
+            if (space > 0) {
+                put_file_buffer(loop, uc);
+                if (arm_recv(loop, uc, space) == -1) {
+                    ERROR("Failed to submit receive for %s", conn->client_ip);
+                    close_connection(loop, uc);
+                    return;
+                }
+                connection_watch(conn, &loop->timers);
+                return;
+            }
+        } else if (conn->state == CONN_WRITING && conn->out_head) {
+            if (arm_send(loop, uc) == -1) {
+                ERROR("Failed to submit send for %s", conn->client_ip);
+                close_connection(loop, uc);
+                return;
+            }
+            connection_watch(conn, &loop->timers);
+            return;
+        } else if (conn->state == CONN_WRITING) {
+            // Nothing left to send, only moves the state on
+            connection_flush(conn);
+        } else {
+            close_connection(loop, uc);
+            return;
+        }
+    }
+}
+
+static void finish_recv(uring_loop *loop, uring_conn *uc) {
+    connection_t *conn = uc->conn;
+    int result = uc->recv_result;
+
+    if (uc->recv_flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = uc->recv_flags >> IORING_CQE_BUFFER_SHIFT;
+        char *input = result > 0 ? connection_input(conn) : NULL;
+        if (input) {
+            memcpy(input, loop->buffers + (size_t)bid * BUFFER_SIZE, result);
+        }
+        recycle_buffer(loop, bid);
+        if (result > 0 && !input) {
+            ERROR("Failed to allocate an input buffer for %s", conn->client_ip);
+            close_connection(loop, uc);
+            return;
+        }
+    } else if (uc->plain_recv && result != -ENOBUFS) {
+        uc->plain_recv = 0;
+    }
+
+    if (result > 0) {
+        connection_received(conn, result);
+        drive_connection(loop, uc);
+        return;
+    }
+
+    if (result == -ENOBUFS) {
+        uc->plain_recv = 1;
+        drive_connection(loop, uc);
+        return;
+    }
+    if (result == -EINTR || result == -EAGAIN) {
+        drive_connection(loop, uc);
+        return;
+    }
+    if (result < 0 && result != -ECONNRESET) {
+        ERROR("Failed to receive data from client %s: %s", conn->client_ip, strerror(-result));
+    }
+    close_connection(loop, uc);
+}
+
+static void finish_send(uring_loop *loop, uring_conn *uc) {
+    connection_t *conn = uc->conn;
+
+    if (uc->read_length > 0 && uc->read_result != (int)uc->read_length) {
+        // File shrank underneath us or can't be read, the promised length can't be delivered
+        int error = uc->read_result < 0 ? -uc->read_result : EIO;
+        ERROR("Failed to send response to client %s: %s", conn->client_ip, strerror(error));
+        close_connection(loop, uc);
+        return;
+    }
+
+    if (uc->send_result > 0) {
+        connection_sent(conn, uc->send_result);
+    } else if (uc->send_result != -EINTR && uc->send_result != -EAGAIN) {
+        if (uc->send_result != -EPIPE && uc->send_result != -ECONNRESET) {
+            ERROR("Failed to send response to client %s: %s", conn->client_ip, strerror(-uc->send_result));
+        }
+        close_connection(loop, uc);
+        return;
+    }
+
+    if (uc->close_result == 0) {
+        // The linked close already released the socket
+        conn->fd = -1;
+        destroy_connection(loop, uc);
+        return;
+    }
+
+    drive_connection(loop, uc);
+}
+
+static void handle_accept(uring_loop *loop, const struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // The multishot accept ended, usually after an error, and has to be armed again
+        arm_accept(loop);
+    }
+
+    if (cqe->res < 0) {
+        if (cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+            ERROR("accept failed: %s", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int client_fd = cqe->res;
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    if (getpeername(client_fd, (struct sockaddr *)&client_addr, &addr_len) == -1) {
+        memset(&client_addr, 0, sizeof(client_addr));
+    }
+
+    connection_t *conn = connection_create(client_fd, &client_addr);
+    uring_conn *uc = calloc(1, sizeof(uring_conn));
+    if (!conn || !uc) {
+        ERROR("Failed to allocate connection");
+        if (conn) {
+            connection_destroy(conn);
+        } else {
+            close(client_fd);
+        }
+        free(uc);
+        return;
+    }
+    uc->conn = conn;
+    // Expiry needs the uring_conn, the connection only knows itself
+    conn->timer.data = uc;
+
+    DEBUG("New connection from %s", conn->client_ip);
+    drive_connection(loop, uc);
+}
+
+static void handle_completion(uring_loop *loop, const struct io_uring_cqe *cqe) {
+    int op = cqe->user_data & OP_MASK;
+    if (op == OP_ACCEPT) {
+        handle_accept(loop, cqe);
+        return;
+    }
+
+    uring_conn *uc = (uring_conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+    switch (op) {
+    case OP_RECV:
+        uc->recv_result = cqe->res;
+        uc->recv_flags = cqe->flags;
+        break;
+    case OP_READ:
+        uc->read_result = cqe->res;
+        break;
+    case OP_SEND:
+        uc->send_result = cqe->res;
+        break;
+    case OP_CLOSE:
+        uc->close_result = cqe->res;
+        break;
+    }
+
+    // Act once the whole chain has completed
+    if (--uc->pending > 0) {
+        return;
+    }
+
+    if (uc->closing) {
+        if (op == OP_RECV && (uc->recv_flags & IORING_CQE_F_BUFFER)) {
+            recycle_buffer(loop, uc->recv_flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        if (uc->close_result == 0) {
+            uc->conn->fd = -1;
+        }
+        destroy_connection(loop, uc);
+        return;
+    }
+
+    if (op == OP_RECV) {
+        finish_recv(loop, uc);
+    } else {
+        finish_send(loop, uc);
+    }
+}
+
+static void expire_connection(void *data, void *arg) {
+    uring_conn *uc = data;
+    connection_expired(uc->conn);
+    close_connection(arg, uc);
+}
+
+int uring_loop_run(int listen_fd) {
+    uring_loop *loop = malloc(sizeof(uring_loop));
+    if (!loop) {
+        perror("malloc failed");
+        return EXIT_FAILURE;
+    }
+    if (uring_setup(loop) == -1) {
+        ERROR("Failed to set up io_uring: %s", strerror(errno));
+        uring_teardown(loop);
+        free(loop);
+        return EXIT_FAILURE;
+    }
+
+    loop->listen_fd = listen_fd;
+    timer_wheel_init(&loop->timers, connection_clock());
+    if (!loop->files_registered) {
+        WARN("io_uring file registration unavailable, files are read through their descriptors");
+    }
+    arm_accept(loop);
+
+    // Wake every tick to close connections past their deadlines
+    struct __kernel_timespec timeout = { .tv_sec = 0, .tv_nsec = TIMER_TICK_MS * 1000000L };
+    while (1) {
+        if (submit(loop, 1, &timeout) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter failed");
+            break;
+        }
+
+        unsigned head = *loop->cq_head;
+        while (head != __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = loop->cqes[head & loop->cq_mask];
+            // Release the entry before handling it, handlers may submit and wait for room
+            __atomic_store_n(loop->cq_head, ++head, __ATOMIC_RELEASE);
+            handle_completion(loop, &cqe);
+        }
+
+        timer_wheel_advance(&loop->timers, connection_clock(), expire_connection, loop);
+    }
+
+    uring_teardown(loop);
+    free(loop);
+    return EXIT_FAILURE;
+}
\ No newline at end of file
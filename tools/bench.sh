@@ -0,0 +1,99 @@
+#!/bin/bash
+# Benchmark a local web instance in each server mode against a generated fixture tree, then the
+# microbenchmarks. Every result is one JSON object per line on stdout, load results carry their mode.
+# Run from the repository root, usually via `make bench`.
+set -eu -o pipefail
+
+DURATION=${BENCH_DURATION:-5}
+CONNECTIONS=${BENCH_CONNECTIONS:-64}
+THREADS=${BENCH_THREADS:-2}
+MODES=${BENCH_MODES:-epoll uring threaded}
+PORT=8080
+FIXTURES=www/bench
+
+# Fixed fixture tree: small files, a large file and a directory to list
+make_fixtures() {
+    [ -f "$FIXTURES/.complete" ] && return
+    rm -rf "$FIXTURES"
+    mkdir -p "$FIXTURES/small" "$FIXTURES/dir"
+    i=0
+    while [ $i -lt 64 ]; do
+        head -c 1024 /dev/zero | tr '\0' "$(printf '\\%03o' $((97 + i % 26)))" > "$FIXTURES/small/$i.txt"
+        i=$((i + 1))
+    done
+    head -c $((16 * 1024 * 1024)) /dev/urandom > "$FIXTURES/large.bin"
+    i=0
+    while [ $i -lt 500 ]; do
+        : > "$FIXTURES/dir/entry-$i.dat"
+        i=$((i + 1))
+    done
+    touch "$FIXTURES/.complete"
+}
+
+wait_for_server() {
+    tries=0
+    until (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; do
+        tries=$((tries + 1))
+        if [ $tries -gt 50 ]; then
+            echo "web did not start listening on port $PORT" >&2
+            return 1
+        fi
+        sleep 0.1
+    done
+}
+
+# Listeners are bound with SO_REUSEPORT, and an io_uring server's socket can outlive its process
+# for a moment. The next server would share the port with it, so wait until nothing accepts
+wait_for_port_free() {
+    tries=0
+    while (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; do
+        tries=$((tries + 1))
+        if [ $tries -gt 50 ]; then
+            echo "Port $PORT still accepts connections after web stopped" >&2
+            return 1
+        fi
+        sleep 0.1
+    done
+}
+
+make_fixtures
+
+if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+    echo "Port $PORT is already in use, stop the running server first" >&2
+    exit 1
+fi
+
+SMALL=""
+i=0
+while [ $i -lt 64 ]; do
+    SMALL="$SMALL /bench/small/$i.txt"
+    i=$((i + 1))
+done
+
+run() {
+    ./loadgen -t "$THREADS" -d "$DURATION" "$@" | sed "s/^{/{\"mode\":\"$MODE\",/"
+}
+
+# A uring run falls back to epoll with a warning when the kernel has no io_uring
+for MODE in $MODES; do
+    # Connections are kept for the whole run and request logging is left out of the measurement
+    env SERVER_MODE="$MODE" KEEPALIVE_MAX_REQUESTS=1000000000 KEEPALIVE_TIMEOUT=60 LOG_LEVEL=${LOG_LEVEL:-WARN} ./web &
+    SERVER=$!
+    trap 'kill $SERVER 2>/dev/null' EXIT INT TERM
+    wait_for_server
+
+    # shellcheck disable=SC2086
+    run -n small -c "$CONNECTIONS" $SMALL
+    # shellcheck disable=SC2086
+    run -n small_pipelined -c "$CONNECTIONS" -P 16 $SMALL
+    run -n large -c 8 /bench/large.bin
+    run -n directory -c "$CONNECTIONS" /bench/dir/
+    run -n ping -c "$CONNECTIONS" "POST /ping"
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null || true
+    trap - EXIT INT TERM
+    wait_for_port_free
+done
+
+./microbench "${BENCH_OPS:-1000000}"
\ No newline at end of file
@@ -0,0 +1,573 @@
+// Closed-loop HTTP load generator: keep-alive connections on epoll, each with a fixed number of requests in flight
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_TARGETS 64
+#define MAX_PIPELINE 64
+#define HEAD_MAX 8192
+#define OUT_MAX (64 * 1024)
+#define READ_CHUNK (256 * 1024)
+
+// Log-linear latency buckets in nanoseconds, 32 per power of two (3% precision)
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS 2048
+
+typedef enum {
+    READ_HEAD,          // Collecting the status line and headers
+    READ_BODY,          // Skipping a Content-Length body
+    READ_CHUNK_SIZE,    // Reading a chunk size line
+    READ_CHUNK_DATA,    // Skipping chunk data and its CRLF
+    READ_TRAILER,       // Skipping trailer lines up to the blank one
+    READ_UNTIL_CLOSE    // Body delimited by the connection closing
+} read_state_t;
+
+typedef struct {
+    const char *request;
+    size_t length;
+} target;
+
+typedef struct {
+    int fd;
+    int connected;
+    int want_write;
+    size_t next_target;
+    char out[OUT_MAX];
+    size_t out_len;
+    size_t out_sent;
+    long long sent_at[MAX_PIPELINE];    // Ring of send times for requests in flight
+    int in_flight;
+    int oldest;
+    read_state_t state;
+    char head[HEAD_MAX];
+    size_t head_len;
+    long long remaining;
+    size_t line_len;
+    int status;
+    int close_after;
+} client;
+
+typedef struct {
+    pthread_t thread;
+    int epoll_fd;
+    client *clients;
+    int client_count;
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long reconnects;
+    unsigned long long bytes;
+    unsigned long long statuses[6];
+    unsigned long long histogram[HISTOGRAM_BUCKETS];
+} worker;
+
+static struct {
+    struct sockaddr_in addr;
+    const char *host_header;
+    int connections;
+    int threads;
+    int pipeline;
+    double seconds;
+    const char *name;
+    target targets[MAX_TARGETS];
+    int target_count;
+    long long deadline;
+} options = {
+    .connections = 32,
+    .threads = 1,
+    .pipeline = 1,
+    .seconds = 5,
+    .name = "load"
+};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (int)value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    int index = (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+// Highest value that lands in a bucket
+static uint64_t bucket_limit(int index) {
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_COUNT - 1;
+    uint64_t lowest = (uint64_t)(HISTOGRAM_SUB_COUNT + index % HISTOGRAM_SUB_COUNT) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t percentile(const unsigned long long *histogram, unsigned long long count, double q) {
+    unsigned long long rank = (unsigned long long)(q * count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return bucket_limit(i);
+        }
+    }
+    return 0;
+}
+
+// "GET /path" or just "/path" becomes a complete request
+static int add_target(const char *spec) {
+    if (options.target_count == MAX_TARGETS) {
+        return -1;
+    }
+
+    const char *method = "GET";
+    const char *path = spec;
+    char method_buf[16];
+    const char *space = strchr(spec, ' ');
+    if (space && (size_t)(space - spec) < sizeof(method_buf)) {
+        memcpy(method_buf, spec, space - spec);
+        method_buf[space - spec] = '\0';
+        method = method_buf;
+        path = space + 1;
+    }
+
+    char *request;
+    int length;
+    if (strcmp(method, "POST") == 0) {
+        static const char body[] = "{\"ping\":1}";
+        length = asprintf(&request, "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n\r\n%s", path, options.host_header, sizeof(body) - 1, body);
+    } else {
+        length = asprintf(&request, "%s %s HTTP/1.1\r\nHost: %s\r\n\r\n", method, path, options.host_header);
+    }
+    if (length < 0) {
+        return -1;
+    }
+
+    options.targets[options.target_count].request = request;
+    options.targets[options.target_count].length = length;
+    options.target_count++;
+    return 0;
+}
+
+static void update_events(worker *w, client *c) {
+    int want_write = c->out_sent < c->out_len || !c->connected;
+    if (want_write == c->want_write) {
+        return;
+    }
+    struct epoll_event event = {
+        .events = EPOLLIN | (want_write ? EPOLLOUT : 0),
+        .data.ptr = c
+    };
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+    c->want_write = want_write;
+}
+
+// Top the pipeline up with the next targets
+static void fill_pipeline(client *c) {
+    long long now = now_ns();
+    while (c->in_flight < options.pipeline && now < options.deadline) {
+        const target *t = &options.targets[c->next_target];
+        if (c->out_len + t->length > OUT_MAX) {
+            break;
+        }
+        c->next_target = (c->next_target + 1) % options.target_count;
+
+        memcpy(c->out + c->out_len, t->request, t->length);
+        c->out_len += t->length;
+        c->sent_at[(c->oldest + c->in_flight) % MAX_PIPELINE] = now;
+        c->in_flight++;
+    }
+}
+
+static int open_client(worker *w, client *c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd == -1) {
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    if (connect(c->fd, (struct sockaddr *)&options.addr, sizeof(options.addr)) == -1 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    c->connected = 0;
+    c->want_write = 1;
+    c->out_len = 0;
+    c->out_sent = 0;
+    c->in_flight = 0;
+    c->oldest = 0;
+    c->state = READ_HEAD;
+    c->head_len = 0;
+    c->close_after = 0;
+    fill_pipeline(c);
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT,
+        .data.ptr = c
+    };
+    return epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, c->fd, &event);
+}
+
+// Drop the connection, requests still in flight are lost, and start over unless the run is over
+static void reconnect(worker *w, client *c) {
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    if (now_ns() < options.deadline) {
+        w->reconnects++;
+        if (open_client(w, c) == -1) {
+            w->errors++;
+        }
+    }
+}
+
+static void complete_response(worker *w, client *c) {
+    long long latency = now_ns() - c->sent_at[c->oldest];
+    c->oldest = (c->oldest + 1) % MAX_PIPELINE;
+    c->in_flight--;
+
+    w->requests++;
+    w->histogram[bucket_index(latency > 0 ? (uint64_t)latency : 0)]++;
+    w->statuses[c->status >= 100 && c->status < 600 ? c->status / 100 : 0]++;
+    if (c->status < 200 || c->status >= 400) {
+        w->errors++;
+    }
+
+    c->state = READ_HEAD;
+    c->head_len = 0;
+}
+
+// Read framing information off a complete response head
+static void parse_head(client *c) {
+    c->head[c->head_len] = '\0';
+    c->status = c->head_len > 12 ? atoi(c->head + 9) : 0;
+    c->close_after = strcasestr(c->head, "\nConnection: close") != NULL;
+
+    const char *length = strcasestr(c->head, "\nContent-Length:");
+    if (strcasestr(c->head, "\nTransfer-Encoding: chunked")) {
+        c->state = READ_CHUNK_SIZE;
+        c->line_len = 0;
+    } else if (length) {
+        c->remaining = atoll(length + 16);
+        c->state = READ_BODY;
+    } else {
+        c->state = READ_UNTIL_CLOSE;
+    }
+}
+
+// Feed received bytes through the response framing, returns -1 once the connection must be dropped
+static int consume(worker *w, client *c, const char *data, size_t length) {
+    const char *end = data + length;
+    while (data < end) {
+        switch (c->state) {
+        case READ_HEAD:
+            while (data < end) {
+                if (c->head_len == HEAD_MAX - 1) {
+                    return -1;
+                }
+                c->head[c->head_len++] = *data++;
+                if (c->head_len >= 4 && memcmp(c->head + c->head_len - 4, "\r\n\r\n", 4) == 0) {
+                    parse_head(c);
+                    break;
+                }
+            }
+            if (c->state == READ_BODY && c->remaining == 0) {
+                complete_response(w, c);
+            }
+            break;
+
+        case READ_BODY: {
+            size_t step = (size_t)c->remaining < (size_t)(end - data) ? (size_t)c->remaining : (size_t)(end - data);
+            data += step;
+            c->remaining -= step;
+            if (c->remaining == 0) {
+                complete_response(w, c);
+            }
+            break;
+        }
+
+        case READ_CHUNK_SIZE:
+            while (data < end) {
+                char ch = *data++;
+                if (ch == '\n') {
+                    c->head[c->line_len] = '\0';
+                    c->remaining = strtoll(c->head, NULL, 16) + 2;
+                    c->state = c->remaining == 2 ? READ_TRAILER : READ_CHUNK_DATA;
+                    c->line_len = 0;
+                    break;
+                }
+                if (c->line_len < 31) {
+                    c->head[c->line_len++] = ch;
+                }
+            }
+            break;
+
+        case READ_CHUNK_DATA: {
+            size_t step = (size_t)c->remaining < (size_t)(end - data) ? (size_t)c->remaining : (size_t)(end - data);
+            data += step;
+            c->remaining -= step;
+            if (c->remaining == 0) {
+                c->state = READ_CHUNK_SIZE;
+            }
+            break;
+        }
+
+        case READ_TRAILER:
+            while (data < end) {
+                char ch = *data++;
+                if (ch == '\n') {
+                    if (c->line_len <= 1) {
+                        complete_response(w, c);
+                        break;
+                    }
+                    c->line_len = 0;
+                } else {
+                    c->line_len++;
+                }
+            }
+            break;
+
+        case READ_UNTIL_CLOSE:
+            return 0;
+        }
+
+        if (c->state == READ_HEAD && c->close_after) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void handle_writable(worker *w, client *c) {
+    if (!c->connected) {
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &error_length);
+        if (error) {
+            w->errors++;
+            reconnect(w, c);
+            return;
+        }
+        c->connected = 1;
+
+        // Latency is measured from when the requests can actually leave, connection setup is not included
+        long long now = now_ns();
+        for (int i = 0; i < c->in_flight; i++) {
+            c->sent_at[(c->oldest + i) % MAX_PIPELINE] = now;
+        }
+    }
+
+    while (c->out_sent < c->out_len) {
+        ssize_t sent = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                w->errors++;
+                reconnect(w, c);
+                return;
+            }
+            break;
+        }
+        c->out_sent += sent;
+    }
+    if (c->out_sent == c->out_len) {
+        c->out_len = 0;
+        c->out_sent = 0;
+    }
+    update_events(w, c);
+}
+
+static void handle_readable(worker *w, client *c, char *buffer) {
+    for (;;) {
+        ssize_t received = recv(c->fd, buffer, READ_CHUNK, 0);
+        if (received > 0) {
+            w->bytes += received;
+            if (consume(w, c, buffer, received) == -1) {
+                reconnect(w, c);
+                return;
+            }
+            continue;
+        }
+        if (received == 0) {
+            if (c->state == READ_UNTIL_CLOSE) {
+                complete_response(w, c);
+            }
+            reconnect(w, c);
+            return;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN) {
+            break;
+        }
+        w->errors++;
+        reconnect(w, c);
+        return;
+    }
+
+    // Responses that came back make room for new requests
+    fill_pipeline(c);
+    handle_writable(w, c);
+}
+
+static void *run_worker(void *arg) {
+    worker *w = arg;
+    char *buffer = malloc(READ_CHUNK);
+    struct epoll_event events[256];
+
+    for (int i = 0; i < w->client_count; i++) {
+        if (open_client(w, &w->clients[i]) == -1) {
+            w->errors++;
+        }
+    }
+
+    while (now_ns() < options.deadline) {
+        int ready = epoll_wait(w->epoll_fd, events, 256, 50);
+        for (int i = 0; i < ready; i++) {
+            client *c = events[i].data.ptr;
+            if (events[i].events & (EPOLLOUT | EPOLLERR)) {
+                handle_writable(w, c);
+            }
+            if (c->fd != -1 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                handle_readable(w, c, buffer);
+            }
+        }
+    }
+
+    for (int i = 0; i < w->client_count; i++) {
+        if (w->clients[i].fd != -1) {
+            close(w->clients[i].fd);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [-a address] [-p port] [-c connections] [-t threads] [-P pipeline] [-d seconds] [-n name]"
+            " target...\n"
+            "  target is a path, or a method and path such as \"POST /ping\"\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *address = "127.0.0.1";
+    int port = 8080;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:c:t:P:d:n:")) != -1) {
+        switch (opt) {
+        case 'a': address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'c': options.connections = atoi(optarg); break;
+        case 't': options.threads = atoi(optarg); break;
+        case 'P': options.pipeline = atoi(optarg); break;
+        case 'd': options.seconds = atof(optarg); break;
+        case 'n': options.name = optarg; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (optind == argc || options.connections < 1 || options.threads < 1 ||
+        options.pipeline < 1 || options.pipeline > MAX_PIPELINE || options.seconds <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.threads > options.connections) {
+        options.threads = options.connections;
+    }
+
+    options.addr.sin_family = AF_INET;
+    options.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &options.addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", address);
+        return EXIT_FAILURE;
+    }
+    options.host_header = address;
+    for (int i = optind; i < argc; i++) {
+        if (add_target(argv[i]) == -1) {
+            fprintf(stderr, "Too many targets\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    worker *workers = calloc(options.threads, sizeof(worker));
+    client *clients = calloc(options.connections, sizeof(client));
+    if (!workers || !clients) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    long long start = now_ns();
+    options.deadline = start + (long long)(options.seconds * 1e9);
+    int assigned = 0;
+    for (int i = 0; i < options.threads; i++) {
+        worker *w = &workers[i];
+        w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        w->clients = clients + assigned;
+        w->client_count = options.connections / options.threads + (i < options.connections % options.threads);
+        assigned += w->client_count;
+        pthread_create(&w->thread, NULL, run_worker, w);
+    }
+
+    worker total = {0};
+    for (int i = 0; i < options.threads; i++) {
+        worker *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        close(w->epoll_fd);
+        total.requests += w->requests;
+        total.errors += w->errors;
+        total.reconnects += w->reconnects;
+        total.bytes += w->bytes;
+        for (int s = 0; s < 6; s++) {
+            total.statuses[s] += w->statuses[s];
+        }
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            total.histogram[b] += w->histogram[b];
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    // One JSON object per run, latencies in microseconds
+    printf("{\"name\":\"%s\",\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"seconds\":%.3f,"
+           "\"requests\":%llu,\"errors\":%llu,\"reconnects\":%llu,\"status_2xx\":%llu,\"status_3xx\":%llu,"
+           "\"status_4xx\":%llu,\"status_5xx\":%llu,\"rps\":%.1f,\"bytes\":%llu,\"mib_per_s\":%.2f,"
+           "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+           options.name, options.connections, options.threads, options.pipeline, elapsed,
+           total.requests, total.errors, total.reconnects, total.statuses[2], total.statuses[3],
+           total.statuses[4], total.statuses[5], total.requests / elapsed, total.bytes,
+           total.bytes / elapsed / (1024 * 1024),
+           percentile(total.histogram, total.requests, 0.5) / 1e3,
+           percentile(total.histogram, total.requests, 0.99) / 1e3,
+           percentile(total.histogram, total.requests, 0.999) / 1e3,
+           percentile(total.histogram, total.requests, 1.0) / 1e3);
+
+    free(clients);
+    free(workers);
+    return total.requests > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
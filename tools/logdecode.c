@@ -0,0 +1,163 @@
+// Turn a binary log written with LOG_FORMAT=binary back into text lines
+#include "log_record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_RECORD (1024 * 1024)
+
+// Strings described so far in the current run, keyed by the pointer they were logged under
+typedef struct {
+    uint64_t pointer;
+    char *text;
+} string_slot;
+
+static struct {
+    string_slot *slots;
+    size_t capacity;
+    size_t count;
+} strings;
+
+static void clear_strings(void) {
+    for (size_t i = 0; i < strings.capacity; i++) {
+        free(strings.slots[i].text);
+        strings.slots[i].text = NULL;
+        strings.slots[i].pointer = 0;
+    }
+    strings.count = 0;
+}
+
+static string_slot *find_slot(uint64_t pointer) {
+    size_t index = (pointer >> 3) % strings.capacity;
+    while (strings.slots[index].text && strings.slots[index].pointer != pointer) {
+        index = (index + 1) % strings.capacity;
+    }
+    return &strings.slots[index];
+}
+
+static const char *lookup_string(uint64_t pointer) {
+    if (strings.capacity == 0) {
+        return NULL;
+    }
+    return find_slot(pointer)->text;
+}
+
+static int define_string(uint64_t pointer, const char *text, size_t length) {
+    if (strings.count * 2 >= strings.capacity) {
+        string_slot *old = strings.slots;
+        size_t old_capacity = strings.capacity;
+        strings.capacity = old_capacity ? old_capacity * 2 : 256;
+        strings.slots = calloc(strings.capacity, sizeof(string_slot));
+        if (!strings.slots) {
+            return -1;
+        }
+        strings.count = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].text) {
+                *find_slot(old[i].pointer) = old[i];
+                strings.count++;
+            }
+        }
+        free(old);
+    }
+
+    string_slot *slot = find_slot(pointer);
+    char *copy = malloc(length + 1);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    if (!slot->text) {
+        strings.count++;
+    }
+    free(slot->text);
+    slot->pointer = pointer;
+    slot->text = copy;
+    return 0;
+}
+
+static int decode(FILE *input, const char *name) {
+    char *record = malloc(MAX_RECORD);
+    char *line = malloc(MAX_RECORD);
+    if (!record || !line) {
+        fprintf(stderr, "Out of memory\n");
+        free(record);
+        free(line);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    log_record header;
+    while (fread(&header, sizeof(header), 1, input) == 1) {
+        if (header.length < sizeof(header) || header.length > MAX_RECORD) {
+            fprintf(stderr, "%s: corrupt record of %u bytes\n", name, header.length);
+            status = EXIT_FAILURE;
+            break;
+        }
+        memcpy(record, &header, sizeof(header));
+        size_t payload = header.length - sizeof(header);
+        if (fread(record + sizeof(header), 1, payload, input) != payload) {
+            fprintf(stderr, "%s: truncated record\n", name);
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        switch (header.kind) {
+            case LOG_RECORD_START:
+                clear_strings();
+                break;
+            case LOG_RECORD_STRING:
+                if (define_string(header.format, record + sizeof(header), payload) == -1) {
+                    fprintf(stderr, "Out of memory\n");
+                    status = EXIT_FAILURE;
+                }
+                break;
+            case LOG_RECORD_MESSAGE: {
+                const char *fmt = lookup_string(header.format);
+                const char *file = lookup_string(header.file);
+                size_t length = log_record_render((const log_record *)record, fmt ? fmt : "<unknown format>",
+                                                  file ? file : "?", line, MAX_RECORD);
+                fwrite(line, 1, length, stdout);
+                break;
+            }
+            default:
+                fprintf(stderr, "%s: unknown record kind %u\n", name, header.kind);
+                break;
+        }
+        if (status != EXIT_SUCCESS) {
+            break;
+        }
+    }
+
+    free(record);
+    free(line);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: %s [server.log.bin]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *input = stdin;
+    const char *name = "stdin";
+    if (argc == 2) {
+        name = argv[1];
+        input = fopen(name, "rb");
+        if (!input) {
+            perror(name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int status = decode(input, name);
+    if (input != stdin) {
+        fclose(input);
+    }
+    clear_strings();
+    free(strings.slots);
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+// Microbenchmarks of hot paths shared with the server, one JSON object per benchmark
+#include "mime_types.h"
+#include "http_parser.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static volatile size_t sink;
+
+static const char *paths[] = {
+    "./www/index.html", "./www/css/site.css", "./www/js/app.min.js", "./www/img/logo.png",
+    "./www/img/photo.JPEG", "./www/fonts/body.woff2", "./www/data/report.json", "./www/docs/manual.pdf",
+    "./www/video/intro.mp4", "./www/archive.tar.gz", "./www/README", "./www/bench/small/17.txt"
+};
+#define PATH_COUNT (sizeof(paths) / sizeof(paths[0]))
+
+static const char request[] =
+    "GET /bench/small/17.txt?v=3 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "If-None-Match: \"1a2b3c-400-65f0a1b2\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, long ops, long long elapsed) {
+    printf("{\"bench\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.1f,\"ops_per_s\":%.0f}\n",
+           name, ops, (double)elapsed / ops, ops / (elapsed / 1e9));
+}
+
+static void bench_mime(long ops) {
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        sink += (size_t)mime_lookup(paths[i % PATH_COUNT]);
+    }
+    report("mime_lookup", ops, now_ns() - start);
+}
+
+static void bench_parser(long ops) {
+    http_request_t req;
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        http_parser_init(&req);
+        if (http_parse_request(&req, request, sizeof(request) - 1) != HTTP_PARSE_DONE) {
+            fprintf(stderr, "Benchmark request failed to parse\n");
+            exit(EXIT_FAILURE);
+        }
+        sink += req.header_count + (size_t)http_get_header(&req, "If-None-Match");
+    }
+    report("http_parse_request", ops, now_ns() - start);
+}
+
+static void bench_logger(long ops) {
+    long long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        INFO("Request from %s: %s %s %s", "127.0.0.1", "GET", paths[i % PATH_COUNT], "HTTP/1.1");
+    }
+    report("log_message", ops, now_ns() - start);
+
+    start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        DEBUG("Filtered out at the default level: %ld", i);
+    }
+    report("log_message_filtered", ops, now_ns() - start);
+}
+
+int main(int argc, char **argv) {
+    long ops = argc > 1 ? atol(argv[1]) : 1000000;
+    const char *log_path = argc > 2 ? argv[2] : "/dev/null";
+    if (ops <= 0) {
+        fprintf(stderr, "usage: %s [operations] [log file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Measure the writer keeping up rather than lines being dropped
+    setenv("LOG_OVERFLOW", "block", 0);
+    setenv("LOG_LEVEL", "INFO", 0);
+    if (logger_init(log_path) != 0) {
+        fprintf(stderr, "Failed to initialize logger\n");
+        return EXIT_FAILURE;
+    }
+
+    if (mime_types_init(NULL) != 0) {
+        fprintf(stderr, "Failed to initialize MIME types\n");
+        return EXIT_FAILURE;
+    }
+
+    bench_mime(ops);
+    bench_parser(ops);
+    bench_logger(ops);
+
+    mime_types_cleanup();
+    logger_cleanup();
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
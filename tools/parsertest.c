@@ -0,0 +1,95 @@
+// Request parser checks, one line per failing case, exits non-zero when any fails
+#include "http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    const char *name;
+    const char *request;
+    size_t length;              // Requests may hold a NUL
+    http_parse_result result;
+    int chunked;                // Expected framing when the head parses
+    long long content_length;
+} parse_case;
+
+#define REQUEST(text) text, sizeof(text) - 1
+
+static const parse_case cases[] = {
+    { "plain GET", REQUEST("GET / HTTP/1.1\r\nHost: a\r\n\r\n"), HTTP_PARSE_DONE, 0, -1 },
+    { "extension method", REQUEST("M-SEARCH * HTTP/1.1\r\n\r\n"), HTTP_PARSE_DONE, 0, -1 },
+    { "separator in method", REQUEST("GE(T / HTTP/1.1\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "control byte in method", REQUEST("G\x01T / HTTP/1.1\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "method without target", REQUEST("GET\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "token characters in name",
+      REQUEST("GET / HTTP/1.1\r\nX-A!#$%&'*+.^_`|~9: v\r\n\r\n"),
+      HTTP_PARSE_DONE, 0, -1 },
+    { "space before colon", REQUEST("GET / HTTP/1.1\r\nHost : a\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "empty name", REQUEST("GET / HTTP/1.1\r\n: a\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "name without colon", REQUEST("GET / HTTP/1.1\r\nHost\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "high byte in name", REQUEST("GET / HTTP/1.1\r\nHo\xc3\xa9st: a\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "visible value bytes",
+      REQUEST("GET / HTTP/1.1\r\nX: a\tb \"(,/:;<=>?@[\\]{})\" ~\r\n\r\n"),
+      HTTP_PARSE_DONE, 0, -1 },
+    { "obs-text in value", REQUEST("GET / HTTP/1.1\r\nX: caf\xc3\xa9\r\n\r\n"), HTTP_PARSE_DONE, 0, -1 },
+    { "NUL in value", REQUEST("GET / HTTP/1.1\r\nX: a\0b\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "control byte in value", REQUEST("GET / HTTP/1.1\r\nX: a\x01" "b\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "bare CR in value", REQUEST("GET / HTTP/1.1\r\nX: a\rb\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "CR before CRLF", REQUEST("GET / HTTP/1.1\r\nX: a\r\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "DEL in value", REQUEST("GET / HTTP/1.1\r\nX: a\x7f\r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "content length", REQUEST("POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n"), HTTP_PARSE_DONE, 0, 5 },
+    { "repeated content length", REQUEST("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n"),
+      HTTP_PARSE_DONE, 0, 5 },
+    { "conflicting content length", REQUEST("POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"), HTTP_PARSE_DONE, 1, -1 },
+    { "chunked any case", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n"), HTTP_PARSE_DONE, 1, -1 },
+    { "chunked among empty elements", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: , chunked ,\r\n\r\n"),
+      HTTP_PARSE_DONE, 1, -1 },
+    { "chunked before another coding", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked after another coding", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked between codings", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked, identity\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked twice in a list", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, chunked\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked twice in headers",
+      REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "coding split over headers",
+      REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked with parameters", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked;x=1\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "empty transfer encoding", REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: \r\n\r\n"), HTTP_PARSE_ERROR, 0, -1 },
+    { "length then chunked",
+      REQUEST("POST / HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 },
+    { "chunked then length",
+      REQUEST("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n"),
+      HTTP_PARSE_ERROR, 0, -1 }
+};
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+int main(void) {
+    int failed = 0;
+    for (size_t i = 0; i < CASE_COUNT; i++) {
+        const parse_case *c = &cases[i];
+        http_request_t req;
+        http_parser_init(&req);
+        http_parse_result result = http_parse_request(&req, c->request, c->length);
+
+        if (result != c->result) {
+            printf("FAIL %s: result %d, expected %d\n", c->name, result, c->result);
+            failed++;
+        } else if (result == HTTP_PARSE_DONE &&
+                   (req.chunked != c->chunked || req.content_length != c->content_length)) {
+            printf("FAIL %s: chunked %d length %lld, expected %d and %lld\n", c->name, req.chunked,
+                   req.content_length, c->chunked, c->content_length);
+            failed++;
+        }
+    }
+
+    printf("%zu of %zu parser cases passed\n", CASE_COUNT - failed, CASE_COUNT);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
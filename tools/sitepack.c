@@ -0,0 +1,459 @@
+// Pack a static site into one archive for SITE_PACK: a hashed path index, and for every file its
+// rendered response heads, ETags and gzip and brotli variants, with a listing for every directory
+#include "site_pack.h"
+#include "config.h"
+#include "mime_types.h"
+#include "compression.h"
+#include "directory_listing.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define DEFAULT_OUTPUT "site.pack"
+
+// A path to pack, key being the decoded request path it answers
+typedef struct {
+    char *key;
+    char *file_path;
+    int directory;
+} source;
+
+static struct {
+    source *items;
+    size_t count;
+    size_t capacity;
+} sources;
+
+// Content-Type and policy lines written so far, shared by every entry of the same type
+typedef struct {
+    const mime_entry *mime;
+    uint64_t type_header;
+    uint64_t policy_headers;
+} type_lines;
+
+static struct {
+    FILE *file;
+    const char *name;
+    uint64_t offset;
+    int failed;
+    pack_entry *entries;
+    type_lines *types;
+    size_t type_count;
+} output;
+
+static int add_source(const char *key, const char *file_path, int directory) {
+    if (sources.count == sources.capacity) {
+        size_t capacity = sources.capacity ? sources.capacity * 2 : 1024;
+        source *grown = realloc(sources.items, capacity * sizeof(source));
+        if (!grown) {
+            return -1;
+        }
+        sources.items = grown;
+        sources.capacity = capacity;
+    }
+
+    source *item = &sources.items[sources.count];
+    item->key = strdup(key);
+    item->file_path = strdup(file_path);
+    item->directory = directory;
+    if (!item->key || !item->file_path) {
+        free(item->key);
+        free(item->file_path);
+        return -1;
+    }
+    sources.count++;
+    return 0;
+}
+
+// Gather everything under dir_path, following symlinks. A directory answers with and without its
+// trailing slash, as it does when served from disk
+static int collect(const char *dir_path, const char *key) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(stderr, "%s: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char child_path[SMALL_BUFFER * 4];
+        char child_key[SMALL_BUFFER];
+        if (snprintf(child_path, sizeof(child_path), "%s/%s", dir_path, entry->d_name) >= (int)sizeof(child_path) ||
+            snprintf(child_key, sizeof(child_key), "%s/%s", key, entry->d_name) >= (int)sizeof(child_key) - 1) {
+            fprintf(stderr, "%s: path too long, skipped\n", child_path);
+            continue;
+        }
+
+        struct stat st;
+        if (stat(child_path, &st) == -1) {
+            fprintf(stderr, "%s: %s, skipped\n", child_path, strerror(errno));
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) {
+            result = add_source(child_key, child_path, 0);
+        } else if (S_ISDIR(st.st_mode)) {
+            result = add_source(child_key, child_path, 1);
+            if (result == 0) {
+                size_t key_length = strlen(child_key);
+                char slashed[SMALL_BUFFER * 4 + 1];
+                snprintf(slashed, sizeof(slashed), "%s/", child_path);
+                memcpy(child_key + key_length, "/", 2);
+                result = add_source(child_key, slashed, 1);
+                child_key[key_length] = '\0';
+            }
+            if (result == 0) {
+                result = collect(child_path, child_key);
+            }
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+static uint64_t write_bytes(const void *data, size_t length) {
+    uint64_t offset = output.offset;
+    if (length > 0 && fwrite(data, 1, length, output.file) != length) {
+        output.failed = 1;
+    }
+    output.offset += length;
+    return offset;
+}
+
+// Write a string followed by a NUL, which the length leaves out
+static uint64_t write_string(const char *data, size_t length) {
+    uint64_t offset = write_bytes(data, length);
+    write_bytes("", 1);
+    return offset;
+}
+
+static void align_output(size_t alignment) {
+    static const char zeros[8];
+    write_bytes(zeros, (alignment - output.offset % alignment) % alignment);
+}
+
+static const type_lines *lines_for(const mime_entry *mime) {
+    for (size_t i = 0; i < output.type_count; i++) {
+        if (output.types[i].mime == mime) {
+            return &output.types[i];
+        }
+    }
+
+    type_lines *grown = realloc(output.types, (output.type_count + 1) * sizeof(type_lines));
+    if (!grown) {
+        output.failed = 1;
+        return NULL;
+    }
+    output.types = grown;
+    type_lines *lines = &output.types[output.type_count++];
+    lines->mime = mime;
+    lines->type_header = write_string(mime->type_header, mime->type_header_length);
+    lines->policy_headers = write_string(mime->policy_headers, mime->policy_headers_length);
+    return lines;
+}
+
+// Read a whole file, returns NULL when it can't be
+static char *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fileno(file), &st) == 0) {
+        data = malloc(st.st_size > 0 ? st.st_size : 1);
+        if (data && fread(data, 1, st.st_size, file) != (size_t)st.st_size) {
+            free(data);
+            data = NULL;
+        }
+        *length = st.st_size;
+    }
+    fclose(file);
+    return data;
+}
+
+// 64-bit FNV-1a of the content, which stands in for the inode and mtime of ETags served from disk
+static uint64_t content_hash(const char *data, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Write one representation: the head file responses render, its ETag and its body
+static void write_variant(pack_variant *variant, const pack_entry *entry, const mime_entry *mime,
+                          const char *encoding, const char *body, size_t length) {
+    char etag[64];
+    int etag_length = snprintf(etag, sizeof(etag), "\"%zx-%016llx%s%s\"", length,
+                               (unsigned long long)content_hash(body, length), encoding ? "-" : "",
+                               encoding ? encoding : "");
+
+    char head[SMALL_BUFFER];
+    int head_length = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\n"
+        "%s"
+        "Content-Length: %zu\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "ETag: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "%s"
+        "%s%s%s",
+        mime->type_header, length, etag, entry->last_modified, mime->policy_headers,
+        encoding ? "Content-Encoding: " : "", encoding ? encoding : "", encoding ? "\r\n" : "");
+
+    if (head_length >= (int)sizeof(head)) {
+        fprintf(stderr, "Response head for %s too long\n", mime->mime_type);
+        output.failed = 1;
+        return;
+    }
+
+    variant->etag = write_bytes(etag, etag_length);
+    variant->etag_length = etag_length;
+    variant->head = write_bytes(head, head_length);
+    variant->head_length = head_length;
+    variant->body = write_bytes(body, length);
+    variant->body_length = length;
+}
+
+// Use a precompressed sibling such as app.js.gz when there is one
+static int write_sibling(pack_variant *variant, const pack_entry *entry, const mime_entry *mime,
+                         const char *file_path, const char *suffix, const char *encoding) {
+    char sibling[SMALL_BUFFER * 4 + 8];
+    snprintf(sibling, sizeof(sibling), "%s%s", file_path, suffix);
+    struct stat st;
+    if (stat(sibling, &st) == -1 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    size_t length;
+    char *data = read_file(sibling, &length);
+    if (!data) {
+        fprintf(stderr, "%s: %s, skipped\n", sibling, strerror(errno));
+        return 0;
+    }
+    write_variant(variant, entry, mime, encoding, data, length);
+    free(data);
+    return 1;
+}
+
+static int pack_file(pack_entry *entry, const source *item) {
+    struct stat st;
+    size_t length;
+    char *data = read_file(item->file_path, &length);
+    if (!data || stat(item->file_path, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", item->file_path, strerror(errno));
+        free(data);
+        return -1;
+    }
+
+    const mime_entry *mime = mime_lookup(item->file_path);
+    const type_lines *lines = lines_for(mime);
+    if (!lines) {
+        free(data);
+        return -1;
+    }
+    entry->flags = mime->compressible ? PACK_COMPRESSIBLE : 0;
+    entry->type_header = lines->type_header;
+    entry->type_header_length = mime->type_header_length;
+    entry->policy_headers = lines->policy_headers;
+    entry->policy_headers_length = mime->policy_headers_length;
+    entry->mtime = st.st_mtime;
+
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    write_variant(&entry->variants[PACK_IDENTITY], entry, mime, NULL, data, length);
+
+    // Encoded variants as served from disk, except that gzip has no size cap when compressed here
+    if (mime->compressible) {
+        write_sibling(&entry->variants[PACK_BR], entry, mime, item->file_path, ".br", "br");
+        if (!write_sibling(&entry->variants[PACK_GZIP], entry, mime, item->file_path, ".gz", "gzip") &&
+            length >= COMPRESS_MIN_SIZE) {
+            char *compressed = NULL;
+            size_t compressed_length = 0;
+            if (gzip_compress(data, length, &compressed, &compressed_length) == 0 && compressed_length < length) {
+                write_variant(&entry->variants[PACK_GZIP], entry, mime, "gzip", compressed, compressed_length);
+            }
+            free(compressed);
+        }
+    }
+    free(data);
+    return 0;
+}
+
+// Listing rendered into memory as it would be streamed
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} listing_buffer;
+
+static void keep_listing(void *arg, const char *data, size_t length) {
+    listing_buffer *buffer = arg;
+    if (buffer->failed) {
+        return;
+    }
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : LISTING_CHUNK_SIZE;
+        while (capacity < buffer->length + length) capacity *= 2;
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+// A listing goes out whole with the head a cached listing has
+static int pack_listing(pack_entry *entry, const source *item) {
+    listing_buffer buffer = {0};
+    struct stat st;
+    if (generate_directory_listing(item->file_path, &st, keep_listing, &buffer) == -1 || buffer.failed) {
+        fprintf(stderr, "%s: %s\n", item->file_path, strerror(errno));
+        free(buffer.data);
+        return -1;
+    }
+
+    char head[SMALL_BUFFER];
+    int head_length = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: %zu\r\n"
+        "Cache-Control: no-cache\r\n",
+        buffer.length);
+
+    // Entries point at an empty Content-Type line, listings never use it
+    pack_variant *variant = &entry->variants[PACK_IDENTITY];
+    entry->flags = PACK_LISTING;
+    entry->type_header = write_string("", 0);
+    entry->mtime = st.st_mtime;
+    variant->head = write_bytes(head, head_length);
+    variant->head_length = head_length;
+    variant->body = write_bytes(buffer.data, buffer.length);
+    variant->body_length = buffer.length;
+    free(buffer.data);
+    return 0;
+}
+
+static int write_pack(const char *root) {
+    pack_header header = { .version = SITE_PACK_VERSION, .entry_count = sources.count };
+    memcpy(header.magic, SITE_PACK_MAGIC, sizeof(header.magic));
+    write_bytes(&header, sizeof(header));
+
+    output.entries = calloc(sources.count, sizeof(pack_entry));
+    if (!output.entries) {
+        return -1;
+    }
+    size_t listings = 0;
+    for (size_t i = 0; i < sources.count && !output.failed; i++) {
+        const source *item = &sources.items[i];
+        pack_entry *entry = &output.entries[i];
+        entry->path_length = strlen(item->key);
+        entry->path = write_bytes(item->key, entry->path_length);
+        entry->hash = site_pack_hash(item->key, entry->path_length);
+        if ((item->directory ? pack_listing(entry, item) : pack_file(entry, item)) == -1) {
+            return -1;
+        }
+        listings += item->directory;
+    }
+
+    // The table stays at most half full so probing ends quickly
+    uint32_t slot_count = 2;
+    while (slot_count < sources.count * 2) slot_count *= 2;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < sources.count; i++) {
+        uint32_t slot = output.entries[i].hash & (slot_count - 1);
+        while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = i + 1;
+    }
+
+    align_output(sizeof(uint64_t));
+    header.entries = write_bytes(output.entries, sources.count * sizeof(pack_entry));
+    header.slot_count = slot_count;
+    header.slots = write_bytes(slots, slot_count * sizeof(uint32_t));
+    header.size = output.offset;
+    free(slots);
+
+    if (fseek(output.file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, output.file) != 1) {
+        output.failed = 1;
+    }
+    if (output.failed) {
+        return -1;
+    }
+    fprintf(stderr, "Packed %zu files and %zu listings from %s into %s, %llu bytes\n",
+            sources.count - listings, listings, root, output.name, (unsigned long long)header.size);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: %s [root, default " ROOT_DIR "] [output, default " DEFAULT_OUTPUT "]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *root = argc > 1 ? argv[1] : ROOT_DIR;
+    output.name = argc > 2 ? argv[2] : DEFAULT_OUTPUT;
+
+    // Types resolve as they would in the server, MIME_TYPES included
+    const char *mime_types = getenv("MIME_TYPES");
+    if (logger_init("/dev/stderr") != 0 || mime_types_init(mime_types && *mime_types ? mime_types : NULL) < 0) {
+        fprintf(stderr, "Failed to initialize the MIME table\n");
+        return EXIT_FAILURE;
+    }
+
+    // Listings are titled with the path they are read from, the server reads them from ROOT_DIR
+    char root_slash[SMALL_BUFFER * 4];
+    snprintf(root_slash, sizeof(root_slash), "%s/", root);
+    int result = add_source("/", root_slash, 1) == 0 && collect(root, "") == 0 ? 0 : -1;
+
+    if (result == 0) {
+        // Written to a temporary name and renamed, so a running server never maps a partial pack
+        char partial[SMALL_BUFFER * 4];
+        snprintf(partial, sizeof(partial), "%s.tmp", output.name);
+        output.file = fopen(partial, "wb");
+        if (!output.file) {
+            perror(partial);
+            result = -1;
+        } else {
+            result = write_pack(root);
+            if (fclose(output.file) != 0 || (result == 0 && rename(partial, output.name) != 0)) {
+                perror(output.name);
+                result = -1;
+            }
+            if (result != 0) {
+                fprintf(stderr, "Failed to write %s\n", output.name);
+                remove(partial);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sources.count; i++) {
+        free(sources.items[i].key);
+        free(sources.items[i].file_path);
+    }
+    free(sources.items);
+    free(output.entries);
+    free(output.types);
+    mime_types_cleanup();
+    logger_cleanup();
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file